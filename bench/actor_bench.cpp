@@ -0,0 +1,99 @@
+#include "bench.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unistd.h>
+
+#include "actor.h"
+#include "fs.h"
+
+using namespace LuauPi;
+
+// Each worker takes a count of units from its parent, runs them, and sends back what it computed.
+// A unit is a fixed amount of arithmetic with no allocation, so workers share nothing but the CPU:
+static const char* const kWorkerScript = R"(
+local parent, units = actor.recv()
+local x = 1
+for u = 1, units do
+	for i = 1, 10000 do
+		x = (x * 1103515245 + 12345) % 2147483648
+	end
+end
+parent:send(x)
+)";
+
+// Spawns workers, hands each its units once all are up, then waits for every reply:
+static std::string parent_script(const std::string& worker_path, int workers, uint64_t units)
+{
+	char source[1024];
+	snprintf(source, sizeof(source), R"(
+local workers = {}
+for i = 1, %d do
+	workers[i] = actor.spawn("%s")
+end
+for _, worker in workers do
+	worker:send(%llu)
+end
+for i = 1, #workers do
+	actor.recv()
+end
+)", workers, worker_path.c_str(), static_cast<unsigned long long>(units));
+
+	return source;
+}
+
+// Every worker count from 1 to one per core, each worker running as many units as the iteration count.
+// With no shared work the throughput should grow with the count, so scaling_N is close to N until the
+// cores run out. Spawning and compiling are included, and amortized as the iteration count grows:
+BENCH(actor_parallel_scaling)
+{
+	int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+
+	std::string prefix = "/tmp/luaupi-bench-actors-" + std::to_string(getpid());
+	std::string worker_path = prefix + "-worker.luau";
+	std::string parent_path = prefix + "-parent.luau";
+	std::string error;
+	if (!FS::write_file(worker_path, kWorkerScript, false, &error))
+	{
+		state.fail(error);
+		return;
+	}
+
+	double single = 0;
+	for (int workers = 1; workers <= cores; workers++)
+	{
+		if (!FS::write_file(parent_path, parent_script(worker_path, workers, state.iterations), false, &error))
+		{
+			state.fail(error);
+			break;
+		}
+
+		std::shared_ptr<Actor> parent = std::make_shared<Actor>(parent_path, ActorOptions{}, nullptr);
+
+		double started = lua_clock();
+		state.start();
+		int exit_code = parent->run(nullptr);
+		state.stop();
+		double elapsed = lua_clock() - started;
+
+		if (exit_code != 0)
+		{
+			state.fail("the parent script did not run");
+			break;
+		}
+
+		double units_per_s = workers * state.iterations / elapsed;
+		if (workers == 1)
+		{
+			single = units_per_s;
+		}
+		state.report("units_per_s_" + std::to_string(workers), units_per_s);
+		state.report("scaling_" + std::to_string(workers), single > 0 ? units_per_s / single : 0);
+	}
+
+	unlink(parent_path.c_str());
+	unlink(worker_path.c_str());
+}
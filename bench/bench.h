@@ -0,0 +1,94 @@
+#ifndef LUAUPI_BENCH_H
+#define LUAUPI_BENCH_H
+
+#include <lua.h>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "state.h"
+#include "scheduler.h"
+
+namespace LuauPi
+{
+
+class BenchState
+{
+private:
+	double started_at;
+	double total;
+	bool running;
+
+public:
+	uint64_t iterations;
+	std::vector<std::pair<std::string, double>> metrics;
+	std::string failure;
+
+	explicit BenchState(uint64_t iterations);
+
+	// Only time between start() and stop() is counted, so setup can happen outside it:
+	void start();
+	void stop();
+	double elapsed() const;
+
+	// Reports an extra metric alongside the time per iteration. The last value reported wins:
+	void report(const std::string& name, double value);
+
+	// Marks the benchmark as failed, e.g. when a stress test loses work:
+	void fail(const std::string& message);
+};
+
+void bench_register(const std::string& name, std::function<void(BenchState& state)> fn);
+
+// Benchmarks that depend on files found at run time:
+void register_script_benches(const std::string& dir);
+
+struct BenchRegistrar
+{
+	BenchRegistrar(const char* name, void (*fn)(BenchState& state))
+	{
+		bench_register(name, fn);
+	}
+};
+
+#define BENCH(name) \
+	static void bench_##name(LuauPi::BenchState& state); \
+	static LuauPi::BenchRegistrar bench_registrar_##name(#name, bench_##name); \
+	static void bench_##name(LuauPi::BenchState& state)
+
+// A fresh LuauState with helpers for running code on its scheduler:
+class BenchVm
+{
+private:
+	LuauState state;
+	lua_State* L;
+	LuauTaskScheduler* scheduler;
+	int function_ref;
+	double now;
+
+public:
+	BenchVm();
+	~BenchVm();
+
+	lua_State* get();
+	LuauTaskScheduler* get_scheduler();
+
+	// Compiles source as the function run() calls. Its arguments are available as ...:
+	void load(const std::string& source);
+
+	// Runs the loaded function as a new task, with the n_args values on top of the stack as its arguments:
+	void run(int n_args);
+
+	// One update at the current time:
+	void tick();
+
+	// Updates until no work is left. With virtual time the clock jumps to each deadline;
+	// otherwise it waits in real time:
+	void drive(bool virtual_time = true);
+};
+
+}
+
+#endif
@@ -0,0 +1,49 @@
+#include "bench.h"
+
+#include <luaupi.h>
+#include <cstring>
+
+using namespace LuauPi;
+
+// Steps a host would make through the embedding API, on a clock of its own:
+static void bench_steps(BenchState& state, const char* source)
+{
+	luaupi_State* vm = luaupi_create(nullptr);
+	if (luaupi_load_source(vm, "bench", source, strlen(source)) != 0)
+	{
+		state.fail(luaupi_error(vm));
+		luaupi_destroy(vm);
+		return;
+	}
+
+	double now = luaupi_clock();
+
+	state.start();
+	for (uint64_t i = 0; i < state.iterations; i++)
+	{
+		now += 0.001;
+		luaupi_step(vm, now);
+		luaupi_next_deadline(vm);
+	}
+	state.stop();
+
+	luaupi_destroy(vm);
+}
+
+// Nothing due, so this is the cost of a host stepping on every wake-up:
+BENCH(embed_step_idle)
+{
+	bench_steps(state, R"(
+		task.wait(1e9)
+	)");
+}
+
+// One task resumed per step:
+BENCH(embed_step_resume)
+{
+	bench_steps(state, R"(
+		while true do
+			task.wait()
+		end
+	)");
+}
@@ -0,0 +1,391 @@
+#include "bench.h"
+
+#include <lualib.h>
+#include <luacode.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <memory>
+
+#include "gpiosim.h"
+
+using namespace LuauPi;
+
+static constexpr uint64_t kMaxIterations = 1000000000;
+
+struct BenchCase
+{
+	std::string name;
+	std::function<void(BenchState& state)> fn;
+};
+
+struct BenchResult
+{
+	std::string name;
+	uint64_t iterations;
+	double ns_per_op;
+	std::vector<std::pair<std::string, double>> metrics;
+	std::string failure;
+};
+
+// The running benchmark, for bench.report calls from Luau:
+static BenchState* current_state = nullptr;
+
+static std::vector<BenchCase>& bench_cases()
+{
+	static std::vector<BenchCase> cases;
+	return cases;
+}
+
+BenchState::BenchState(uint64_t iterations) : started_at(0), total(0), running(false), iterations(iterations)
+{
+}
+
+void BenchState::start()
+{
+	if (!running)
+	{
+		running = true;
+		started_at = lua_clock();
+	}
+}
+
+void BenchState::stop()
+{
+	if (running)
+	{
+		running = false;
+		total += lua_clock() - started_at;
+	}
+}
+
+double BenchState::elapsed() const
+{
+	return running ? total + lua_clock() - started_at : total;
+}
+
+void BenchState::report(const std::string& name, double value)
+{
+	for (auto it = metrics.begin(); it != metrics.end(); ++it)
+	{
+		if (it->first == name)
+		{
+			it->second = value;
+			return;
+		}
+	}
+	metrics.emplace_back(name, value);
+}
+
+void BenchState::fail(const std::string& message)
+{
+	failure = message;
+}
+
+void LuauPi::bench_register(const std::string& name, std::function<void(BenchState& state)> fn)
+{
+	bench_cases().push_back(BenchCase{name, std::move(fn)});
+}
+
+static int bench_report(lua_State* L)
+{
+	const char* name = luaL_checkstring(L, 1);
+	double value = luaL_checknumber(L, 2);
+
+	if (current_state)
+	{
+		current_state->report(name, value);
+	}
+
+	return 0;
+}
+
+BenchVm::BenchVm() : L(state.get()), scheduler(LuauTaskScheduler::get(L)), function_ref(LUA_NOREF), now(0)
+{
+	scheduler->set_time(0);
+
+	// Scripts report their own metrics through bench.report(name, value):
+	lua_setreadonly(L, LUA_GLOBALSINDEX, false);
+	lua_newtable(L);
+	lua_pushcfunction(L, bench_report, "report");
+	lua_setfield(L, -2, "report");
+	lua_setreadonly(L, -1, true);
+	lua_setglobal(L, "bench");
+	lua_setreadonly(L, LUA_GLOBALSINDEX, true);
+}
+
+BenchVm::~BenchVm()
+{
+	lua_unref(L, function_ref);
+}
+
+lua_State* BenchVm::get()
+{
+	return L;
+}
+
+LuauTaskScheduler* BenchVm::get_scheduler()
+{
+	return scheduler;
+}
+
+void BenchVm::load(const std::string& source)
+{
+	lua_CompileOptions compile_options{};
+	compile_options.optimizationLevel = 1;
+	compile_options.debugLevel = 1;
+
+	size_t bytecode_size;
+	std::unique_ptr<char, void(*)(void*)> bytecode(luau_compile(source.data(), source.size(), &compile_options, &bytecode_size), free);
+
+	if (luau_load(L, "=bench", bytecode.get(), bytecode_size, 0) != LUA_OK)
+	{
+		printf("[ERROR] %s\n", lua_tostring(L, -1));
+		exit(1);
+	}
+
+	lua_unref(L, function_ref);
+	function_ref = lua_ref(L, -1);
+	lua_pop(L, 1);
+}
+
+void BenchVm::run(int n_args)
+{
+	lua_State* T = scheduler->create_thread(L);
+	lua_pop(L, 1);
+
+	lua_getref(L, function_ref);
+	lua_xmove(L, T, 1);
+	lua_xmove(L, T, n_args);
+
+	scheduler->spawn(T, nullptr, n_args);
+}
+
+void BenchVm::tick()
+{
+	scheduler->update(now, 0);
+}
+
+void BenchVm::drive(bool virtual_time)
+{
+	if (!virtual_time)
+	{
+		now = lua_clock();
+	}
+
+	while (true)
+	{
+		double last = now;
+		if (!virtual_time)
+		{
+			now = lua_clock();
+		}
+
+		if (!scheduler->update(now, now - last))
+		{
+			break;
+		}
+
+		double until = scheduler->next_deadline();
+		if (virtual_time && until != HUGE_VAL)
+		{
+			now = std::max(now, until);
+			continue;
+		}
+		scheduler->wait(until);
+	}
+}
+
+static BenchResult run_case(const BenchCase& bench, double min_time)
+{
+	uint64_t n = 1;
+	while (true)
+	{
+		BenchState state(n);
+		current_state = &state;
+		bench.fn(state);
+		state.stop();
+		current_state = nullptr;
+
+		double elapsed = state.elapsed();
+		if (!state.failure.empty() || elapsed >= min_time || n >= kMaxIterations)
+		{
+			return BenchResult{bench.name, n, elapsed * 1e9 / n, state.metrics, state.failure};
+		}
+
+		// Grow towards the minimum time, by at least 2x and at most 100x:
+		double per_op = elapsed / n;
+		uint64_t next = per_op > 0 ? static_cast<uint64_t>(min_time * 1.2 / per_op) : n * 100;
+		n = std::min(std::max(next, n * 2), std::min(n * 100, kMaxIterations));
+	}
+}
+
+static void write_json(FILE* out, const std::vector<BenchResult>& results)
+{
+	fprintf(out, "{\n  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const BenchResult& result = results[i];
+		fprintf(out, "    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.3f, \"metrics\": {", result.name.c_str(), static_cast<unsigned long long>(result.iterations), result.ns_per_op);
+		for (size_t m = 0; m < result.metrics.size(); m++)
+		{
+			fprintf(out, "%s\"%s\": %.6g", m > 0 ? ", " : "", result.metrics[m].first.c_str(), result.metrics[m].second);
+		}
+		fprintf(out, "}");
+		if (!result.failure.empty())
+		{
+			fprintf(out, ", \"failure\": \"%s\"", result.failure.c_str());
+		}
+		fprintf(out, "}%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+}
+
+// Reads name and ns_per_op back from a file written by write_json, which puts one result per line:
+static bool read_baseline(const char* filepath, std::map<std::string, double>* baseline)
+{
+	FILE* file = fopen(filepath, "r");
+	if (!file)
+	{
+		return false;
+	}
+
+	char line[4096];
+	while (fgets(line, sizeof(line), file))
+	{
+		const char* name = strstr(line, "\"name\": \"");
+		const char* ns = strstr(line, "\"ns_per_op\": ");
+		if (!name || !ns)
+		{
+			continue;
+		}
+
+		name += strlen("\"name\": \"");
+		const char* name_end = strchr(name, '"');
+		if (!name_end)
+		{
+			continue;
+		}
+
+		(*baseline)[std::string(name, name_end)] = strtod(ns + strlen("\"ns_per_op\": "), nullptr);
+	}
+	fclose(file);
+
+	return true;
+}
+
+static void print_help()
+{
+	printf("Usage: luaupi-bench [OPTIONS]\n\n");
+	printf("Options:\n");
+	printf("   --filter=TEXT        Only run benchmarks whose name contains TEXT\n");
+	printf("   --min-time=SECONDS   Minimum time to run each benchmark for (default 0.2)\n");
+	printf("   --json=FILE          Write results to FILE as JSON\n");
+	printf("   --compare=FILE       Compare against a baseline written by --json\n");
+	printf("   --threshold=PERCENT  Slowdown that counts as a regression when comparing (default 10)\n");
+	printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+	const char* filter = nullptr;
+	const char* json_path = nullptr;
+	const char* compare_path = nullptr;
+	double min_time = 0.2;
+	double threshold = 10;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		if (strncmp(arg, "--filter=", 9) == 0)
+		{
+			filter = arg + 9;
+		}
+		else if (strncmp(arg, "--min-time=", 11) == 0)
+		{
+			min_time = atof(arg + 11);
+		}
+		else if (strncmp(arg, "--json=", 7) == 0)
+		{
+			json_path = arg + 7;
+		}
+		else if (strncmp(arg, "--compare=", 10) == 0)
+		{
+			compare_path = arg + 10;
+		}
+		else if (strncmp(arg, "--threshold=", 12) == 0)
+		{
+			threshold = atof(arg + 12);
+		}
+		else
+		{
+			print_help();
+			return strcmp(arg, "--help") == 0 ? 0 : 1;
+		}
+	}
+
+	// Needs no GPIO hardware attached. It still links against wiringPi like the rest of the tree, so the
+	// library must be installed, but nothing calls into it unless LUAUPI_BENCH_HARDWARE=1:
+	Gpio::set_backend(std::unique_ptr<GpioBackend>(new SimGpio()));
+
+	register_script_benches("bench/luau");
+
+	std::map<std::string, double> baseline;
+	if (compare_path && !read_baseline(compare_path, &baseline))
+	{
+		printf("Could not read baseline %s\n", compare_path);
+		return 1;
+	}
+
+	std::vector<BenchResult> results;
+	int failures = 0;
+	int regressions = 0;
+	for (auto it = bench_cases().begin(); it != bench_cases().end(); ++it)
+	{
+		if (filter && it->name.find(filter) == std::string::npos)
+		{
+			continue;
+		}
+
+		BenchResult result = run_case(*it, min_time);
+		printf("%-40s %12llu %14.1f ns/op", result.name.c_str(), static_cast<unsigned long long>(result.iterations), result.ns_per_op);
+
+		auto base = baseline.find(result.name);
+		if (base != baseline.end() && base->second > 0)
+		{
+			double change = (result.ns_per_op - base->second) / base->second * 100;
+			bool regressed = change > threshold;
+			printf("  %+7.1f%%%s", change, regressed ? " REGRESSION" : "");
+			regressions += regressed ? 1 : 0;
+		}
+		for (auto m = result.metrics.begin(); m != result.metrics.end(); ++m)
+		{
+			printf("  %s=%.6g", m->first.c_str(), m->second);
+		}
+		if (!result.failure.empty())
+		{
+			printf("  FAILED: %s", result.failure.c_str());
+			failures++;
+		}
+		printf("\n");
+
+		results.push_back(std::move(result));
+	}
+
+	if (json_path)
+	{
+		FILE* out = fopen(json_path, "w");
+		if (!out)
+		{
+			printf("Could not write %s\n", json_path);
+			return 1;
+		}
+		write_json(out, results);
+		fclose(out);
+	}
+
+	return failures > 0 || regressions > 0 ? 1 : 0;
+}
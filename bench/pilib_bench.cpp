@@ -0,0 +1,507 @@
+#include "bench.h"
+
+#include <wiringPi.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gpiommap.h"
+#include "gpiowiringpi.h"
+#include "gpiosim.h"
+#include "gpioinput.h"
+#include "motion.h"
+
+using namespace LuauPi;
+
+// Calls made from a Luau loop, so each result is the Lua to C call cost plus the binding itself:
+static void bench_calls(BenchState& state, const char* source)
+{
+	BenchVm vm;
+	vm.load(source);
+
+	lua_pushinteger(vm.get(), static_cast<int>(state.iterations));
+
+	state.start();
+	vm.run(1);
+	vm.drive();
+	state.stop();
+}
+
+BENCH(luau_loop_baseline)
+{
+	bench_calls(state, R"(
+		local n = ...
+		local x = 0
+		for i = 1, n do
+			x += i
+		end
+	)");
+}
+
+BENCH(c_call_baseline)
+{
+	bench_calls(state, R"(
+		local n = ...
+		local clock = task.clock
+		for i = 1, n do
+			clock()
+		end
+	)");
+}
+
+BENCH(pi_pinMode)
+{
+	bench_calls(state, R"(
+		local n = ...
+		local pinMode, OUTPUT = pi.pinMode, pi.OUTPUT
+		for i = 1, n do
+			pinMode(17, OUTPUT)
+		end
+	)");
+}
+
+BENCH(pi_digitalWrite)
+{
+	bench_calls(state, R"(
+		local n = ...
+		pi.pinMode(17, pi.OUTPUT)
+		local digitalWrite = pi.digitalWrite
+		for i = 1, n do
+			digitalWrite(17, i % 2 == 0)
+		end
+	)");
+}
+
+BENCH(pi_digitalRead)
+{
+	bench_calls(state, R"(
+		local n = ...
+		pi.pinMode(18, pi.INPUT)
+		local digitalRead = pi.digitalRead
+		for i = 1, n do
+			digitalRead(18)
+		end
+	)");
+}
+
+BENCH(pi_analogRead)
+{
+	bench_calls(state, R"(
+		local n = ...
+		local analogRead = pi.analogRead
+		for i = 1, n do
+			analogRead(0)
+		end
+	)");
+}
+
+BENCH(pi_digitalWriteMask)
+{
+	bench_calls(state, R"(
+		local n = ...
+		for pin = 4, 11 do
+			pi.pinMode(pin, pi.OUTPUT)
+		end
+		local digitalWriteMask = pi.digitalWriteMask
+		for i = 1, n do
+			digitalWriteMask(0xFF0, bit32.lshift(i % 256, 4))
+		end
+	)");
+}
+
+BENCH(pi_counter_count)
+{
+	bench_calls(state, R"(
+		local n = ...
+		local counter = pi.counter(18)
+		local count = 0
+		for i = 1, n do
+			count = counter.count
+		end
+		counter:close()
+	)");
+}
+
+// Replays pins traced on a simulated backend through input, a poll interval at a time as the poller would:
+static void replay(SimGpio& sim, GpioInput& input, double end)
+{
+	std::vector<GpioEdge> edges;
+	input.start(std::vector<int>(input.get_pins().size(), LOW), 0);
+
+	for (double from = 0; from < end;)
+	{
+		double to = from + GpioInputs::kPollInterval;
+
+		edges.clear();
+		for (int pin : input.get_pins())
+		{
+			sim.read_edges(pin, from, to, &edges);
+		}
+		std::stable_sort(edges.begin(), edges.end(), [](const GpioEdge& a, const GpioEdge& b) {
+			return a.time < b.time;
+		});
+
+		for (const GpioEdge& edge : edges)
+		{
+			input.feed(edge);
+		}
+		input.settle(to);
+
+		from = to;
+	}
+}
+
+// Each iteration replays one second of pulses, far faster than a task.wait() loop could poll for them:
+static void bench_replay(BenchState& state, SimGpio& sim, GpioInput& input, uint64_t edges_per_pass, std::function<bool()> check)
+{
+	state.start();
+	for (uint64_t i = 0; i < state.iterations; i++)
+	{
+		replay(sim, input, 1.0);
+		if (!check())
+		{
+			state.fail("input state does not match the pulse train");
+			break;
+		}
+	}
+	state.stop();
+
+	state.report("edges_per_s", state.iterations * edges_per_pass / state.elapsed());
+}
+
+BENCH(input_counter_20khz)
+{
+	SimGpio sim;
+	for (int i = 0; i < 20000; i++)
+	{
+		sim.add_trace_event(i * 50e-6 + 10e-6, 18, HIGH);
+		sim.add_trace_event(i * 50e-6 + 20e-6, 18, LOW);
+	}
+
+	GpioCounter counter(18, true, false, 0);
+	bench_replay(state, sim, counter, 40000, [&counter]() {
+		return counter.reset() == 20000;
+	});
+}
+
+// Every real pulse is preceded by a 2 us glitch, which the 5 us glitch filter drops:
+BENCH(input_counter_glitch_filter)
+{
+	SimGpio sim;
+	for (int i = 0; i < 10000; i++)
+	{
+		double t = i * 100e-6;
+		sim.add_trace_event(t + 10e-6, 18, HIGH);
+		sim.add_trace_event(t + 12e-6, 18, LOW);
+		sim.add_trace_event(t + 40e-6, 18, HIGH);
+		sim.add_trace_event(t + 70e-6, 18, LOW);
+	}
+
+	GpioCounter counter(18, true, false, 5e-6);
+	bench_replay(state, sim, counter, 40000, [&counter]() {
+		return counter.reset() == 10000;
+	});
+}
+
+// Traces 10000 quadrature steps forward on pins 20 and 21, then 5000 back, step i at time_of(i):
+static void trace_quadrature(SimGpio& sim, std::function<double(int)> time_of)
+{
+	static const int sequence[4] = {0, 1, 3, 2};
+
+	int state_index = 0;
+	for (int i = 0; i < 15000; i++)
+	{
+		int previous = sequence[state_index];
+		state_index = (state_index + (i < 10000 ? 1 : 3)) % 4;
+		int next = sequence[state_index];
+
+		double t = time_of(i);
+		if ((previous ^ next) & 2)
+		{
+			sim.add_trace_event(t, 20, (next >> 1) & 1);
+		}
+		else
+		{
+			sim.add_trace_event(t, 21, next & 1);
+		}
+	}
+}
+
+// Evenly spaced at 20 kHz:
+BENCH(input_encoder_quadrature)
+{
+	SimGpio sim;
+	trace_quadrature(sim, [](int i) {
+		return i * 50e-6 + 25e-6;
+	});
+
+	GpioEncoder encoder(20, 21, 0);
+	bench_replay(state, sim, encoder, 15000, [&encoder]() {
+		return encoder.get_errors() == 0 && encoder.reset() == 5000;
+	});
+}
+
+// Steps in pairs 10 us apart, inside the 15 us glitch filter and one poll interval, with the channel
+// that leads alternating. Both changes settle in the same poll and must be applied in the order they happened:
+BENCH(input_encoder_glitch_filter)
+{
+	SimGpio sim;
+	trace_quadrature(sim, [](int i) {
+		return (i / 2) * 100e-6 + 25e-6 + (i % 2) * 10e-6;
+	});
+
+	GpioEncoder encoder(20, 21, 15e-6);
+	bench_replay(state, sim, encoder, 15000, [&encoder]() {
+		return encoder.get_errors() == 0 && encoder.reset() == 5000;
+	});
+}
+
+// 50 presses of a button that bounces on press and release, debounced over 5 ms:
+BENCH(input_debounce_bouncy)
+{
+	SimGpio sim;
+	for (int i = 0; i < 50; i++)
+	{
+		double t = i * 0.02 + 0.001;
+		const double press[] = {0, 0.0001, 0.0003, 0.0006, 0.001};
+		const double release[] = {0.01, 0.0102, 0.0105};
+		for (int j = 0; j < 5; j++)
+		{
+			sim.add_trace_event(t + press[j], 22, j % 2 == 0 ? HIGH : LOW);
+		}
+		for (int j = 0; j < 3; j++)
+		{
+			sim.add_trace_event(t + release[j], 22, j % 2 == 0 ? LOW : HIGH);
+		}
+	}
+
+	GpioDebouncer debouncer(22, 0.005, nullptr);
+	uint64_t expected = 0;
+	bench_replay(state, sim, debouncer, 400, [&debouncer, &expected]() {
+		expected += 100;
+		return debouncer.get_changes() == expected && debouncer.get_value() == LOW;
+	});
+}
+
+// The same bouncy button driven end to end: traced on the process backend, collected by the poller
+// through Gpio::read_edges, and waited on from a script with debounced:wait(). Fails if a press is lost
+// or a task parked in wait() lets the script end early. Each iteration is one press, 20 ms apart:
+BENCH(input_debounce_script)
+{
+	std::unique_ptr<SimGpio> sim(new SimGpio());
+	for (uint64_t i = 0; i < state.iterations; i++)
+	{
+		double t = i * 0.02 + 0.01;
+		const double press[] = {0, 0.0001, 0.0003, 0.0006, 0.001};
+		const double release[] = {0.01, 0.0102, 0.0105};
+		for (int j = 0; j < 5; j++)
+		{
+			sim->add_trace_event(t + press[j], 22, j % 2 == 0 ? HIGH : LOW);
+		}
+		for (int j = 0; j < 3; j++)
+		{
+			sim->add_trace_event(t + release[j], 22, j % 2 == 0 ? LOW : HIGH);
+		}
+	}
+
+	BenchVm vm;
+	vm.load(R"(
+		local n, timeout = ...
+		local button = pi.debounced(22, 5)
+		local guard = task.delay(timeout, function()
+			button:close()
+		end)
+
+		local presses = 0
+		while presses < n do
+			local level = button:wait()
+			if level == nil then
+				break
+			end
+			if level then
+				presses += 1
+			end
+		end
+
+		task.cancel(guard)
+		button:close()
+		bench.report("presses", presses)
+	)");
+
+	// Trace times start from here:
+	Gpio::set_backend(std::move(sim));
+
+	lua_pushinteger(vm.get(), static_cast<int>(state.iterations));
+	lua_pushnumber(vm.get(), state.iterations * 0.02 + 1.0);
+
+	// The guard is scheduled in real time, as drive runs:
+	vm.get_scheduler()->set_time(lua_clock());
+
+	state.start();
+	vm.run(2);
+	vm.drive(false);
+	state.stop();
+
+	// Later benchmarks get an untraced backend again:
+	Gpio::set_backend(std::unique_ptr<GpioBackend>(new SimGpio()));
+
+	auto presses = std::find_if(state.metrics.begin(), state.metrics.end(), [](const std::pair<std::string, double>& metric) {
+		return metric.first == "presses";
+	});
+	if (presses == state.metrics.end() || presses->second != static_cast<double>(state.iterations))
+	{
+		state.fail("debounced presses do not match the pulse train");
+	}
+}
+
+// Step times of a long trapezoidal move, as the motion engine asks for them:
+BENCH(motion_profile_time_at)
+{
+	MotionProfile profile(static_cast<double>(state.iterations), 0, 20000, 200000);
+
+	double sum = 0;
+	state.start();
+	for (uint64_t i = 1; i <= state.iterations; i++)
+	{
+		sum += profile.time_at(static_cast<double>(i));
+	}
+	state.stop();
+
+	if (!(sum > 0))
+	{
+		state.fail("no step times");
+	}
+}
+
+// A real-time move of one step per iteration at up to 20 kHz. Lateness is how far pulses
+// strayed from the profile on the timing thread:
+BENCH(stepper_move)
+{
+	BenchVm vm;
+	vm.load(R"(
+		local n = ...
+		local stepper = pi.stepper(5, 6, {maxVelocity = 20000, acceleration = 200000})
+		local done = false
+		task.spawn(function()
+			stepper:moveTo(n)
+			done = true
+		end)
+		while not done do
+			task.wait(0.001)
+		end
+
+		local timing = stepper:getTiming()
+		bench.report("mean_late_us", timing.meanLateUs)
+		bench.report("max_late_us", timing.maxLateUs)
+		stepper:close()
+	)");
+
+	lua_pushinteger(vm.get(), static_cast<int>(state.iterations));
+
+	state.start();
+	vm.run(1);
+	vm.drive(false);
+	state.stop();
+
+	state.report("steps_per_s", state.iterations / state.elapsed());
+}
+
+// Toggles straight through a backend, without the Luau binding in the way:
+static void bench_toggle(BenchState& state, GpioBackend* backend, int pin)
+{
+	backend->pin_mode(pin, OUTPUT);
+
+	state.start();
+	for (uint64_t i = 0; i < state.iterations; i++)
+	{
+		backend->digital_write(pin, static_cast<int>(i & 1));
+	}
+	state.stop();
+
+	state.report("toggles_per_s", state.iterations / state.elapsed());
+}
+
+// A regular file laid out like the BCM2711 register block stands in for /dev/gpiomem:
+BENCH(gpio_toggle_mmap_file)
+{
+	char path[] = "/tmp/luaupi-gpiomem-XXXXXX";
+	int fd = mkstemp(path);
+	if (fd < 0 || ftruncate(fd, 0x1000) != 0)
+	{
+		state.fail("could not create a register file");
+		return;
+	}
+	close(fd);
+
+	MmapGpioOptions options;
+	options.chip = GpioChip::Bcm2711;
+	options.device = path;
+	{
+		MmapGpio gpio(options);
+		if (!gpio.setup(GpioSetup::Gpio))
+		{
+			state.fail("could not map the register file");
+		}
+		else
+		{
+			bench_toggle(state, &gpio, 17);
+
+			// Writes must land in the set and clear registers, and the mode in its function select field:
+			gpio.digital_write(17, 1);
+			gpio.digital_write(27, 0);
+			gpio.digital_write_mask(1u << 22, 1u << 23);
+
+			int check = open(path, O_RDONLY);
+			uint32_t registers[0x40]{};
+			if (check < 0 || pread(check, registers, sizeof(registers), 0) != static_cast<ssize_t>(sizeof(registers)))
+			{
+				state.fail("could not read the register file back");
+			}
+			else if (((registers[0x04 / 4] >> 21) & 7) != 1 || !(registers[0x1C / 4] & (1u << 22)) || !(registers[0x28 / 4] & (1u << 23)))
+			{
+				state.fail("register writes did not land where expected");
+			}
+			if (check >= 0)
+			{
+				close(check);
+			}
+		}
+	}
+
+	unlink(path);
+}
+
+// Real hardware comparisons only run with LUAUPI_BENCH_HARDWARE=1, as they drive GPIO 17:
+static struct HardwareBenches
+{
+	HardwareBenches()
+	{
+		const char* hardware = getenv("LUAUPI_BENCH_HARDWARE");
+		if (!hardware || strcmp(hardware, "1") != 0)
+		{
+			return;
+		}
+
+		bench_register("gpio_toggle_wiringpi", [](BenchState& state) {
+			WiringPiGpio gpio;
+			if (!gpio.setup(GpioSetup::Gpio))
+			{
+				state.fail("wiringPi setup failed");
+				return;
+			}
+			bench_toggle(state, &gpio, 17);
+		});
+
+		bench_register("gpio_toggle_mmap", [](BenchState& state) {
+			MmapGpio gpio{MmapGpioOptions()};
+			if (!gpio.setup(GpioSetup::Gpio))
+			{
+				state.fail("could not map the GPIO registers");
+				return;
+			}
+			bench_toggle(state, &gpio, 17);
+		});
+	}
+} hardware_benches;
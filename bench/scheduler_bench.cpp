@@ -0,0 +1,416 @@
+#include "bench.h"
+
+#include <lualib.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace LuauPi;
+
+static constexpr int kProducers = 4;
+// How long post_fire_producers waits for every posted event before failing:
+static constexpr double kPostDeadline = 10.0;
+
+// Runs a chunk once with the iteration count as its argument, then drives it to completion:
+static void bench_chunk(BenchState& state, const char* source, bool virtual_time = true)
+{
+	BenchVm vm;
+	vm.load(source);
+
+	lua_pushinteger(vm.get(), static_cast<int>(state.iterations));
+
+	state.start();
+	vm.run(1);
+	vm.drive(virtual_time);
+	state.stop();
+}
+
+// Iterations of a chunk run with the collector stopped when measuring the garbage it leaves:
+static constexpr int kGarbageSample = 1000;
+
+static double heap_bytes(lua_State* L)
+{
+	return lua_gc(L, LUA_GCCOUNT, 0) * 1024.0 + lua_gc(L, LUA_GCCOUNTB, 0);
+}
+
+// Bytes the collector frees per iteration of a chunk, as bench_chunk runs it. Threads kept in
+// the scheduler's pool stay reachable, so only allocations nothing reuses are counted:
+static double garbage_per_iteration(const char* source)
+{
+	BenchVm vm;
+	vm.load(source);
+	lua_State* L = vm.get();
+
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	lua_gc(L, LUA_GCSTOP, 0);
+
+	lua_pushinteger(L, kGarbageSample);
+	vm.run(1);
+	vm.drive();
+
+	double before = heap_bytes(L);
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	double garbage = before - heap_bytes(L);
+	lua_gc(L, LUA_GCRESTART, 0);
+
+	return garbage / kGarbageSample;
+}
+
+// Every spawn gets a fresh thread, as task.spawn hands its thread to the script:
+static const char* const kSpawnChunk = R"(
+	local n = ...
+	local f = function() end
+	for i = 1, n do
+		task.spawn(f)
+	end
+)";
+
+BENCH(task_spawn)
+{
+	bench_chunk(state, kSpawnChunk);
+	state.report("spawns_per_s", state.iterations / state.elapsed());
+	state.report("garbage_bytes_per_spawn", garbage_per_iteration(kSpawnChunk));
+}
+
+// Handler threads never reach the script, so they come from the scheduler's pool:
+static const char* const kSignalFireChunk = R"(
+	local n = ...
+	local signal = task.signal()
+	signal:connect(function() end)
+	for i = 1, n do
+		signal:fire()
+	end
+)";
+
+BENCH(signal_fire_handler)
+{
+	bench_chunk(state, kSignalFireChunk);
+	state.report("fires_per_s", state.iterations / state.elapsed());
+	state.report("garbage_bytes_per_fire", garbage_per_iteration(kSignalFireChunk));
+}
+
+BENCH(task_defer)
+{
+	bench_chunk(state, R"(
+		local n = ...
+		local f = function() end
+		for i = 1, n do
+			task.defer(f)
+		end
+	)");
+}
+
+BENCH(task_delay)
+{
+	bench_chunk(state, R"(
+		local n = ...
+		local f = function() end
+		for i = 1, n do
+			task.delay(0, f)
+		end
+	)");
+}
+
+BENCH(task_wait)
+{
+	bench_chunk(state, R"(
+		local n = ...
+		local f = function()
+			task.wait()
+		end
+		for i = 1, n do
+			task.spawn(f)
+		end
+	)");
+}
+
+BENCH(task_delay_cancel)
+{
+	bench_chunk(state, R"(
+		local n = ...
+		local f = function() end
+		local threads = table.create(n)
+		for i = 1, n do
+			threads[i] = task.delay(1, f)
+		end
+		for i = 1, n do
+			task.cancel(threads[i])
+		end
+	)");
+}
+
+BENCH(task_every_1khz)
+{
+	bench_chunk(state, R"(
+		local n = ...
+		local count = 0
+		local handle
+		handle = task.every(0.001, function()
+			count += 1
+			if count == n then
+				handle:cancel()
+			end
+		end)
+	)");
+}
+
+BENCH(channel_ping_pong)
+{
+	bench_chunk(state, R"(
+		local n = ...
+		local ping, pong = task.channel(), task.channel()
+		task.spawn(function()
+			for i = 1, n do
+				pong:send(ping:recv())
+			end
+		end)
+		for i = 1, n do
+			ping:send(i)
+			pong:recv()
+		end
+	)");
+}
+
+BENCH(offload_roundtrip)
+{
+	bench_chunk(state, R"(
+		local n = ...
+		for i = 1, n do
+			task.offload("sleep", 0)
+		end
+	)", false);
+}
+
+// Cost of an update() with nothing due, against the number of sleeping tasks:
+static void bench_update_idle(BenchState& state, int sleepers)
+{
+	BenchVm vm;
+	vm.load(R"(
+		local n = ...
+		local f = function() end
+		for i = 1, n do
+			task.delay(1e9, f)
+		end
+	)");
+	lua_pushinteger(vm.get(), sleepers);
+	vm.run(1);
+
+	state.start();
+	for (uint64_t i = 0; i < state.iterations; i++)
+	{
+		vm.tick();
+	}
+	state.stop();
+}
+
+BENCH(update_idle_0)
+{
+	bench_update_idle(state, 0);
+}
+
+BENCH(update_idle_1000)
+{
+	bench_update_idle(state, 1000);
+}
+
+BENCH(update_idle_100000)
+{
+	bench_update_idle(state, 100000);
+}
+
+// Worst lateness a 10 ms periodic task may see next to a busy loop, with a 1 ms resume budget:
+static constexpr double kBusyLoopBudget = 0.001;
+static constexpr double kBusyLoopMaxLateness = 0.005;
+
+static std::vector<double> tick_times;
+
+static int record_tick(lua_State* L)
+{
+	tick_times.push_back(lua_clock());
+	return 0;
+}
+
+// A task that never yields must not starve task.every once it is preempted by the resume budget:
+BENCH(busy_loop_every_lateness)
+{
+	BenchVm vm;
+	vm.get_scheduler()->set_resume_budget(kBusyLoopBudget, BudgetPolicy::Yield);
+	vm.load(R"(
+		local n, record = ...
+		local busy = task.spawn(function()
+			while true do
+			end
+		end)
+		local count = 0
+		local handle
+		handle = task.every(0.01, function()
+			record()
+			count += 1
+			if count == n then
+				handle:cancel()
+				task.cancel(busy)
+			end
+		end)
+	)");
+
+	tick_times.clear();
+	lua_pushinteger(vm.get(), static_cast<int>(state.iterations) + 1);
+	lua_pushcfunction(vm.get(), record_tick, "record");
+
+	// The periodic task is scheduled in real time, as drive runs:
+	vm.get_scheduler()->set_time(lua_clock());
+
+	state.start();
+	vm.run(2);
+	vm.drive(false);
+	state.stop();
+
+	double worst = 0;
+	for (size_t i = 1; i < tick_times.size(); i++)
+	{
+		worst = std::max(worst, tick_times[i] - tick_times[i - 1] - 0.01);
+	}
+
+	state.report("max_lateness_ms", worst * 1000.0);
+	if (tick_times.size() != state.iterations + 1)
+	{
+		state.fail("periodic task did not run to completion");
+	}
+	else if (worst > kBusyLoopMaxLateness)
+	{
+		state.fail("periodic task was starved by the busy loop");
+	}
+}
+
+// Reports the distribution of samples in seconds as NAME_p50_us, NAME_p99_us and NAME_max_us:
+static void report_percentiles(BenchState& state, const std::string& name, std::vector<double> samples)
+{
+	if (samples.empty())
+	{
+		return;
+	}
+
+	std::sort(samples.begin(), samples.end());
+	state.report(name + "_p50_us", samples[samples.size() / 2] * 1e6);
+	state.report(name + "_p99_us", samples[samples.size() * 99 / 100] * 1e6);
+	state.report(name + "_max_us", samples.back() * 1e6);
+}
+
+static double mark_time = 0;
+
+static int mark(lua_State* L)
+{
+	mark_time = lua_clock();
+	return 0;
+}
+
+// How late a high priority task runs in a tick that also has 1000 low priority tasks due:
+BENCH(priority_lateness)
+{
+	BenchVm vm;
+	vm.load(R"(
+		local n, mark = ...
+		local function work()
+			local x = 0
+			for i = 1, 100 do
+				x += i
+			end
+		end
+		for i = 1, n do
+			task.delay(0, "low", work)
+		end
+		task.delay(0, "high", mark)
+	)");
+
+	std::vector<double> lateness;
+	lateness.reserve(state.iterations);
+	for (uint64_t i = 0; i < state.iterations; i++)
+	{
+		lua_pushinteger(vm.get(), 1000);
+		lua_pushcfunction(vm.get(), mark, "mark");
+		vm.run(2);
+
+		state.start();
+		double tick_start = lua_clock();
+		vm.tick();
+		lateness.push_back(mark_time - tick_start);
+		state.stop();
+	}
+
+	report_percentiles(state, "high_lateness", lateness);
+}
+
+static int fired = 0;
+static int signal_ref = LUA_NOREF;
+
+static int count_fire(lua_State* L)
+{
+	fired++;
+	return 0;
+}
+
+static int keep_signal(lua_State* L)
+{
+	signal_ref = lua_ref(L, 1);
+	return 0;
+}
+
+// Stress test for the post queue: several threads post at once, and every post must arrive:
+BENCH(post_fire_producers)
+{
+	BenchVm vm;
+	vm.load(R"(
+		local counter, keep = ...
+		local signal = task.signal()
+		signal:connect(counter)
+		keep(signal)
+	)");
+	lua_pushcfunction(vm.get(), count_fire, "counter");
+	lua_pushcfunction(vm.get(), keep_signal, "keep");
+	vm.run(2);
+
+	LuauTaskScheduler* scheduler = vm.get_scheduler();
+	int ref = signal_ref;
+	uint64_t total = state.iterations;
+	fired = 0;
+
+	state.start();
+
+	std::vector<std::thread> producers;
+	for (int p = 0; p < kProducers; p++)
+	{
+		uint64_t count = total / kProducers + (static_cast<uint64_t>(p) < total % kProducers ? 1 : 0);
+		producers.emplace_back([scheduler, ref, count]() {
+			for (uint64_t i = 0; i < count; i++)
+			{
+				scheduler->post_fire(ref, Message());
+			}
+		});
+	}
+
+	// A lost event would otherwise leave this waiting forever:
+	double deadline = lua_clock() + kPostDeadline;
+	while (static_cast<uint64_t>(fired) < total && lua_clock() < deadline)
+	{
+		vm.tick();
+		if (static_cast<uint64_t>(fired) < total)
+		{
+			scheduler->wait(std::min(lua_clock() + 0.01, deadline));
+		}
+	}
+
+	state.stop();
+
+	for (auto it = producers.begin(); it != producers.end(); ++it)
+	{
+		it->join();
+	}
+
+	if (static_cast<uint64_t>(fired) != total)
+	{
+		state.fail("lost posted events");
+	}
+
+	lua_unref(vm.get(), ref);
+}
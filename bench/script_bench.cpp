@@ -0,0 +1,187 @@
+#include "bench.h"
+
+#include <lualib.h>
+#include <luacode.h>
+#include <dirent.h>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+#include <unistd.h>
+
+#include "fs.h"
+#include "script.h"
+#include "bundle.h"
+#include "daemon.h"
+
+using namespace LuauPi;
+
+// Macro benchmarks with this comment run in real time rather than virtual time:
+static constexpr const char* kRealtimeMarker = "-- bench: realtime";
+
+static std::string compile(const std::string& source)
+{
+	lua_CompileOptions compile_options{};
+	compile_options.optimizationLevel = 1;
+	compile_options.debugLevel = 1;
+
+	size_t bytecode_size;
+	std::unique_ptr<char, void(*)(void*)> bytecode(luau_compile(source.data(), source.size(), &compile_options, &bytecode_size), free);
+
+	return std::string(bytecode.get(), bytecode_size);
+}
+
+static void register_compile_benches(const std::string& filepath, const std::string& name)
+{
+	bench_register("compile:" + name, [filepath](BenchState& state) {
+		std::string source = FS::read_file(filepath);
+
+		state.start();
+		for (uint64_t i = 0; i < state.iterations; i++)
+		{
+			compile(source);
+		}
+		state.stop();
+	});
+
+	bench_register("load:" + name, [filepath](BenchState& state) {
+		std::string bytecode = compile(FS::read_file(filepath));
+		BenchVm vm;
+		lua_State* L = vm.get();
+
+		state.start();
+		for (uint64_t i = 0; i < state.iterations; i++)
+		{
+			luau_load(L, "=bench", bytecode.data(), bytecode.size(), 0);
+			lua_pop(L, 1);
+		}
+		state.stop();
+	});
+}
+
+static void register_macro_bench(const std::string& filepath, const std::string& name)
+{
+	bench_register("macro:" + name, [filepath](BenchState& state) {
+		bool virtual_time = FS::read_file(filepath).find(kRealtimeMarker) == std::string::npos;
+
+		for (uint64_t i = 0; i < state.iterations; i++)
+		{
+			BenchVm vm;
+
+			state.start();
+			LuauScript::load_and_run(vm.get(), filepath, nullptr);
+			vm.drive(virtual_time);
+			state.stop();
+		}
+	});
+}
+
+// Cold start up to the entry script's first yield, including every module it requires on the way:
+static void register_startup_benches(const std::string& filepath, const std::string& name)
+{
+	bench_register("startup:source:" + name, [filepath](BenchState& state) {
+		for (uint64_t i = 0; i < state.iterations; i++)
+		{
+			BenchVm vm;
+
+			state.start();
+			LuauScript::load_and_run(vm.get(), filepath, nullptr);
+			state.stop();
+		}
+	});
+
+	bench_register("startup:bundle:" + name, [filepath, name](BenchState& state) {
+		std::string output = "/tmp/luaupi-bench-" + name + ".lpb";
+		std::vector<std::string> names;
+		std::string error;
+		if (!Bundle::build(filepath, output, &names, &error))
+		{
+			state.fail(error);
+			return;
+		}
+
+		for (uint64_t i = 0; i < state.iterations; i++)
+		{
+			BenchVm vm;
+
+			state.start();
+			std::unique_ptr<Bundle> bundle = Bundle::open(output, &error);
+			std::string entry = bundle->get_entry();
+			Bundle::mount(std::move(bundle));
+			LuauScript::load_and_run(vm.get(), entry, nullptr);
+			state.stop();
+
+			// Unmapped once the chunks are loaded, as the bytecode has been copied into the VM:
+			Bundle::mount(nullptr);
+		}
+
+		unlink(output.c_str());
+	});
+
+	// The daemon's reload of a running script, against a cold start above. Each iteration is the time
+	// to the new script's first tick; handover_us is how long no script was running:
+	bench_register("reload:" + name, [filepath](BenchState& state) {
+		Daemon daemon(ActorOptions{});
+		DaemonTiming timing;
+		std::string error;
+		if (!daemon.load(filepath, &timing, &error))
+		{
+			state.fail(error);
+			return;
+		}
+
+		double handover = 0;
+		for (uint64_t i = 0; i < state.iterations; i++)
+		{
+			state.start();
+			bool ok = daemon.reload(&timing, &error);
+			state.stop();
+
+			if (!ok)
+			{
+				state.fail(error);
+				return;
+			}
+			handover += timing.handover;
+		}
+
+		state.report("handover_us", handover / state.iterations * 1e6);
+	});
+}
+
+void LuauPi::register_script_benches(const std::string& dir)
+{
+	// The sample script loops forever, so it is only compiled and loaded:
+	register_compile_benches("test.luau", "test");
+
+	DIR* d = opendir(dir.c_str());
+	if (!d)
+	{
+		return;
+	}
+
+	std::vector<std::string> names;
+	while (dirent* entry = readdir(d))
+	{
+		std::string name = entry->d_name;
+		if (name.size() > 5 && name.compare(name.size() - 5, 5, ".luau") == 0)
+		{
+			names.push_back(name.substr(0, name.size() - 5));
+		}
+	}
+	closedir(d);
+
+	std::sort(names.begin(), names.end());
+	for (auto it = names.begin(); it != names.end(); ++it)
+	{
+		std::string filepath = dir + "/" + *it + ".luau";
+		register_compile_benches(filepath, *it);
+		register_macro_bench(filepath, *it);
+
+		// Scripts that open files or sockets as they start are left out:
+		if (FS::read_file(filepath).find(kRealtimeMarker) == std::string::npos)
+		{
+			register_startup_benches(filepath, *it);
+		}
+	}
+}
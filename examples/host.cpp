@@ -0,0 +1,104 @@
+// A host with its own epoll loop driving a Luau script through libluaupi. The host's own work here
+// is a 10 Hz timerfd; the script's tasks run from the same thread, woken by a second timerfd armed
+// for the script's next deadline, so there is no fixed sleep and no millisecond rounding.
+//
+// Usage: host FILE
+
+#include <luaupi.h>
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t stop_host = 0;
+
+static void handle_sigint(int s)
+{
+	stop_host = 1;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 2)
+	{
+		printf("Usage: host FILE\n");
+		return 1;
+	}
+
+	signal(SIGINT, handle_sigint);
+
+	luaupi_State* state = luaupi_create(nullptr);
+	if (state == nullptr || luaupi_load(state, argv[1]) != 0)
+	{
+		printf("%s\n", state ? luaupi_error(state) : "could not create a state");
+		luaupi_destroy(state);
+		return 1;
+	}
+
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+	int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	itimerspec interval{};
+	interval.it_interval.tv_nsec = 100000000;
+	interval.it_value.tv_nsec = 100000000;
+	timerfd_settime(timer_fd, 0, &interval, nullptr);
+
+	int deadline_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	int fds[] = { timer_fd, deadline_fd, luaupi_fd(state) };
+	for (int fd : fds)
+	{
+		epoll_event ev{};
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+		epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+	}
+
+	uint64_t host_ticks = 0;
+	bool running = luaupi_step(state, luaupi_clock()) != 0;
+	while (running && !stop_host)
+	{
+		// Disarmed when the script has nothing timed. A zero it_value also disarms, so due work gets 1 ns:
+		itimerspec deadline{};
+		double until = luaupi_next_deadline(state);
+		if (until != HUGE_VAL)
+		{
+			double delay = std::max(1e-9, until - luaupi_clock());
+			deadline.it_value.tv_sec = static_cast<time_t>(delay);
+			deadline.it_value.tv_nsec = static_cast<long>((delay - std::floor(delay)) * 1e9);
+		}
+		timerfd_settime(deadline_fd, 0, &deadline, nullptr);
+
+		epoll_event events[4];
+		int n = epoll_wait(epoll_fd, events, 4, -1);
+		for (int i = 0; i < n; i++)
+		{
+			uint64_t expirations;
+			if (events[i].data.fd == timer_fd && read(timer_fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+			{
+				host_ticks += expirations;
+			}
+			else if (events[i].data.fd == deadline_fd)
+			{
+				ssize_t drained = read(deadline_fd, &expirations, sizeof(expirations));
+				(void)drained;
+			}
+		}
+
+		// Cheap when nothing is due, so it runs on every wake-up rather than only for the script's fds:
+		running = luaupi_step(state, luaupi_clock()) != 0;
+	}
+
+	printf("Script finished after %llu host ticks\n", static_cast<unsigned long long>(host_ticks));
+
+	close(deadline_fd);
+	close(timer_fd);
+	close(epoll_fd);
+	luaupi_destroy(state);
+
+	return 0;
+}
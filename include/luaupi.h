@@ -0,0 +1,67 @@
+#ifndef LUAUPI_H
+#define LUAUPI_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Embedding API for libluaupi. A host creates a state, loads a script into it, then steps its
+// scheduler from the host's own loop: whenever luaupi_fd polls readable, and once
+// luaupi_next_deadline has passed. Every call on a state must come from the same thread.
+//
+// Times are seconds on the luaupi_clock timeline. Embedded states have the full pi, task, fs
+// and net libraries. The actor library is there too, but raises an error when called, as an
+// embedded state is not itself an actor.
+
+#define LUAUPI_VERSION 1
+
+typedef struct lua_State lua_State;
+typedef struct luaupi_State luaupi_State;
+
+typedef struct luaupi_Options
+{
+	// Preempt tasks that run longer than this without yielding, or 0 to let them run:
+	double budget;
+	// Raise an error in tasks over budget instead of yielding them:
+	int budget_error;
+	// Stop running due low priority tasks once they have taken this long in a step, or 0 to run them all:
+	double low_priority_budget;
+	// Compile scripts to native code as they load, where supported. Applies to the whole process:
+	int native;
+} luaupi_Options;
+
+// options may be NULL for the defaults. Returns NULL if the state could not be created:
+luaupi_State* luaupi_create(const luaupi_Options* options);
+// Runs the script's pi.onExit callbacks, then frees the state:
+void luaupi_destroy(luaupi_State* state);
+
+// Loads a script or .lpb bundle and runs it up to its first yield. Returns 0, or -1 with the reason
+// in luaupi_error. Only one bundle can be loaded per process:
+int luaupi_load(luaupi_State* state, const char* path);
+// As above, from source held by the host. chunkname names the chunk in errors:
+int luaupi_load_source(luaupi_State* state, const char* chunkname, const char* source, size_t size);
+
+// Runs everything due by now. Returns 1 while tasks are left that a later step could run, or 0 once the
+// script has nothing left to do:
+int luaupi_step(luaupi_State* state, double now);
+// When a step next has work without luaupi_fd becoming readable first, or HUGE_VAL if never:
+double luaupi_next_deadline(luaupi_State* state);
+// Polls readable while work posted from other threads or I/O is waiting for a step. Owned by the state:
+int luaupi_fd(luaupi_State* state);
+
+double luaupi_clock(void);
+
+// Why the last call failed:
+const char* luaupi_error(luaupi_State* state);
+
+// The state's main Luau thread, for hosts adding their own globals with the Luau C API. Globals are
+// sandboxed read-only, so unlock them with lua_setreadonly around any changes:
+lua_State* luaupi_lua(luaupi_State* state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,585 @@
+#include "actor.h"
+
+#include <lualib.h>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <new>
+
+#include "state.h"
+#include "script.h"
+#include "pilib.h"
+#include "gpio.h"
+#include "gpioinput.h"
+#include "motion.h"
+#include "hotlines.h"
+#include "allocprofiler.h"
+#include "realtime.h"
+#include "latency.h"
+
+using namespace LuauPi;
+
+static constexpr const char* kActor = "Actor";
+static constexpr const char* kActorHandle = "ActorHandle";
+
+static std::atomic<int> next_actor_id(1);
+
+struct ActorHandle
+{
+	std::shared_ptr<Actor> actor;
+	// Set when the handle lives in another actor's state, where it counts as a sender:
+	bool sender;
+
+	~ActorHandle()
+	{
+		if (sender)
+		{
+			actor->remove_sender();
+		}
+	}
+};
+
+static void push_actor(lua_State* L, std::shared_ptr<Actor> actor)
+{
+	bool sender = Actor::get(L) != actor;
+	if (sender)
+	{
+		actor->add_sender();
+	}
+
+	void* data = lua_newuserdatadtor(L, sizeof(ActorHandle), [](void* ud) {
+		static_cast<ActorHandle*>(ud)->~ActorHandle();
+	});
+	new (data) ActorHandle{std::move(actor), sender};
+
+	luaL_getmetatable(L, kActorHandle);
+	lua_setmetatable(L, -2);
+}
+
+// Pushes the sender followed by the message values, returning the number of values pushed:
+static int push_message(lua_State* L, const ActorMessage& message)
+{
+	int top = lua_gettop(L);
+
+	if (message.sender)
+	{
+		push_actor(L, message.sender);
+	}
+	else
+	{
+		lua_pushnil(L);
+	}
+
+	message.values.unpack(L);
+
+	return lua_gettop(L) - top;
+}
+
+Actor::Actor(const std::string& filepath, const ActorOptions& options, std::shared_ptr<Actor> parent)
+	: id(next_actor_id++), filepath(filepath), options(options), parent(parent), running(false), stop_requested(false), senders(0), running_scheduler(nullptr), closed(false)
+{
+}
+
+std::shared_ptr<Actor> Actor::get(lua_State* L)
+{
+	lua_rawgetfield(L, LUA_REGISTRYINDEX, kActor);
+	Actor* actor = static_cast<Actor*>(lua_tolightuserdata(L, -1));
+	lua_pop(L, 1);
+
+	return actor ? actor->shared_from_this() : nullptr;
+}
+
+int Actor::run(const volatile bool* stop, const Waker* interrupt, const ActorHooks* hooks)
+{
+	running = true;
+	Gpio::set_owner(id);
+	Realtime::configure_thread();
+
+	LatencyHistogram latency;
+
+	int exit_code = 0;
+	{
+		LuauState state;
+		lua_State* L = state.get();
+
+		lua_pushlightuserdata(L, this);
+		lua_rawsetfield(L, LUA_REGISTRYINDEX, kActor);
+
+		LuauTaskScheduler* scheduler = LuauTaskScheduler::get(L);
+		{
+			std::lock_guard<std::mutex> lock(inbox_mutex);
+			running_scheduler = scheduler;
+		}
+
+		if (options.budget > 0)
+		{
+			scheduler->set_resume_budget(options.budget, options.budget_policy);
+		}
+		if (options.low_priority_budget > 0)
+		{
+			scheduler->set_low_priority_budget(options.low_priority_budget);
+		}
+
+		// Virtual time starts at zero and only moves when the loop jumps to the next deadline:
+		if (options.virtual_time)
+		{
+			scheduler->set_time(0);
+			Gpio::set_virtual_time(0);
+		}
+
+		// Compiled before ready is asked, so the caller can hold the script back until it is needed:
+		bool loaded = LuauScript::load(L, filepath);
+		const char* load_error = loaded ? nullptr : lua_tostring(L, -1);
+		if (load_error)
+		{
+			printf("[ERROR] %s\n", load_error);
+		}
+
+		bool started = hooks && hooks->ready ? hooks->ready(load_error) && loaded : loaded;
+		bool ticked = false;
+
+		if (!started || LuauScript::run_loaded(L, nullptr) == nullptr)
+		{
+			exit_code = 1;
+			hand_over(scheduler, hooks);
+		}
+		else
+		{
+			double now = options.virtual_time ? 0 : lua_clock();
+			double last = now;
+			double next_harvest = lua_clock() + HotLines::kHarvestInterval;
+			while (true)
+			{
+				// Cleared before the inbox is drained and stop is checked, so a message or stop request
+				// arriving from here on wakes the wait below:
+				scheduler->reset_wake();
+				if (stop_requested || (stop && *stop))
+				{
+					break;
+				}
+
+				dispatch(L);
+				AllocProfiler::poll();
+
+				if (options.virtual_time)
+				{
+					Gpio::set_virtual_time(now);
+					GpioInputs::pump(scheduler);
+				}
+				else
+				{
+					now = lua_clock();
+				}
+				double dt = now - last;
+				last = now;
+
+				bool has_more = scheduler->update(now, dt);
+				if (!ticked)
+				{
+					ticked = true;
+					if (hooks && hooks->ticked)
+					{
+						hooks->ticked();
+					}
+				}
+
+				// Keeps the counts current for the report while long-running scripts are still going:
+				if (HotLines::is_enabled() && lua_clock() >= next_harvest)
+				{
+					HotLines::harvest(L);
+					next_harvest = lua_clock() + HotLines::kHarvestInterval;
+				}
+
+				if (!has_more && !can_receive())
+				{
+					break;
+				}
+
+				// Sleep until the next task is due or something is posted:
+				double until = scheduler->next_deadline();
+				if (options.virtual_time)
+				{
+					// Inputs follow the same clock, so their next traced edge is a deadline too:
+					until = std::min(until, GpioInputs::next_event(scheduler));
+				}
+				if (options.virtual_time && until != HUGE_VAL)
+				{
+					// Posted work, I/O and offloaded jobs still arrive in real time and are picked up without blocking:
+					now = std::max(now, until);
+					continue;
+				}
+				// Only sleeps towards a deadline from next_deadline() are timed wake-ups. Work already due
+				// does not sleep at all, and wake-ups before the deadline were for posted work:
+				bool timed = options.latency_report && until != HUGE_VAL && until > lua_clock();
+				scheduler->wait(until, interrupt ? interrupt->get_fd() : -1);
+
+				if (timed)
+				{
+					double late = lua_clock() - until;
+					if (late >= 0)
+					{
+						latency.record(late);
+					}
+				}
+			}
+
+			hand_over(scheduler, hooks);
+			pilib_call_exit_callbacks(L);
+
+			if (stop && *stop)
+			{
+				exit_code = 1;
+			}
+		}
+
+		// Receiver refs go away with the state:
+		receivers.clear();
+
+		if (!ticked && hooks && hooks->ticked)
+		{
+			hooks->ticked();
+		}
+	}
+
+	// Messages nothing will receive now, freed outside the lock as they may hold the last reference to their sender:
+	std::deque<ActorMessage> dropped;
+	{
+		std::lock_guard<std::mutex> lock(inbox_mutex);
+		running_scheduler = nullptr;
+		closed = true;
+		dropped.swap(inbox);
+	}
+	dropped.clear();
+
+	stop_children();
+	// Again, for any claimed by exit callbacks:
+	Gpio::release_all(id);
+
+	// A child can no longer reach its parent through actor.parent():
+	std::shared_ptr<Actor> parent_actor = parent.lock();
+	if (parent_actor)
+	{
+		parent_actor->remove_sender();
+	}
+
+	if (options.latency_report)
+	{
+		LatencyHistogram::add_to_report(latency);
+	}
+
+	running = false;
+
+	return exit_code;
+}
+
+std::shared_ptr<Actor> Actor::spawn(const std::string& child_filepath)
+{
+	std::shared_ptr<Actor> child = std::make_shared<Actor>(child_filepath, options, shared_from_this());
+
+	// Counted before its thread starts, so this actor does not decide nothing can send to it:
+	child->running = true;
+	add_sender();
+	child->thread = std::thread([child]() {
+		child->run(nullptr);
+	});
+
+	std::lock_guard<std::mutex> lock(children_mutex);
+	children.push_back(child);
+
+	return child;
+}
+
+void Actor::start(ActorHooks hooks)
+{
+	std::shared_ptr<Actor> self = shared_from_this();
+
+	running = true;
+	thread = std::thread([self, hooks]() {
+		self->run(nullptr, nullptr, &hooks);
+	});
+}
+
+// Nothing drives the pins once the loop stops, so they are handed on before the state is torn down.
+// Steppers are stopped too, as the motion engine would otherwise keep pulsing them:
+void Actor::hand_over(LuauTaskScheduler* scheduler, const ActorHooks* hooks)
+{
+	MotionEngine::release(scheduler);
+	Gpio::release_all(id);
+
+	if (hooks && hooks->stopped)
+	{
+		hooks->stopped();
+	}
+}
+
+void Actor::stop()
+{
+	stop_requested = true;
+	wake();
+}
+
+void Actor::join()
+{
+	if (thread.joinable())
+	{
+		thread.join();
+	}
+}
+
+void Actor::stop_children()
+{
+	std::vector<std::shared_ptr<Actor>> stopping;
+	{
+		std::lock_guard<std::mutex> lock(children_mutex);
+		stopping.swap(children);
+	}
+
+	for (auto it = stopping.begin(); it != stopping.end(); ++it)
+	{
+		(*it)->stop();
+	}
+	for (auto it = stopping.begin(); it != stopping.end(); ++it)
+	{
+		(*it)->join();
+	}
+}
+
+void Actor::post(ActorMessage&& message)
+{
+	std::lock_guard<std::mutex> lock(inbox_mutex);
+	if (closed)
+	{
+		return;
+	}
+
+	inbox.push_back(std::move(message));
+
+	if (running_scheduler)
+	{
+		running_scheduler->wake();
+	}
+}
+
+void Actor::wake()
+{
+	std::lock_guard<std::mutex> lock(inbox_mutex);
+	if (running_scheduler)
+	{
+		running_scheduler->wake();
+	}
+}
+
+void Actor::add_sender()
+{
+	senders++;
+}
+
+void Actor::remove_sender()
+{
+	// Parked receivers recheck whether anything could still send to them:
+	if (--senders == 0)
+	{
+		wake();
+	}
+}
+
+bool Actor::pop_message(ActorMessage* message)
+{
+	std::lock_guard<std::mutex> lock(inbox_mutex);
+	if (inbox.empty())
+	{
+		return false;
+	}
+
+	*message = std::move(inbox.front());
+	inbox.pop_front();
+
+	return true;
+}
+
+bool Actor::can_receive()
+{
+	if (receivers.empty())
+	{
+		return false;
+	}
+
+	// A parked receiver can still be woken if a message is waiting or another actor could send one:
+	std::lock_guard<std::mutex> lock(inbox_mutex);
+	return !inbox.empty() || senders > 0;
+}
+
+void Actor::dispatch(lua_State* L)
+{
+	LuauTaskScheduler* scheduler = LuauTaskScheduler::get(L);
+
+	while (!receivers.empty())
+	{
+		int ref = receivers.front();
+
+		lua_getref(L, ref);
+		lua_State* T = lua_tothread(L, -1);
+		lua_pop(L, 1);
+
+		// Drop receivers that were cancelled while parked:
+		if (lua_status(T) != LUA_YIELD)
+		{
+			receivers.pop_front();
+			lua_unref(L, ref);
+			continue;
+		}
+
+		ActorMessage message;
+		if (!pop_message(&message))
+		{
+			break;
+		}
+
+		receivers.pop_front();
+
+		int n = push_message(T, message);
+		scheduler->wake(T, nullptr, n);
+
+		lua_unref(L, ref);
+	}
+}
+
+int Actor::recv(lua_State* L)
+{
+	ActorMessage message;
+	if (pop_message(&message))
+	{
+		return push_message(L, message);
+	}
+
+	lua_pushthread(L);
+	receivers.push_back(lua_ref(L, -1));
+	lua_pop(L, 1);
+
+	// Resumed by dispatch with the next message:
+	return lua_yield(L, 0);
+}
+
+int Actor::get_id() const
+{
+	return id;
+}
+
+bool Actor::is_running() const
+{
+	return running;
+}
+
+std::shared_ptr<Actor> Actor::get_parent() const
+{
+	return parent.lock();
+}
+
+static std::shared_ptr<Actor> check_self(lua_State* L)
+{
+	std::shared_ptr<Actor> self = Actor::get(L);
+	if (!self)
+	{
+		luaL_error(L, "actors are not available in this state");
+	}
+
+	return self;
+}
+
+static int actor_spawn(lua_State* L)
+{
+	const char* filepath = luaL_checkstring(L, 1);
+
+	push_actor(L, check_self(L)->spawn(filepath));
+
+	return 1;
+}
+
+static int actor_recv(lua_State* L)
+{
+	return check_self(L)->recv(L);
+}
+
+static int actor_self(lua_State* L)
+{
+	push_actor(L, check_self(L));
+	return 1;
+}
+
+static int actor_parent(lua_State* L)
+{
+	std::shared_ptr<Actor> parent = check_self(L)->get_parent();
+	if (parent)
+	{
+		push_actor(L, parent);
+	}
+	else
+	{
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
+static int handle_send(lua_State* L)
+{
+	ActorHandle* handle = static_cast<ActorHandle*>(luaL_checkudata(L, 1, kActorHandle));
+
+	ActorMessage message;
+	message.sender = Actor::get(L);
+
+	int top = lua_gettop(L);
+	for (int i = 2; i <= top; i++)
+	{
+		message.values.pack(L, i);
+	}
+
+	handle->actor->post(std::move(message));
+
+	return 0;
+}
+
+static int handle_isRunning(lua_State* L)
+{
+	ActorHandle* handle = static_cast<ActorHandle*>(luaL_checkudata(L, 1, kActorHandle));
+	lua_pushboolean(L, handle->actor->is_running());
+	return 1;
+}
+
+static int handle_getId(lua_State* L)
+{
+	ActorHandle* handle = static_cast<ActorHandle*>(luaL_checkudata(L, 1, kActorHandle));
+	lua_pushinteger(L, handle->actor->get_id());
+	return 1;
+}
+
+static const luaL_Reg actor_lib[] = {
+	{"spawn", actor_spawn},
+	{"recv", actor_recv},
+	{"self", actor_self},
+	{"parent", actor_parent},
+	{nullptr, nullptr},
+};
+
+static const luaL_Reg handle_methods[] = {
+	{"send", handle_send},
+	{"isRunning", handle_isRunning},
+	{"getId", handle_getId},
+	{nullptr, nullptr},
+};
+
+void actor_lib_open(lua_State* L)
+{
+	luaL_register(L, "actor", actor_lib);
+	lua_pop(L, 1);
+
+	luaL_newmetatable(L, kActorHandle);
+	lua_newtable(L);
+	luaL_register(L, nullptr, handle_methods);
+	lua_setreadonly(L, -1, true);
+	lua_setfield(L, -2, "__index");
+	lua_pushstring(L, "The metatable is locked");
+	lua_setfield(L, -2, "__metatable");
+	lua_pop(L, 1);
+}
@@ -0,0 +1,124 @@
+#ifndef LUAUPI_ACTOR_H
+#define LUAUPI_ACTOR_H
+
+#include <lua.h>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "scheduler.h"
+#include "message.h"
+#include "waker.h"
+
+namespace LuauPi
+{
+
+class Actor;
+
+struct ActorOptions
+{
+	double budget = 0;
+	BudgetPolicy budget_policy = BudgetPolicy::Yield;
+	double low_priority_budget = 0;
+
+	// Advance the clock straight to the next deadline instead of sleeping:
+	bool virtual_time = false;
+
+	// Record how late each timed wake-up is, for LatencyHistogram::print_report:
+	bool latency_report = false;
+};
+
+// Calls into whoever started an actor, each made from the actor's own thread:
+struct ActorHooks
+{
+	// Once the script has compiled, with nullptr, or failed to, with the error. The script only starts
+	// running if it returns true:
+	std::function<bool(const char* error)> ready;
+	// After the script's first scheduler tick, or as the actor finishes without one:
+	std::function<void()> ticked;
+	// Once the loop has stopped ticking and the actor's pins are released, before its exit callbacks
+	// run and its state closes:
+	std::function<void()> stopped;
+};
+
+struct ActorMessage
+{
+	std::shared_ptr<Actor> sender;
+
+	// Moved as a whole from the sender's inbox slot to the receiver:
+	Message values;
+};
+
+// A script running in its own LuauState and LuauTaskScheduler. The main script
+// runs as an actor on the main thread; every actor it spawns gets an OS thread.
+class Actor : public std::enable_shared_from_this<Actor>
+{
+private:
+	int id;
+	std::string filepath;
+	ActorOptions options;
+	std::weak_ptr<Actor> parent;
+
+	std::thread thread;
+	std::atomic<bool> running;
+	std::atomic<bool> stop_requested;
+
+	// Handles to this actor held in other actors' states, plus running children, which can reach it
+	// through actor.parent(). Parked receivers only keep the actor alive while one of these could send:
+	std::atomic<int> senders;
+
+	std::mutex inbox_mutex;
+	std::deque<ActorMessage> inbox;
+	// Woken when a message is posted. Only set while the actor is running:
+	LuauTaskScheduler* running_scheduler;
+	// Set once the actor has finished, after which posts are dropped:
+	bool closed;
+
+	std::mutex children_mutex;
+	std::vector<std::shared_ptr<Actor>> children;
+
+	// Receivers parked in actor.recv, as refs to their threads. Only touched from this actor's OS thread:
+	std::deque<int> receivers;
+
+	bool pop_message(ActorMessage* message);
+	bool can_receive();
+	void dispatch(lua_State* L);
+	void stop_children();
+	void hand_over(LuauTaskScheduler* scheduler, const ActorHooks* hooks);
+
+public:
+	Actor(const std::string& filepath, const ActorOptions& options, std::shared_ptr<Actor> parent);
+
+	static std::shared_ptr<Actor> get(lua_State* L);
+
+	// Runs until the script finishes or stop is set. interrupt, if given, wakes the loop to check stop:
+	int run(const volatile bool* stop, const Waker* interrupt = nullptr, const ActorHooks* hooks = nullptr);
+	std::shared_ptr<Actor> spawn(const std::string& filepath);
+	// Runs the actor on an OS thread of its own, without a parent, as run does with hooks:
+	void start(ActorHooks hooks);
+	// Asks the actor to finish, without waiting for it:
+	void stop();
+	void join();
+
+	// Messages posted once the actor has finished are dropped:
+	void post(ActorMessage&& message);
+	void wake();
+	void add_sender();
+	void remove_sender();
+	int recv(lua_State* L);
+
+	int get_id() const;
+	bool is_running() const;
+	std::shared_ptr<Actor> get_parent() const;
+};
+
+}
+
+void actor_lib_open(lua_State* L);
+
+#endif
@@ -0,0 +1,223 @@
+#include "allocprofiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "fs.h"
+#include "traceback.h"
+
+using namespace LuauPi;
+
+// Deepest stack recorded per sample; outer frames past this are dropped:
+static constexpr size_t kMaxFrames = 64;
+
+// Call sites printed with each report:
+static constexpr size_t kTopSites = 20;
+
+struct StackCounts
+{
+	// Estimates, scaled up from the samples:
+	uint64_t bytes;
+	double allocations;
+
+	uint64_t samples;
+};
+
+static bool enabled = false;
+static std::string report_path;
+static int64_t sample_rate = AllocProfiler::kDefaultSampleRate;
+
+static std::mutex stacks_mutex;
+static std::unordered_map<std::string, StackCounts> stacks;
+
+static std::atomic<int64_t> heap_bytes(0);
+static std::atomic<int64_t> heap_peak(0);
+
+static std::atomic<bool> report_requested(false);
+
+// Bytes left until the next sample. Each state only allocates on its actor's thread:
+static thread_local int64_t until_sample = 0;
+
+static std::string frame_label(const lua_Debug& ar)
+{
+	std::string label = ar.name ? ar.name : "<anonymous>";
+	label += " (";
+	label += ar.short_src ? ar.short_src : "?";
+	if (ar.currentline > 0)
+	{
+		label += ":";
+		label += std::to_string(ar.currentline);
+	}
+	label += ")";
+	return label;
+}
+
+static void on_allocate(lua_State* L, size_t osize, size_t nsize)
+{
+	// Frees and shrinks are left to the GC:
+	if (nsize <= osize)
+	{
+		return;
+	}
+
+	until_sample -= static_cast<int64_t>(nsize - osize);
+
+	// Growth through realloc (stacks, table arrays) counts, but the sample waits for the next fresh
+	// allocation. The VM can be part way through moving this thread's stack when it reallocs:
+	if (until_sample > 0 || osize > 0)
+	{
+		return;
+	}
+
+	// One sample stands for every sample_rate bytes crossed since the last:
+	int64_t samples = 1 + (-until_sample) / sample_rate;
+	until_sample += samples * sample_rate;
+	uint64_t weight = static_cast<uint64_t>(samples * sample_rate);
+
+	std::vector<std::string> frames;
+	for_each_frame(L, 0, [&frames](const lua_Debug& ar) {
+		if (frames.size() < kMaxFrames)
+		{
+			frames.push_back(frame_label(ar));
+		}
+	});
+
+	// Folded stacks are written outermost frame first:
+	std::string key;
+	for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+	{
+		if (!key.empty())
+		{
+			key += ';';
+		}
+		key += *it;
+	}
+	if (key.empty())
+	{
+		key = "<native>";
+	}
+
+	std::lock_guard<std::mutex> lock(stacks_mutex);
+	StackCounts& counts = stacks[key];
+	counts.bytes += weight;
+	counts.allocations += static_cast<double>(weight) / static_cast<double>(nsize);
+	counts.samples++;
+}
+
+void AllocProfiler::enable(const std::string& path, size_t rate)
+{
+	enabled = true;
+	report_path = path;
+	sample_rate = static_cast<int64_t>(std::max<size_t>(rate, 1));
+}
+
+bool AllocProfiler::is_enabled()
+{
+	return enabled;
+}
+
+void AllocProfiler::attach(lua_State* L)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	until_sample = sample_rate;
+	lua_callbacks(L)->onallocate = on_allocate;
+}
+
+void AllocProfiler::track_heap(size_t osize, size_t nsize)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	int64_t now = heap_bytes.fetch_add(static_cast<int64_t>(nsize) - static_cast<int64_t>(osize), std::memory_order_relaxed);
+	now += static_cast<int64_t>(nsize) - static_cast<int64_t>(osize);
+
+	int64_t peak = heap_peak.load(std::memory_order_relaxed);
+	while (now > peak && !heap_peak.compare_exchange_weak(peak, now, std::memory_order_relaxed))
+	{
+	}
+}
+
+void AllocProfiler::request_report()
+{
+	report_requested = true;
+}
+
+void AllocProfiler::poll()
+{
+	if (!enabled || !report_requested.exchange(false))
+	{
+		return;
+	}
+
+	std::string error;
+	if (!write_report(&error))
+	{
+		printf("%s\n", error.c_str());
+	}
+}
+
+bool AllocProfiler::write_report(std::string* error)
+{
+	std::vector<std::pair<std::string, StackCounts>> sorted;
+	{
+		std::lock_guard<std::mutex> lock(stacks_mutex);
+		sorted.assign(stacks.begin(), stacks.end());
+	}
+	std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) {
+		return a.second.bytes > b.second.bytes;
+	});
+
+	std::string folded;
+	std::unordered_map<std::string, StackCounts> sites;
+	for (const auto& entry : sorted)
+	{
+		folded += entry.first;
+		folded += ' ';
+		folded += std::to_string(entry.second.bytes);
+		folded += '\n';
+
+		// A call site is the innermost frame of a stack:
+		size_t split = entry.first.rfind(';');
+		StackCounts& site = sites[split == std::string::npos ? entry.first : entry.first.substr(split + 1)];
+		site.bytes += entry.second.bytes;
+		site.allocations += entry.second.allocations;
+		site.samples += entry.second.samples;
+	}
+
+	if (!FS::write_file(report_path, folded, false, error))
+	{
+		return false;
+	}
+
+	std::vector<std::pair<std::string, StackCounts>> top(sites.begin(), sites.end());
+	std::sort(top.begin(), top.end(), [](const auto& a, const auto& b) {
+		return a.second.bytes > b.second.bytes;
+	});
+	if (top.size() > kTopSites)
+	{
+		top.resize(kTopSites);
+	}
+
+	printf("Allocation profile written to %s (sampled every %lld bytes)\n", report_path.c_str(), static_cast<long long>(sample_rate));
+	printf("VM heap: %.1f KiB in use, %.1f KiB peak\n", heap_bytes.load() / 1024.0, heap_peak.load() / 1024.0);
+	printf("   %12s  %12s  %8s  %s\n", "BYTES", "ALLOCS", "SAMPLES", "CALL SITE");
+	for (const auto& entry : top)
+	{
+		printf("   %12llu  %12.0f  %8llu  %s\n", static_cast<unsigned long long>(entry.second.bytes), entry.second.allocations,
+			static_cast<unsigned long long>(entry.second.samples), entry.first.c_str());
+	}
+
+	return true;
+}
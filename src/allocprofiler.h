@@ -0,0 +1,38 @@
+#ifndef LUAUPI_ALLOCPROFILER_H
+#define LUAUPI_ALLOCPROFILER_H
+
+#include <lua.h>
+#include <cstddef>
+#include <string>
+
+namespace LuauPi
+{
+
+// Sampled allocation profile for --alloc-profile runs. Each time another sample_rate bytes have been
+// allocated on a thread, the allocating Luau stack is recorded. Totals are kept per stack across every actor.
+class AllocProfiler
+{
+public:
+	static constexpr size_t kDefaultSampleRate = 64 * 1024;
+
+	// Only valid before any actor starts:
+	static void enable(const std::string& report_path, size_t sample_rate);
+	static bool is_enabled();
+
+	// Installs the sampling hook on a new state:
+	static void attach(lua_State* L);
+	// Called by the state allocator, to track how much memory the VMs hold from the system:
+	static void track_heap(size_t osize, size_t nsize);
+
+	// Safe to call from a signal handler. The next poll() writes the report:
+	static void request_report();
+	// Called regularly from each actor's loop:
+	static void poll();
+
+	// Writes folded stacks weighted by sampled bytes, and prints the top allocating call sites:
+	static bool write_report(std::string* error);
+};
+
+}
+
+#endif
@@ -0,0 +1,307 @@
+#include "bundle.h"
+
+#include <Luau/Parser.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fs.h"
+#include "script.h"
+
+using namespace LuauPi;
+
+static constexpr char kMagic[4] = {'L', 'P', 'B', '1'};
+static constexpr uint32_t kVersion = 1;
+
+struct BundleHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t module_count;
+	uint32_t entry;
+};
+
+struct BundleEntry
+{
+	uint32_t name_offset;
+	uint32_t name_size;
+	uint32_t bytecode_offset;
+	uint32_t bytecode_size;
+};
+
+static std::unique_ptr<Bundle> mounted;
+
+// Collects the literal paths passed to require and actor.spawn:
+struct DependencyFinder : Luau::AstVisitor
+{
+	std::vector<std::string> required;
+	std::vector<std::string> spawned;
+
+	bool visit(Luau::AstExprCall* call) override
+	{
+		if (call->args.size != 1)
+		{
+			return true;
+		}
+
+		Luau::AstExprConstantString* path = call->args.data[0]->as<Luau::AstExprConstantString>();
+		if (!path)
+		{
+			return true;
+		}
+		std::string value(path->value.data, path->value.size);
+
+		if (Luau::AstExprGlobal* global = call->func->as<Luau::AstExprGlobal>())
+		{
+			if (strcmp(global->name.value, "require") == 0)
+			{
+				required.push_back(value);
+			}
+		}
+		else if (Luau::AstExprIndexName* index = call->func->as<Luau::AstExprIndexName>())
+		{
+			Luau::AstExprGlobal* global = index->expr->as<Luau::AstExprGlobal>();
+			if (global && strcmp(global->name.value, "actor") == 0 && strcmp(index->index.value, "spawn") == 0)
+			{
+				spawned.push_back(value);
+			}
+		}
+
+		return true;
+	}
+};
+
+Bundle::Bundle() : data(nullptr), size(0)
+{
+}
+
+Bundle::~Bundle()
+{
+	if (data)
+	{
+		munmap(data, size);
+	}
+}
+
+bool Bundle::is_bundle(const std::string& filepath)
+{
+	FILE* file = fopen(filepath.c_str(), "rb");
+	if (!file)
+	{
+		return false;
+	}
+
+	char magic[sizeof(kMagic)];
+	bool matches = fread(magic, 1, sizeof(magic), file) == sizeof(magic) && memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+	fclose(file);
+
+	return matches;
+}
+
+std::unique_ptr<Bundle> Bundle::open(const std::string& filepath, std::string* error)
+{
+	int fd = ::open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		*error = filepath + ": " + strerror(errno);
+		return nullptr;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		*error = filepath + ": " + strerror(errno);
+		::close(fd);
+		return nullptr;
+	}
+	if (static_cast<size_t>(st.st_size) < sizeof(BundleHeader))
+	{
+		*error = filepath + ": not a valid bundle";
+		::close(fd);
+		return nullptr;
+	}
+
+	void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if (mapped == MAP_FAILED)
+	{
+		*error = filepath + ": " + strerror(errno);
+		return nullptr;
+	}
+
+	std::unique_ptr<Bundle> bundle(new Bundle());
+	bundle->data = mapped;
+	bundle->size = st.st_size;
+
+	const char* bytes = static_cast<const char*>(mapped);
+	uint64_t total = bundle->size;
+
+	BundleHeader header;
+	memcpy(&header, bytes, sizeof(header));
+	bool valid = memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 && header.version == kVersion && header.entry < header.module_count
+		&& sizeof(header) + static_cast<uint64_t>(header.module_count) * sizeof(BundleEntry) <= total;
+
+	for (uint32_t i = 0; valid && i < header.module_count; i++)
+	{
+		BundleEntry entry;
+		memcpy(&entry, bytes + sizeof(header) + i * sizeof(BundleEntry), sizeof(entry));
+
+		valid = static_cast<uint64_t>(entry.name_offset) + entry.name_size <= total
+			&& static_cast<uint64_t>(entry.bytecode_offset) + entry.bytecode_size <= total;
+		if (valid)
+		{
+			std::string name(bytes + entry.name_offset, entry.name_size);
+			bundle->modules[name] = Module{entry.bytecode_offset, entry.bytecode_size};
+			if (i == header.entry)
+			{
+				bundle->entry = name;
+			}
+		}
+	}
+
+	if (!valid)
+	{
+		*error = filepath + ": not a valid bundle";
+		return nullptr;
+	}
+
+	return bundle;
+}
+
+bool Bundle::build(const std::string& entry, const std::string& output, std::vector<std::string>* names, std::string* error)
+{
+	names->clear();
+	std::vector<std::string> bytecodes;
+
+	std::deque<std::string> pending{LuauScript::normalize_path(entry)};
+	std::set<std::string> seen(pending.begin(), pending.end());
+
+	while (!pending.empty())
+	{
+		std::string name = pending.front();
+		pending.pop_front();
+
+		std::string source;
+		if (!FS::read_file(name, &source, error))
+		{
+			return false;
+		}
+
+		// A leading zero byte marks a compile error, followed by the message:
+		std::string bytecode = LuauScript::compile(source);
+		if (bytecode.empty() || bytecode[0] == 0)
+		{
+			*error = name + (bytecode.empty() ? ": compile failed" : bytecode.substr(1));
+			return false;
+		}
+
+		Luau::Allocator allocator;
+		Luau::AstNameTable name_table(allocator);
+		Luau::ParseResult result = Luau::Parser::parse(source.data(), source.size(), name_table, allocator);
+		DependencyFinder finder;
+		result.root->visit(&finder);
+
+		std::vector<std::string> dependencies;
+		for (const std::string& path : finder.required)
+		{
+			std::string dependency;
+			if (!LuauScript::resolve_module(name, path, &dependency))
+			{
+				*error = name + ": cannot find module '" + path + "'";
+				return false;
+			}
+			dependencies.push_back(dependency);
+		}
+		// Actor scripts are opened by path, as given:
+		for (const std::string& path : finder.spawned)
+		{
+			std::string dependency = LuauScript::normalize_path(path);
+			if (access(dependency.c_str(), R_OK) != 0)
+			{
+				*error = name + ": cannot find actor script '" + path + "'";
+				return false;
+			}
+			dependencies.push_back(dependency);
+		}
+
+		for (const std::string& dependency : dependencies)
+		{
+			if (seen.insert(dependency).second)
+			{
+				pending.push_back(dependency);
+			}
+		}
+
+		names->push_back(name);
+		bytecodes.push_back(std::move(bytecode));
+	}
+
+	BundleHeader header;
+	memcpy(header.magic, kMagic, sizeof(kMagic));
+	header.version = kVersion;
+	header.module_count = static_cast<uint32_t>(names->size());
+	header.entry = 0;
+
+	std::string index;
+	std::string blob;
+	uint64_t data_offset = sizeof(header) + names->size() * sizeof(BundleEntry);
+	for (size_t i = 0; i < names->size(); i++)
+	{
+		BundleEntry entry;
+		entry.name_offset = static_cast<uint32_t>(data_offset + blob.size());
+		entry.name_size = static_cast<uint32_t>((*names)[i].size());
+		blob += (*names)[i];
+		entry.bytecode_offset = static_cast<uint32_t>(data_offset + blob.size());
+		entry.bytecode_size = static_cast<uint32_t>(bytecodes[i].size());
+		blob += bytecodes[i];
+
+		index.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+	}
+
+	if (data_offset + blob.size() > UINT32_MAX)
+	{
+		*error = output + ": bundle is larger than 4 GiB";
+		return false;
+	}
+
+	std::string out(reinterpret_cast<const char*>(&header), sizeof(header));
+	out += index;
+	out += blob;
+
+	return FS::write_file(output, out, false, error);
+}
+
+const std::string& Bundle::get_entry() const
+{
+	return entry;
+}
+
+bool Bundle::find(const std::string& name, const char** bytecode, size_t* bytecode_size) const
+{
+	auto it = modules.find(name);
+	if (it == modules.end())
+	{
+		return false;
+	}
+
+	*bytecode = static_cast<const char*>(data) + it->second.offset;
+	*bytecode_size = it->second.size;
+
+	return true;
+}
+
+void Bundle::mount(std::unique_ptr<Bundle> bundle)
+{
+	mounted = std::move(bundle);
+}
+
+const Bundle* Bundle::get_mounted()
+{
+	return mounted.get();
+}
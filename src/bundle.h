@@ -0,0 +1,55 @@
+#ifndef LUAUPI_BUNDLE_H
+#define LUAUPI_BUNDLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace LuauPi
+{
+
+// Precompiled bytecode for a script and every module it needs, in one .lpb file. The file is
+// mapped into memory, and each module's bytecode is only loaded when it is first required.
+//
+// Layout, little-endian: a header of "LPB1", version, module count and entry index, then one
+// entry per module of name offset, name size, bytecode offset and bytecode size, then the data.
+class Bundle
+{
+private:
+	struct Module
+	{
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	void* data;
+	size_t size;
+	std::string entry;
+	std::unordered_map<std::string, Module> modules;
+
+	Bundle();
+
+public:
+	~Bundle();
+
+	static bool is_bundle(const std::string& filepath);
+	static std::unique_ptr<Bundle> open(const std::string& filepath, std::string* error);
+
+	// Compiles entry and every module it requires or spawns as an actor, by literal path, into output.
+	// names is set to the modules written, entry first:
+	static bool build(const std::string& entry, const std::string& output, std::vector<std::string>* names, std::string* error);
+
+	const std::string& get_entry() const;
+	bool find(const std::string& name, const char** bytecode, size_t* bytecode_size) const;
+
+	// Scripts and modules come from the mounted bundle instead of the file system. Only valid before any actor starts:
+	static void mount(std::unique_ptr<Bundle> bundle);
+	static const Bundle* get_mounted();
+};
+
+}
+
+#endif
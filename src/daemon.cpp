@@ -0,0 +1,321 @@
+#include "daemon.h"
+
+#include <lua.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace LuauPi;
+
+// Longest command line accepted, which leaves room for any path:
+static constexpr size_t kMaxCommand = 4096;
+
+static bool unix_address(const std::string& path, sockaddr_un* addr, std::string* error)
+{
+	if (path.size() >= sizeof(addr->sun_path))
+	{
+		*error = path + ": path too long";
+		return false;
+	}
+
+	memset(addr, 0, sizeof(sockaddr_un));
+	addr->sun_family = AF_UNIX;
+	memcpy(addr->sun_path, path.c_str(), path.size() + 1);
+
+	return true;
+}
+
+static int listen_on(const std::string& path, std::string* error)
+{
+	sockaddr_un addr;
+	if (!unix_address(path, &addr, error))
+	{
+		return -1;
+	}
+
+	// A socket file nobody answers on is left over from a daemon that did not exit cleanly:
+	struct stat st;
+	if (stat(path.c_str(), &st) == 0)
+	{
+		int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		bool answered = probe >= 0 && connect(probe, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0;
+		if (probe >= 0)
+		{
+			close(probe);
+		}
+
+		if (answered || !S_ISSOCK(st.st_mode))
+		{
+			*error = path + (answered ? ": another daemon is listening" : ": exists and is not a socket");
+			return -1;
+		}
+		unlink(path.c_str());
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+	{
+		*error = std::string("socket: ") + strerror(errno);
+		return -1;
+	}
+
+	// Commands can start any script, so only the daemon's user may send them:
+	if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || chmod(path.c_str(), 0600) != 0 || listen(fd, 8) != 0)
+	{
+		*error = path + ": " + strerror(errno);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+// Reads up to the first newline, or whatever arrived before the peer stopped sending:
+static std::string read_line(int fd)
+{
+	std::string line;
+	char buffer[512];
+	while (line.find('\n') == std::string::npos && line.size() < kMaxCommand)
+	{
+		ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+		if (n <= 0)
+		{
+			break;
+		}
+		line.append(buffer, static_cast<size_t>(n));
+	}
+
+	return line.substr(0, line.find('\n'));
+}
+
+Daemon::Daemon(const ActorOptions& options) : options(options)
+{
+}
+
+Daemon::~Daemon()
+{
+	if (current)
+	{
+		current->stop();
+		current->join();
+	}
+}
+
+bool Daemon::load(const std::string& filepath, DaemonTiming* timing, std::string* error)
+{
+	double requested = lua_clock();
+
+	// The new actor compiles on its own thread, then waits for the go-ahead:
+	std::shared_ptr<std::string> load_error = std::make_shared<std::string>();
+	std::shared_ptr<std::promise<bool>> loaded = std::make_shared<std::promise<bool>>();
+	std::future<bool> load_result = loaded->get_future();
+	std::promise<bool> go;
+	std::shared_future<bool> go_result = go.get_future().share();
+	std::shared_ptr<std::promise<double>> ticked = std::make_shared<std::promise<double>>();
+	std::future<double> first_tick = ticked->get_future();
+	std::shared_ptr<std::promise<void>> stopped = std::make_shared<std::promise<void>>();
+
+	ActorHooks hooks;
+	hooks.ready = [load_error, loaded, go_result](const char* message) {
+		if (message)
+		{
+			*load_error = message;
+		}
+		loaded->set_value(message == nullptr);
+		return go_result.get();
+	};
+	hooks.ticked = [ticked]() {
+		ticked->set_value(lua_clock());
+	};
+	hooks.stopped = [stopped]() {
+		stopped->set_value();
+	};
+
+	std::shared_ptr<Actor> next = std::make_shared<Actor>(filepath, options, nullptr);
+	next->start(std::move(hooks));
+
+	if (!load_result.get())
+	{
+		go.set_value(false);
+		next->join();
+		*error = *load_error;
+		return false;
+	}
+
+	// Nothing drives the pins from here until the new script ticks. The old loop stops within a tick
+	// and releases its pins, and its exit callbacks and teardown run after the new script has started:
+	double stopping = lua_clock();
+	std::shared_ptr<Actor> previous = std::move(current);
+	if (previous)
+	{
+		previous->stop();
+		current_stopped.wait();
+	}
+
+	go.set_value(true);
+	double ticked_at = first_tick.get();
+
+	if (previous)
+	{
+		previous->join();
+	}
+
+	current = std::move(next);
+	current_stopped = stopped->get_future().share();
+	current_path = filepath;
+
+	timing->first_tick = ticked_at - requested;
+	timing->handover = ticked_at - stopping;
+
+	return true;
+}
+
+bool Daemon::reload(DaemonTiming* timing, std::string* error)
+{
+	if (current_path.empty())
+	{
+		*error = "no script has been loaded";
+		return false;
+	}
+
+	return load(current_path, timing, error);
+}
+
+bool Daemon::stop(std::string* error)
+{
+	bool running = current && current->is_running();
+	if (current)
+	{
+		current->stop();
+		current->join();
+		current.reset();
+	}
+
+	if (!running)
+	{
+		*error = "no script is running";
+		return false;
+	}
+
+	return true;
+}
+
+std::string Daemon::execute(const std::string& command)
+{
+	size_t space = command.find(' ');
+	std::string name = command.substr(0, space);
+	std::string argument = space == std::string::npos ? "" : command.substr(space + 1);
+
+	std::string error;
+	if (name == "load" || name == "reload")
+	{
+		if (name == "load" && argument.empty())
+		{
+			return "error load needs a file";
+		}
+
+		DaemonTiming timing;
+		bool ok = name == "load" ? load(argument, &timing, &error) : reload(&timing, &error);
+		if (!ok)
+		{
+			printf("Failed to load %s\n", name == "load" ? argument.c_str() : current_path.c_str());
+			return "error " + error;
+		}
+
+		char reply[256];
+		snprintf(reply, sizeof(reply), "ok first tick after %.3f ms, %.3f ms handover", timing.first_tick * 1000, timing.handover * 1000);
+		printf("Loaded %s: %s\n", current_path.c_str(), reply + 3);
+
+		return reply;
+	}
+	else if (name == "stop")
+	{
+		if (!stop(&error))
+		{
+			return "error " + error;
+		}
+
+		printf("Stopped %s\n", current_path.c_str());
+		return "ok stopped";
+	}
+
+	return "error unknown command: " + name;
+}
+
+bool Daemon::serve(const std::string& socket_path, const volatile bool* quit, const Waker* interrupt, std::string* error)
+{
+	int fd = listen_on(socket_path, error);
+	if (fd < 0)
+	{
+		return false;
+	}
+
+	printf("Listening on %s\n", socket_path.c_str());
+	fflush(stdout);
+
+	while (!*quit)
+	{
+		interrupt->wait(-1, {fd});
+		interrupt->reset();
+
+		int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+		if (client < 0)
+		{
+			continue;
+		}
+
+		// A client that connects and never sends a line must not hold up the daemon:
+		timeval timeout{1, 0};
+		setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+		std::string reply = execute(read_line(client)) + "\n";
+		send(client, reply.data(), reply.size(), MSG_NOSIGNAL);
+		close(client);
+		fflush(stdout);
+	}
+
+	close(fd);
+	unlink(socket_path.c_str());
+
+	return true;
+}
+
+bool Daemon::send_command(const std::string& socket_path, const std::string& command, std::string* reply, std::string* error)
+{
+	sockaddr_un addr;
+	if (!unix_address(socket_path, &addr, error))
+	{
+		return false;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+	{
+		*error = socket_path + ": " + strerror(errno);
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return false;
+	}
+
+	std::string line = command + "\n";
+	send(fd, line.data(), line.size(), MSG_NOSIGNAL);
+	shutdown(fd, SHUT_WR);
+
+	*reply = read_line(fd);
+	close(fd);
+
+	if (reply->empty())
+	{
+		*error = socket_path + ": no reply";
+		return false;
+	}
+
+	return true;
+}
@@ -0,0 +1,69 @@
+#ifndef LUAUPI_DAEMON_H
+#define LUAUPI_DAEMON_H
+
+#include <future>
+#include <memory>
+#include <string>
+
+#include "actor.h"
+#include "waker.h"
+
+namespace LuauPi
+{
+
+// How long a load took, in seconds:
+struct DaemonTiming
+{
+	// From the request to the new script's first tick, compile included:
+	double first_tick = 0;
+	// Between the old script being told to stop and the new one's first tick, while nothing drives the pins:
+	double handover = 0;
+};
+
+// Keeps the runtime and GPIO backend initialized between scripts, for luaupi daemon. Scripts are
+// swapped over a Unix control socket taking one command per connection, each a line answered with
+// a line starting with "ok" or "error":
+//
+//   load FILE   compile FILE in a fresh state, then swap it in for the running script
+//   reload      load the running (or last) script again
+//   stop        stop the running script, keeping the daemon up
+//
+// Pin levels are left as the old script set them until the new one changes them. The new script
+// starts as soon as the old one stops ticking, so the old pi.onExit callbacks run alongside it and
+// can only write pins it has not claimed.
+class Daemon
+{
+private:
+	ActorOptions options;
+	std::shared_ptr<Actor> current;
+	// Ready once the running script has stopped ticking:
+	std::shared_future<void> current_stopped;
+	std::string current_path;
+
+	// Runs one command line and returns the reply:
+	std::string execute(const std::string& command);
+
+public:
+	static constexpr const char* kDefaultSocket = "/tmp/luaupi.sock";
+
+	explicit Daemon(const ActorOptions& options);
+	~Daemon();
+
+	Daemon(const Daemon&) = delete;
+	Daemon& operator=(const Daemon&) = delete;
+
+	// Runs filepath in place of the running script. If it fails to compile, the running script carries on:
+	bool load(const std::string& filepath, DaemonTiming* timing, std::string* error);
+	bool reload(DaemonTiming* timing, std::string* error);
+	bool stop(std::string* error);
+
+	// Answers commands on socket_path until quit is set. interrupt wakes the loop to check quit:
+	bool serve(const std::string& socket_path, const volatile bool* quit, const Waker* interrupt, std::string* error);
+
+	// Sends command to the daemon listening on socket_path, for luaupi ctl:
+	static bool send_command(const std::string& socket_path, const std::string& command, std::string* reply, std::string* error);
+};
+
+}
+
+#endif
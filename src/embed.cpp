@@ -0,0 +1,154 @@
+#include "luaupi.h"
+
+#include <lua.h>
+#include <lualib.h>
+#include <memory>
+#include <string>
+
+#include "state.h"
+#include "scheduler.h"
+#include "script.h"
+#include "bundle.h"
+#include "pilib.h"
+
+using namespace LuauPi;
+
+struct luaupi_State
+{
+	LuauState state;
+	LuauTaskScheduler* scheduler;
+	double last;
+	std::string error;
+};
+
+luaupi_State* luaupi_create(const luaupi_Options* options)
+{
+	luaupi_Options defaults{};
+	if (options == nullptr)
+	{
+		options = &defaults;
+	}
+
+	LuauScript::set_native(options->native != 0);
+
+	luaupi_State* state = new luaupi_State();
+	state->scheduler = LuauTaskScheduler::get(state->state.get());
+	state->last = lua_clock();
+
+	if (options->budget > 0)
+	{
+		state->scheduler->set_resume_budget(options->budget, options->budget_error ? BudgetPolicy::Error : BudgetPolicy::Yield);
+	}
+	if (options->low_priority_budget > 0)
+	{
+		state->scheduler->set_low_priority_budget(options->low_priority_budget);
+	}
+
+	return state;
+}
+
+void luaupi_destroy(luaupi_State* state)
+{
+	if (state == nullptr)
+	{
+		return;
+	}
+
+	pilib_call_exit_callbacks(state->state.get());
+
+	delete state;
+}
+
+// Runs the chunk on top of the stack as the script's main task:
+static int run_chunk(luaupi_State* state)
+{
+	int status;
+	lua_State* T = LuauScript::run_loaded(state->state.get(), &status);
+	if (status != LUA_OK && status != LUA_YIELD)
+	{
+		state->error = LuauTaskScheduler::describe_error(T);
+		return -1;
+	}
+
+	return 0;
+}
+
+int luaupi_load(luaupi_State* state, const char* path)
+{
+	lua_State* L = state->state.get();
+
+	std::string script = path;
+	if (Bundle::is_bundle(script))
+	{
+		if (Bundle::get_mounted())
+		{
+			state->error = "a bundle is already loaded";
+			return -1;
+		}
+
+		std::unique_ptr<Bundle> bundle = Bundle::open(script, &state->error);
+		if (!bundle)
+		{
+			return -1;
+		}
+
+		script = bundle->get_entry();
+		Bundle::mount(std::move(bundle));
+	}
+
+	if (!LuauScript::load(L, script))
+	{
+		state->error = lua_tostring(L, -1);
+		lua_pop(L, 1);
+		return -1;
+	}
+
+	return run_chunk(state);
+}
+
+int luaupi_load_source(luaupi_State* state, const char* chunkname, const char* source, size_t size)
+{
+	lua_State* L = state->state.get();
+
+	if (!LuauScript::load_source(L, chunkname, std::string(source, size)))
+	{
+		state->error = lua_tostring(L, -1);
+		lua_pop(L, 1);
+		return -1;
+	}
+
+	return run_chunk(state);
+}
+
+int luaupi_step(luaupi_State* state, double now)
+{
+	double dt = now - state->last;
+	state->last = now;
+
+	return state->scheduler->update(now, dt) ? 1 : 0;
+}
+
+double luaupi_next_deadline(luaupi_State* state)
+{
+	return state->scheduler->next_deadline();
+}
+
+int luaupi_fd(luaupi_State* state)
+{
+	return state->scheduler->get_poll_fd();
+}
+
+double luaupi_clock(void)
+{
+	return lua_clock();
+}
+
+const char* luaupi_error(luaupi_State* state)
+{
+	return state->error.c_str();
+}
+
+lua_State* luaupi_lua(luaupi_State* state)
+{
+	return state->state.get();
+}
@@ -1,6 +1,9 @@
 #include "fs.h"
 
 #include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
 
 using namespace LuauPi;
 
@@ -20,3 +23,54 @@ std::string FS::read_file(const std::string& filepath)
 	
 	return out;
 }
+
+static std::string describe_error(const std::string& filepath)
+{
+	return filepath + ": " + strerror(errno);
+}
+
+bool FS::read_file(const std::string& filepath, std::string* out, std::string* error)
+{
+	FILE* file = fopen(filepath.c_str(), "rb");
+	if (!file)
+	{
+		*error = describe_error(filepath);
+		return false;
+	}
+
+	out->clear();
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+	{
+		out->append(buf, n);
+	}
+
+	bool ok = !ferror(file);
+	if (!ok)
+	{
+		*error = describe_error(filepath);
+	}
+	fclose(file);
+
+	return ok;
+}
+
+bool FS::write_file(const std::string& filepath, const std::string& data, bool append, std::string* error)
+{
+	FILE* file = fopen(filepath.c_str(), append ? "ab" : "wb");
+	if (!file)
+	{
+		*error = describe_error(filepath);
+		return false;
+	}
+
+	bool ok = fwrite(data.data(), 1, data.size(), file) == data.size();
+	ok = fclose(file) == 0 && ok;
+	if (!ok)
+	{
+		*error = describe_error(filepath);
+	}
+
+	return ok;
+}
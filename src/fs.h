@@ -10,6 +10,10 @@ class FS
 {
 public:
 	static std::string read_file(const std::string& filepath);
+
+	// On failure these return false and set error to a description of the problem:
+	static bool read_file(const std::string& filepath, std::string* out, std::string* error);
+	static bool write_file(const std::string& filepath, const std::string& data, bool append, std::string* error);
 };
 
 }
@@ -0,0 +1,366 @@
+#include "fslib.h"
+
+#include <lualib.h>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+
+#include "scheduler.h"
+#include "workerpool.h"
+#include "fs.h"
+
+using namespace LuauPi;
+
+static constexpr const char* kFile = "File";
+
+// Writes are coalesced in memory and handed to the worker pool once this much is buffered:
+static constexpr size_t kWriteBufferSize = 64 * 1024;
+
+// State shared between a File handle and the jobs writing on its behalf:
+struct FileState
+{
+	FILE* file;
+
+	// Buffers are written in the order they were handed off. Each job takes a
+	// ticket and waits for its turn, since workers may pick jobs up concurrently:
+	std::mutex mutex;
+	std::condition_variable turn;
+	uint64_t issued;
+	uint64_t completed;
+
+	// First write error, raised by the next write, flush or close:
+	std::string error;
+};
+
+struct File
+{
+	std::shared_ptr<FileState> state;
+	std::string buffer;
+	bool closed;
+};
+
+static void check_data(lua_State* L, int idx, std::string* out)
+{
+	size_t len;
+	const char* bytes;
+	if (lua_isbuffer(L, idx))
+	{
+		bytes = static_cast<const char*>(lua_tobuffer(L, idx, &len));
+	}
+	else
+	{
+		bytes = luaL_checklstring(L, idx, &len);
+	}
+
+	out->append(bytes, len);
+}
+
+int fs_read_file(lua_State* L)
+{
+	std::string filepath = luaL_checkstring(L, 1);
+
+	struct Result
+	{
+		bool ok;
+		std::string data;
+		std::string error;
+	};
+	std::shared_ptr<Result> result = std::make_shared<Result>();
+
+	return LuauTaskScheduler::get(L)->offload(
+		L,
+		[filepath, result]() {
+			result->ok = FS::read_file(filepath, &result->data, &result->error);
+		},
+		[result](lua_State* T) {
+			if (!result->ok)
+			{
+				lua_pushlstring(T, result->error.data(), result->error.size());
+				return -1;
+			}
+			lua_pushlstring(T, result->data.data(), result->data.size());
+			return 1;
+		}
+	);
+}
+
+static int write_file(lua_State* L, bool append)
+{
+	std::string filepath = luaL_checkstring(L, 1);
+
+	std::shared_ptr<std::string> data = std::make_shared<std::string>();
+	check_data(L, 2, data.get());
+
+	std::shared_ptr<std::string> error = std::make_shared<std::string>();
+
+	return LuauTaskScheduler::get(L)->offload(
+		L,
+		[filepath, data, append, error]() {
+			FS::write_file(filepath, *data, append, error.get());
+		},
+		[error](lua_State* T) {
+			if (!error->empty())
+			{
+				lua_pushlstring(T, error->data(), error->size());
+				return -1;
+			}
+			return 0;
+		}
+	);
+}
+
+int fs_write_file(lua_State* L)
+{
+	return write_file(L, luaL_optboolean(L, 3, false));
+}
+
+static int fs_append(lua_State* L)
+{
+	return write_file(L, true);
+}
+
+static File* check_file(lua_State* L, int idx)
+{
+	File* file = static_cast<File*>(luaL_checkudata(L, idx, kFile));
+	if (file->closed)
+	{
+		luaL_error(L, "attempt to use a closed file");
+	}
+
+	return file;
+}
+
+// Hands the buffered data to the worker pool and yields until it is written. Flushes the
+// stream to the OS too when sync is set, and closes it when close is set:
+static int write_buffer(lua_State* L, File* file, bool sync, bool close)
+{
+	// Checked before anything is handed off, so the buffer is kept if the caller cannot yield:
+	if (!lua_isyieldable(L))
+	{
+		luaL_error(L, "attempt to write from a thread that cannot yield");
+	}
+
+	std::shared_ptr<FileState> state = file->state;
+	std::shared_ptr<std::string> data = std::make_shared<std::string>(std::move(file->buffer));
+	file->buffer.clear();
+	if (close)
+	{
+		file->closed = true;
+	}
+
+	uint64_t ticket = state->issued++;
+
+	return LuauTaskScheduler::get(L)->offload(
+		L,
+		[state, data, ticket, sync, close]() {
+			std::unique_lock<std::mutex> lock(state->mutex);
+			state->turn.wait(lock, [&state, ticket]() {
+				return state->completed == ticket;
+			});
+
+			if (state->error.empty())
+			{
+				bool ok = fwrite(data->data(), 1, data->size(), state->file) == data->size();
+				if (ok && (sync || close))
+				{
+					ok = fflush(state->file) == 0;
+				}
+				if (!ok)
+				{
+					state->error = strerror(errno);
+				}
+			}
+			if (close)
+			{
+				fclose(state->file);
+				state->file = nullptr;
+			}
+
+			state->completed++;
+			state->turn.notify_all();
+		},
+		[state](lua_State* T) {
+			std::lock_guard<std::mutex> lock(state->mutex);
+			if (!state->error.empty())
+			{
+				lua_pushlstring(T, state->error.data(), state->error.size());
+				return -1;
+			}
+			return 0;
+		}
+	);
+}
+
+static int file_write(lua_State* L)
+{
+	File* file = check_file(L, 1);
+
+	check_data(L, 2, &file->buffer);
+
+	// Only yields once enough has been buffered to be worth a write:
+	if (file->buffer.size() >= kWriteBufferSize)
+	{
+		return write_buffer(L, file, false, false);
+	}
+
+	return 0;
+}
+
+static int file_flush(lua_State* L)
+{
+	File* file = check_file(L, 1);
+	return write_buffer(L, file, true, false);
+}
+
+static int file_close(lua_State* L)
+{
+	File* file = check_file(L, 1);
+	return write_buffer(L, file, true, true);
+}
+
+static int file_index(lua_State* L)
+{
+	File* file = static_cast<File*>(luaL_checkudata(L, 1, kFile));
+	const char* key = luaL_checkstring(L, 2);
+
+	if (strcmp(key, "write") == 0)
+	{
+		lua_pushcfunction(L, file_write, "write");
+	}
+	else if (strcmp(key, "flush") == 0)
+	{
+		lua_pushcfunction(L, file_flush, "flush");
+	}
+	else if (strcmp(key, "close") == 0)
+	{
+		lua_pushcfunction(L, file_close, "close");
+	}
+	else if (strcmp(key, "closed") == 0)
+	{
+		lua_pushboolean(L, file->closed);
+	}
+	else if (strcmp(key, "buffered") == 0)
+	{
+		lua_pushnumber(L, static_cast<double>(file->buffer.size()));
+	}
+	else
+	{
+		luaL_error(L, "%s is not a valid member of File", key);
+	}
+
+	return 1;
+}
+
+static void file_destructor(void* ud)
+{
+	File* file = static_cast<File*>(ud);
+
+	// A file that was never closed is written out and closed on a worker, after any writes still in flight:
+	if (!file->closed)
+	{
+		std::shared_ptr<FileState> state = file->state;
+		std::shared_ptr<std::string> data = std::make_shared<std::string>(std::move(file->buffer));
+		uint64_t ticket = state->issued++;
+
+		WorkerPool::get().submit_detached([state, data, ticket]() {
+			std::unique_lock<std::mutex> lock(state->mutex);
+			state->turn.wait(lock, [&state, ticket]() {
+				return state->completed == ticket;
+			});
+
+			fwrite(data->data(), 1, data->size(), state->file);
+			fclose(state->file);
+			state->file = nullptr;
+
+			state->completed++;
+			state->turn.notify_all();
+		});
+	}
+
+	file->~File();
+}
+
+static int fs_open(lua_State* L)
+{
+	std::string filepath = luaL_checkstring(L, 1);
+	const char* mode = luaL_optstring(L, 2, "w");
+
+	bool append = strcmp(mode, "a") == 0;
+	luaL_argcheck(L, append || strcmp(mode, "w") == 0, 2, "expected 'w' or 'a'");
+
+	struct Result
+	{
+		FILE* file = nullptr;
+		std::string error;
+
+		// Closes a file no task took, when the task was cancelled or its actor stopped while it opened:
+		~Result()
+		{
+			if (file)
+			{
+				fclose(file);
+			}
+		}
+	};
+	std::shared_ptr<Result> result = std::make_shared<Result>();
+
+	return LuauTaskScheduler::get(L)->offload(
+		L,
+		[filepath, append, result]() {
+			result->file = fopen(filepath.c_str(), append ? "ab" : "wb");
+			if (!result->file)
+			{
+				result->error = filepath + ": " + strerror(errno);
+			}
+		},
+		[result](lua_State* T) {
+			if (!result->file)
+			{
+				lua_pushlstring(T, result->error.data(), result->error.size());
+				return -1;
+			}
+
+			void* data = lua_newuserdatadtor(T, sizeof(File), file_destructor);
+			File* file = new (data) File();
+			file->state = std::make_shared<FileState>();
+			file->state->file = result->file;
+			result->file = nullptr;
+			file->state->issued = 0;
+			file->state->completed = 0;
+			file->buffer.reserve(kWriteBufferSize);
+			file->closed = false;
+
+			luaL_getmetatable(T, kFile);
+			lua_setmetatable(T, -2);
+
+			return 1;
+		}
+	);
+}
+
+static const luaL_Reg fs_lib[] = {
+	{"readFile", fs_read_file},
+	{"writeFile", fs_write_file},
+	{"append", fs_append},
+	{"open", fs_open},
+	{nullptr, nullptr},
+};
+
+void fs_lib_open(lua_State* L)
+{
+	luaL_register(L, "fs", fs_lib);
+	lua_pop(L, 1);
+
+	// File handle metatable:
+	luaL_newmetatable(L, kFile);
+	lua_pushcfunction(L, file_index, "__index");
+	lua_setfield(L, -2, "__index");
+	lua_pushstring(L, "The metatable is locked");
+	lua_setfield(L, -2, "__metatable");
+	lua_pop(L, 1);
+}
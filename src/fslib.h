@@ -0,0 +1,12 @@
+#ifndef FSLIB_H
+#define FSLIB_H
+
+#include <lua.h>
+
+// Yielding file operations, shared with task.offload. Arguments start at index 1:
+int fs_read_file(lua_State* L);
+int fs_write_file(lua_State* L);
+
+void fs_lib_open(lua_State* L);
+
+#endif
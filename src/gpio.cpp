@@ -0,0 +1,208 @@
+#include "gpio.h"
+
+#include <lua.h>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+#include "gpiowiringpi.h"
+
+using namespace LuauPi;
+
+static std::mutex setup_mutex;
+static bool setup_done = false;
+static bool setup_result = false;
+
+// Switched by pointer while other actors may be mid-call, so replaced backends are kept until exit
+// instead of being freed under them. Guarded by setup_mutex:
+static std::vector<std::unique_ptr<GpioBackend>> installed_backends;
+static std::unique_ptr<GpioBackend> default_backend(new WiringPiGpio());
+static std::atomic<GpioBackend*> backend(default_backend.get());
+static bool backend_pinned = false;
+static double epoch = lua_clock();
+
+static std::atomic<int> pin_owners[Gpio::kMaxPins];
+static thread_local int current_owner = 0;
+
+static thread_local bool has_virtual_time = false;
+static thread_local double virtual_time = 0;
+
+void GpioBackend::digital_write_mask(uint64_t set, uint64_t clear)
+{
+	for (int pin = 0; pin < 64; pin++)
+	{
+		if ((set >> pin) & 1)
+		{
+			digital_write(pin, 1);
+		}
+		else if ((clear >> pin) & 1)
+		{
+			digital_write(pin, 0);
+		}
+	}
+}
+
+bool GpioBackend::read_edges(int pin, double from, double to, std::vector<GpioEdge>* edges)
+{
+	return false;
+}
+
+double GpioBackend::next_edge(int pin, double from)
+{
+	return HUGE_VAL;
+}
+
+static GpioBackend* get_backend()
+{
+	return backend.load(std::memory_order_acquire);
+}
+
+// Must hold setup_mutex:
+static void install_backend(std::unique_ptr<GpioBackend> new_backend)
+{
+	backend.store(new_backend.get(), std::memory_order_release);
+	installed_backends.push_back(std::move(new_backend));
+}
+
+bool Gpio::setup(GpioSetup mode)
+{
+	return setup(mode, nullptr);
+}
+
+bool Gpio::setup(GpioSetup mode, std::unique_ptr<GpioBackend> new_backend)
+{
+	std::lock_guard<std::mutex> lock(setup_mutex);
+
+	// wiringPi may only be set up once per process, whichever actor asks first:
+	if (setup_done)
+	{
+		return setup_result;
+	}
+
+	if (new_backend && !backend_pinned)
+	{
+		install_backend(std::move(new_backend));
+	}
+
+	setup_done = true;
+	setup_result = get_backend()->setup(mode);
+
+	return setup_result;
+}
+
+void Gpio::set_backend(std::unique_ptr<GpioBackend> new_backend)
+{
+	std::lock_guard<std::mutex> lock(setup_mutex);
+
+	install_backend(std::move(new_backend));
+	backend_pinned = true;
+	epoch = lua_clock();
+}
+
+void Gpio::pin_mode(int pin, int mode)
+{
+	get_backend()->pin_mode(pin, mode);
+}
+
+void Gpio::pull_up_dn(int pin, int pud)
+{
+	get_backend()->pull_up_dn(pin, pud);
+}
+
+int Gpio::digital_read(int pin)
+{
+	return get_backend()->digital_read(pin);
+}
+
+void Gpio::digital_write(int pin, int value)
+{
+	get_backend()->digital_write(pin, value);
+}
+
+void Gpio::digital_write_mask(uint64_t set, uint64_t clear)
+{
+	get_backend()->digital_write_mask(set, clear);
+}
+
+void Gpio::pwm_write(int pin, int value)
+{
+	get_backend()->pwm_write(pin, value);
+}
+
+int Gpio::analog_read(int pin)
+{
+	return get_backend()->analog_read(pin);
+}
+
+void Gpio::analog_write(int pin, int value)
+{
+	get_backend()->analog_write(pin, value);
+}
+
+bool Gpio::read_edges(int pin, double from, double to, std::vector<GpioEdge>* edges)
+{
+	return get_backend()->read_edges(pin, from, to, edges);
+}
+
+double Gpio::next_edge(int pin, double from)
+{
+	return get_backend()->next_edge(pin, from);
+}
+
+void Gpio::set_virtual_time(double now)
+{
+	has_virtual_time = true;
+	virtual_time = now;
+}
+
+double Gpio::now()
+{
+	return has_virtual_time ? virtual_time : lua_clock() - epoch;
+}
+
+bool Gpio::uses_virtual_time()
+{
+	return has_virtual_time;
+}
+
+void Gpio::set_owner(int owner)
+{
+	current_owner = owner;
+}
+
+bool Gpio::claim(int pin)
+{
+	if (pin < 0 || pin >= kMaxPins || current_owner == 0)
+	{
+		return true;
+	}
+
+	int expected = 0;
+	if (pin_owners[pin].compare_exchange_strong(expected, current_owner))
+	{
+		return true;
+	}
+
+	return expected == current_owner;
+}
+
+bool Gpio::can_write(int pin)
+{
+	if (pin < 0 || pin >= kMaxPins)
+	{
+		return true;
+	}
+
+	int owner = pin_owners[pin].load(std::memory_order_relaxed);
+	return owner == 0 || owner == current_owner;
+}
+
+void Gpio::release_all(int owner)
+{
+	for (int pin = 0; pin < kMaxPins; pin++)
+	{
+		int expected = owner;
+		pin_owners[pin].compare_exchange_strong(expected, 0);
+	}
+}
@@ -0,0 +1,96 @@
+#ifndef LUAUPI_GPIO_H
+#define LUAUPI_GPIO_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace LuauPi
+{
+
+enum class GpioSetup
+{
+	WiringPi,
+	Sys,
+	Gpio,
+	Phys,
+};
+
+struct GpioEdge
+{
+	int pin;
+	int value;
+	// On the Gpio::now() clock:
+	double time;
+};
+
+// Where pin operations end up. Calls may come from any actor's thread:
+class GpioBackend
+{
+public:
+	virtual ~GpioBackend() = default;
+
+	// Returns false if the hardware could not be set up:
+	virtual bool setup(GpioSetup mode) = 0;
+
+	virtual void pin_mode(int pin, int mode) = 0;
+	virtual void pull_up_dn(int pin, int pud) = 0;
+	virtual int digital_read(int pin) = 0;
+	virtual void digital_write(int pin, int value) = 0;
+	// Sets the pins whose bits are set in set and clears those in clear, which must not overlap.
+	// One write per pin unless overridden:
+	virtual void digital_write_mask(uint64_t set, uint64_t clear);
+	virtual void pwm_write(int pin, int value) = 0;
+	virtual int analog_read(int pin) = 0;
+	virtual void analog_write(int pin, int value) = 0;
+
+	// Appends the level changes on pin after from and up to to, oldest first. Returns false unless
+	// overridden, and the pin is sampled with digital_read instead, which misses pulses between samples:
+	virtual bool read_edges(int pin, double from, double to, std::vector<GpioEdge>* edges);
+	// Time of the first level change on pin after from, for virtual-time runs to jump to. HUGE_VAL
+	// unless overridden, or when no change is known in advance:
+	virtual double next_edge(int pin, double from);
+};
+
+// Process-wide GPIO state shared by every actor. Hardware setup happens once,
+// and each pin can be claimed by a single actor at a time.
+class Gpio
+{
+public:
+	static constexpr int kMaxPins = 64;
+
+	// Replaces the backend (wiringPi by default), and keeps scripts from choosing another at setup.
+	// Only valid before any actor starts:
+	static void set_backend(std::unique_ptr<GpioBackend> backend);
+
+	static bool setup(GpioSetup mode);
+	// As above, switching to backend first unless setup already happened or the backend was set with set_backend:
+	static bool setup(GpioSetup mode, std::unique_ptr<GpioBackend> backend);
+
+	static void pin_mode(int pin, int mode);
+	static void pull_up_dn(int pin, int pud);
+	static int digital_read(int pin);
+	static void digital_write(int pin, int value);
+	static void digital_write_mask(uint64_t set, uint64_t clear);
+	static void pwm_write(int pin, int value);
+	static int analog_read(int pin);
+	static void analog_write(int pin, int value);
+	static bool read_edges(int pin, double from, double to, std::vector<GpioEdge>* edges);
+	static double next_edge(int pin, double from);
+
+	// Clock backends see on the calling thread. Virtual-time runs set it every tick;
+	// otherwise it is real time since the backend was installed:
+	static void set_virtual_time(double now);
+	static double now();
+	static bool uses_virtual_time();
+
+	// Owner of the pins claimed from the calling OS thread (0 when unowned):
+	static void set_owner(int owner);
+	static bool claim(int pin);
+	static bool can_write(int pin);
+	static void release_all(int owner);
+};
+
+}
+
+#endif
@@ -0,0 +1,491 @@
+#include "gpioinput.h"
+
+#include <lualib.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <thread>
+
+#include "scheduler.h"
+#include "realtime.h"
+
+using namespace LuauPi;
+
+// Steps for each quadrature transition, indexed by the previous state times four plus the next,
+// where a state is channel A's level shifted left by one, or'd with channel B's:
+static constexpr int8_t kSkipped = 2;
+static constexpr int8_t kQuadrature[16] = {
+	0, 1, -1, kSkipped,
+	-1, 0, kSkipped, 1,
+	1, kSkipped, 0, -1,
+	kSkipped, -1, 1, 0,
+};
+
+struct InputEntry
+{
+	std::shared_ptr<GpioInput> input;
+	LuauTaskScheduler* scheduler;
+	bool pumped;
+	double last;
+
+	// Levels last read from pins whose backend does not report edges:
+	std::vector<int> sampled;
+};
+
+static std::mutex inputs_mutex;
+static std::condition_variable inputs_cv;
+static std::vector<InputEntry> inputs;
+static std::thread poller;
+static bool stopping = false;
+
+static thread_local std::vector<GpioEdge> edges;
+
+void LevelFilter::start(int value, double now)
+{
+	level = value;
+	raw = value;
+	raw_since = now;
+}
+
+bool LevelFilter::feed(int value, double time, double* changed_at)
+{
+	bool changed = settle(time, changed_at);
+	if (value != raw)
+	{
+		raw = value;
+		raw_since = time;
+	}
+
+	// With a window of zero the new level is taken at once:
+	return settle(time, changed_at) || changed;
+}
+
+bool LevelFilter::settle(double now, double* changed_at)
+{
+	if (raw == level || now - raw_since < window)
+	{
+		return false;
+	}
+
+	level = raw;
+	*changed_at = raw_since + window;
+
+	return true;
+}
+
+double LevelFilter::settles_at() const
+{
+	return raw != level ? raw_since + window : HUGE_VAL;
+}
+
+const std::vector<int>& GpioInput::get_pins() const
+{
+	return pins;
+}
+
+void GpioInput::detach()
+{
+}
+
+GpioCounter::GpioCounter(int pin, bool rising, bool falling, double glitch) : rising(rising), falling(falling), count(0)
+{
+	pins.push_back(pin);
+	filter.window = glitch;
+}
+
+void GpioCounter::on_change(int level)
+{
+	if ((level && rising) || (!level && falling))
+	{
+		count.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+int64_t GpioCounter::get_count() const
+{
+	return count.load(std::memory_order_relaxed);
+}
+
+int64_t GpioCounter::reset()
+{
+	return count.exchange(0);
+}
+
+void GpioCounter::start(const std::vector<int>& levels, double now)
+{
+	filter.start(levels[0], now);
+}
+
+void GpioCounter::feed(const GpioEdge& edge)
+{
+	double changed_at;
+	if (filter.feed(edge.value, edge.time, &changed_at))
+	{
+		on_change(filter.level);
+	}
+}
+
+void GpioCounter::settle(double now)
+{
+	double changed_at;
+	if (filter.settle(now, &changed_at))
+	{
+		on_change(filter.level);
+	}
+}
+
+GpioEncoder::GpioEncoder(int pin_a, int pin_b, double glitch) : state(0), position(0), errors(0)
+{
+	pins.push_back(pin_a);
+	pins.push_back(pin_b);
+	a.window = glitch;
+	b.window = glitch;
+}
+
+void GpioEncoder::step()
+{
+	int next = (a.level << 1) | b.level;
+	int8_t delta = kQuadrature[state * 4 + next];
+	state = next;
+
+	if (delta == kSkipped)
+	{
+		errors.fetch_add(1, std::memory_order_relaxed);
+	}
+	else
+	{
+		position.fetch_add(delta, std::memory_order_relaxed);
+	}
+}
+
+int64_t GpioEncoder::get_position() const
+{
+	return position.load(std::memory_order_relaxed);
+}
+
+int64_t GpioEncoder::get_errors() const
+{
+	return errors.load(std::memory_order_relaxed);
+}
+
+int64_t GpioEncoder::reset()
+{
+	return position.exchange(0);
+}
+
+void GpioEncoder::start(const std::vector<int>& levels, double now)
+{
+	a.start(levels[0], now);
+	b.start(levels[1], now);
+	state = (a.level << 1) | b.level;
+}
+
+void GpioEncoder::feed(const GpioEdge& edge)
+{
+	// Changes pending on either channel from before the edge come first:
+	settle(edge.time);
+
+	LevelFilter& channel = edge.pin == pins[0] ? a : b;
+
+	double changed_at;
+	if (channel.feed(edge.value, edge.time, &changed_at))
+	{
+		step();
+	}
+}
+
+double GpioCounter::next_settle() const
+{
+	return filter.settles_at();
+}
+
+void GpioEncoder::settle(double now)
+{
+	// In the order the channels settle, so the state steps through the transitions as they happened:
+	LevelFilter& first = a.settles_at() <= b.settles_at() ? a : b;
+	LevelFilter& second = &first == &a ? b : a;
+
+	double changed_at;
+	if (first.settle(now, &changed_at))
+	{
+		step();
+	}
+	if (second.settle(now, &changed_at))
+	{
+		step();
+	}
+}
+
+double GpioEncoder::next_settle() const
+{
+	return std::min(a.settles_at(), b.settles_at());
+}
+
+GpioDebouncer::GpioDebouncer(int pin, double window, LuauTaskScheduler* scheduler) : value(0), changes(0), scheduler(scheduler)
+{
+	pins.push_back(pin);
+	filter.window = window;
+}
+
+void GpioDebouncer::on_change(int level)
+{
+	value.store(level, std::memory_order_relaxed);
+	changes.fetch_add(1, std::memory_order_relaxed);
+
+	std::lock_guard<std::mutex> lock(waiters_mutex);
+	for (int ref : waiters)
+	{
+		Message values;
+		values.push_boolean(level != 0);
+		scheduler->post_resume(ref, std::move(values), true);
+	}
+	waiters.clear();
+}
+
+int GpioDebouncer::get_value() const
+{
+	return value.load(std::memory_order_relaxed);
+}
+
+uint64_t GpioDebouncer::get_changes() const
+{
+	return changes.load(std::memory_order_relaxed);
+}
+
+int GpioDebouncer::wait(lua_State* L)
+{
+	if (!lua_isyieldable(L))
+	{
+		luaL_error(L, "attempt to wait for an input from a thread that cannot yield");
+	}
+
+	bool attached;
+	{
+		std::lock_guard<std::mutex> lock(waiters_mutex);
+		attached = scheduler != nullptr;
+		if (attached)
+		{
+			lua_pushthread(L);
+			waiters.push_back(lua_ref(L, -1));
+			lua_pop(L, 1);
+
+			// Keeps the script running while it waits on nothing but this input:
+			scheduler->begin_external_wait();
+		}
+	}
+
+	// Detached inputs never change again, so there is nothing to wait for:
+	if (!attached)
+	{
+		return 0;
+	}
+
+	// Resumed by on_change with the new level:
+	return lua_yield(L, 0);
+}
+
+void GpioDebouncer::start(const std::vector<int>& levels, double now)
+{
+	filter.start(levels[0], now);
+	value.store(levels[0], std::memory_order_relaxed);
+}
+
+void GpioDebouncer::feed(const GpioEdge& edge)
+{
+	double changed_at;
+	if (filter.feed(edge.value, edge.time, &changed_at))
+	{
+		on_change(filter.level);
+	}
+}
+
+void GpioDebouncer::settle(double now)
+{
+	double changed_at;
+	if (filter.settle(now, &changed_at))
+	{
+		on_change(filter.level);
+	}
+}
+
+double GpioDebouncer::next_settle() const
+{
+	return filter.settles_at();
+}
+
+void GpioDebouncer::detach()
+{
+	std::lock_guard<std::mutex> lock(waiters_mutex);
+	for (int ref : waiters)
+	{
+		scheduler->post_resume(ref, Message(), true);
+	}
+	waiters.clear();
+	scheduler = nullptr;
+}
+
+// Feeds the input every edge since it was last polled, up to the given time:
+static void poll_entry(InputEntry& entry, double to)
+{
+	const std::vector<int>& pins = entry.input->get_pins();
+
+	edges.clear();
+	for (size_t i = 0; i < pins.size(); i++)
+	{
+		if (Gpio::read_edges(pins[i], entry.last, to, &edges))
+		{
+			continue;
+		}
+
+		int level = Gpio::digital_read(pins[i]) ? 1 : 0;
+		if (level != entry.sampled[i])
+		{
+			entry.sampled[i] = level;
+			edges.push_back(GpioEdge{pins[i], level, to});
+		}
+	}
+
+	if (pins.size() > 1)
+	{
+		std::stable_sort(edges.begin(), edges.end(), [](const GpioEdge& a, const GpioEdge& b) {
+			return a.time < b.time;
+		});
+	}
+
+	for (const GpioEdge& edge : edges)
+	{
+		entry.input->feed(edge);
+	}
+	entry.input->settle(to);
+	entry.last = to;
+}
+
+static void poller_main()
+{
+	Realtime::configure_engine_thread();
+
+	std::unique_lock<std::mutex> lock(inputs_mutex);
+	while (!stopping)
+	{
+		bool polled = std::any_of(inputs.begin(), inputs.end(), [](const InputEntry& entry) {
+			return !entry.pumped;
+		});
+		if (!polled)
+		{
+			inputs_cv.wait(lock);
+			continue;
+		}
+
+		lock.unlock();
+		std::this_thread::sleep_for(std::chrono::duration<double>(GpioInputs::kPollInterval));
+		lock.lock();
+
+		double now = Gpio::now();
+		for (InputEntry& entry : inputs)
+		{
+			if (!entry.pumped)
+			{
+				poll_entry(entry, now);
+			}
+		}
+	}
+}
+
+// Stops the poller at exit. Inputs are all released by then, so it is idle:
+static struct PollerShutdown
+{
+	~PollerShutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lock(inputs_mutex);
+			stopping = true;
+		}
+		inputs_cv.notify_all();
+
+		if (poller.joinable())
+		{
+			poller.join();
+		}
+	}
+} poller_shutdown;
+
+void GpioInputs::add(std::shared_ptr<GpioInput> input, LuauTaskScheduler* scheduler)
+{
+	InputEntry entry;
+	for (int pin : input->get_pins())
+	{
+		entry.sampled.push_back(Gpio::digital_read(pin) ? 1 : 0);
+	}
+	entry.last = Gpio::now();
+	entry.pumped = Gpio::uses_virtual_time();
+	entry.scheduler = scheduler;
+
+	input->start(entry.sampled, entry.last);
+	entry.input = std::move(input);
+
+	std::lock_guard<std::mutex> lock(inputs_mutex);
+	if (!entry.pumped && !poller.joinable())
+	{
+		poller = std::thread(poller_main);
+	}
+	inputs.push_back(std::move(entry));
+	inputs_cv.notify_all();
+}
+
+void GpioInputs::remove(GpioInput* input)
+{
+	std::lock_guard<std::mutex> lock(inputs_mutex);
+	inputs.erase(std::remove_if(inputs.begin(), inputs.end(), [input](const InputEntry& entry) {
+		return entry.input.get() == input;
+	}), inputs.end());
+}
+
+void GpioInputs::pump(LuauTaskScheduler* scheduler)
+{
+	std::lock_guard<std::mutex> lock(inputs_mutex);
+	double now = Gpio::now();
+	for (InputEntry& entry : inputs)
+	{
+		if (entry.pumped && entry.scheduler == scheduler)
+		{
+			poll_entry(entry, now);
+		}
+	}
+}
+
+double GpioInputs::next_event(LuauTaskScheduler* scheduler)
+{
+	std::lock_guard<std::mutex> lock(inputs_mutex);
+	double now = Gpio::now();
+	double next = HUGE_VAL;
+	for (InputEntry& entry : inputs)
+	{
+		if (!entry.pumped || entry.scheduler != scheduler)
+		{
+			continue;
+		}
+
+		next = std::min(next, entry.input->next_settle());
+		for (int pin : entry.input->get_pins())
+		{
+			next = std::min(next, Gpio::next_edge(pin, entry.last));
+		}
+	}
+
+	// A change that rounding kept from settling at its own time settles just after it:
+	return next > now ? next : std::nextafter(now, HUGE_VAL);
+}
+
+void GpioInputs::release(LuauTaskScheduler* scheduler)
+{
+	std::lock_guard<std::mutex> lock(inputs_mutex);
+	inputs.erase(std::remove_if(inputs.begin(), inputs.end(), [scheduler](const InputEntry& entry) {
+		if (entry.scheduler != scheduler)
+		{
+			return false;
+		}
+		entry.input->detach();
+		return true;
+	}), inputs.end());
+}
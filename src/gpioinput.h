@@ -0,0 +1,167 @@
+#ifndef LUAUPI_GPIOINPUT_H
+#define LUAUPI_GPIOINPUT_H
+
+#include <lua.h>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "gpio.h"
+
+class LuauTaskScheduler;
+
+namespace LuauPi
+{
+
+// Only lets a level through once it has held for window seconds, so shorter pulses are dropped.
+// A window of zero passes every change straight through:
+struct LevelFilter
+{
+	double window = 0;
+	int level = 0;
+	int raw = 0;
+	double raw_since = 0;
+
+	void start(int value, double now);
+
+	// Both return true and set changed_at when level changes:
+	bool feed(int value, double time, double* changed_at);
+	bool settle(double now, double* changed_at);
+
+	// When a pending change will be let through, or HUGE_VAL if none is pending:
+	double settles_at() const;
+};
+
+// Input state kept up to date natively from pin edges, and read from Luau without polling:
+class GpioInput
+{
+protected:
+	std::vector<int> pins;
+
+public:
+	virtual ~GpioInput() = default;
+
+	const std::vector<int>& get_pins() const;
+
+	// Current levels of the pins, in the order of get_pins:
+	virtual void start(const std::vector<int>& levels, double now) = 0;
+	// Edges arrive in time order across all of the input's pins:
+	virtual void feed(const GpioEdge& edge) = 0;
+	// Applies changes that have held long enough by now:
+	virtual void settle(double now) = 0;
+	// When settle next has a change to apply, or HUGE_VAL if none is pending:
+	virtual double next_settle() const = 0;
+	// Stops waking tasks. Called when the input is closed or its state goes away:
+	virtual void detach();
+};
+
+// Counts rising edges, falling edges or both:
+class GpioCounter : public GpioInput
+{
+private:
+	bool rising;
+	bool falling;
+	LevelFilter filter;
+	std::atomic<int64_t> count;
+
+	void on_change(int level);
+
+public:
+	GpioCounter(int pin, bool rising, bool falling, double glitch);
+
+	int64_t get_count() const;
+	// Returns the count before the reset:
+	int64_t reset();
+
+	void start(const std::vector<int>& levels, double now) override;
+	void feed(const GpioEdge& edge) override;
+	void settle(double now) override;
+	double next_settle() const override;
+};
+
+// Position of a quadrature encoder, one step per edge on either channel. Transitions that skip
+// a state, where both channels appear to change at once, are counted as errors instead:
+class GpioEncoder : public GpioInput
+{
+private:
+	LevelFilter a;
+	LevelFilter b;
+	int state;
+	std::atomic<int64_t> position;
+	std::atomic<int64_t> errors;
+
+	void step();
+
+public:
+	GpioEncoder(int pin_a, int pin_b, double glitch);
+
+	int64_t get_position() const;
+	int64_t get_errors() const;
+	// Returns the position before the reset:
+	int64_t reset();
+
+	void start(const std::vector<int>& levels, double now) override;
+	void feed(const GpioEdge& edge) override;
+	void settle(double now) override;
+	double next_settle() const override;
+};
+
+// A pin level that only changes once it has been stable for the debounce time. Tasks parked in
+// wait are resumed through the scheduler on each change:
+class GpioDebouncer : public GpioInput
+{
+private:
+	LevelFilter filter;
+	std::atomic<int> value;
+	std::atomic<uint64_t> changes;
+
+	std::mutex waiters_mutex;
+	LuauTaskScheduler* scheduler;
+	// Refs to the parked threads, handed to the scheduler with each change:
+	std::vector<int> waiters;
+
+	void on_change(int level);
+
+public:
+	GpioDebouncer(int pin, double window, LuauTaskScheduler* scheduler);
+
+	int get_value() const;
+	uint64_t get_changes() const;
+
+	// Yields L until the next change, which it resumes with:
+	int wait(lua_State* L);
+
+	void start(const std::vector<int>& levels, double now) override;
+	void feed(const GpioEdge& edge) override;
+	void settle(double now) override;
+	double next_settle() const override;
+	// Parked tasks are resumed with nothing:
+	void detach() override;
+};
+
+// Process-wide set of inputs being kept up to date. A poller thread collects edges every kPollInterval,
+// or samples pins whose backend cannot report edges. Inputs created in virtual-time runs are pumped
+// from their actor's loop instead, so they follow its clock.
+class GpioInputs
+{
+public:
+	static constexpr double kPollInterval = 0.0001;
+
+	// Reads the current pin levels and starts keeping input up to date:
+	static void add(std::shared_ptr<GpioInput> input, LuauTaskScheduler* scheduler);
+	static void remove(GpioInput* input);
+
+	// Brings the virtual-time inputs of scheduler up to Gpio::now():
+	static void pump(LuauTaskScheduler* scheduler);
+	// When pump next has an edge or a settled change to apply, after Gpio::now(), or HUGE_VAL if none
+	// is known. Virtual-time runs jump to it, as they do to the scheduler's next deadline:
+	static double next_event(LuauTaskScheduler* scheduler);
+	// Detaches and removes every input of scheduler. Called before it closes:
+	static void release(LuauTaskScheduler* scheduler);
+};
+
+}
+
+#endif
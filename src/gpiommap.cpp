@@ -0,0 +1,342 @@
+#include "gpiommap.h"
+
+#include <wiringPi.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace LuauPi;
+
+// BCM2835 family register offsets, in bytes from the GPIO block:
+static constexpr size_t kGpfsel0 = 0x00;
+static constexpr size_t kGpset0 = 0x1C;
+static constexpr size_t kGpclr0 = 0x28;
+static constexpr size_t kGplev0 = 0x34;
+static constexpr size_t kGppud = 0x94;
+static constexpr size_t kGppudclk0 = 0x98;
+static constexpr size_t kGpioPupPdnCntrl0 = 0xE4;
+static constexpr size_t kBcmMapSize = 0x1000;
+static constexpr int kBcmGpioCount = 54;
+
+// RP1 blocks as /dev/gpiomem0 lays them out, followed by offsets within each:
+static constexpr size_t kRp1IoBank0 = 0x00000;
+static constexpr size_t kRp1SysRio0 = 0x10000;
+static constexpr size_t kRp1PadsBank0 = 0x20000;
+static constexpr size_t kRp1MapSize = 0x30000;
+static constexpr int kRp1GpioCount = 28;
+
+static constexpr size_t kRp1RioOut = 0x00;
+static constexpr size_t kRp1RioOe = 0x04;
+static constexpr size_t kRp1RioIn = 0x08;
+static constexpr size_t kRp1SetAlias = 0x2000;
+static constexpr size_t kRp1ClearAlias = 0x3000;
+
+static constexpr uint32_t kRp1FuncselMask = 0x1F;
+static constexpr uint32_t kRp1FuncselSysRio = 5;
+static constexpr uint32_t kRp1PadOutputDisable = 1 << 7;
+static constexpr uint32_t kRp1PadInputEnable = 1 << 6;
+static constexpr uint32_t kRp1PadPullUp = 1 << 3;
+static constexpr uint32_t kRp1PadPullDown = 1 << 2;
+
+// wiringPi and physical header numbering to GPIO numbers, for the 40 pin header:
+static const int wiringpi_to_gpio[] = {
+	17, 18, 27, 22, 23, 24, 25, 4, 2, 3, 8, 7, 10, 9, 11, 14, 15,
+	28, 29, 30, 31, 5, 6, 13, 19, 26, 12, 16, 20, 21, 0, 1,
+};
+static const int phys_to_gpio[] = {
+	-1, -1, -1, 2, -1, 3, -1, 4, 14, -1, 15, 17, 18, 27, -1, 22, 23, -1, 24, 10, -1,
+	9, 25, 11, 8, -1, 7, 0, 1, 5, -1, 6, 12, 13, -1, 19, 16, 26, 20, -1, 21,
+};
+
+MmapGpio::MmapGpio(const MmapGpioOptions& options)
+	: options(options), numbering(GpioSetup::Gpio), map(nullptr), map_size(0), registers(nullptr)
+{
+}
+
+MmapGpio::~MmapGpio()
+{
+	if (map)
+	{
+		munmap(map, map_size);
+	}
+}
+
+GpioChip MmapGpio::detect_chip()
+{
+	char compatible[256]{};
+	FILE* file = fopen("/proc/device-tree/compatible", "rb");
+	if (file)
+	{
+		// Entries are separated by NUL bytes:
+		size_t len = fread(compatible, 1, sizeof(compatible) - 1, file);
+		for (size_t i = 0; i < len; i++)
+		{
+			if (compatible[i] == '\0')
+			{
+				compatible[i] = ' ';
+			}
+		}
+		fclose(file);
+	}
+
+	if (strstr(compatible, "bcm2712"))
+	{
+		return GpioChip::Rp1;
+	}
+	else if (strstr(compatible, "bcm2711"))
+	{
+		return GpioChip::Bcm2711;
+	}
+
+	return GpioChip::Bcm2835;
+}
+
+bool MmapGpio::setup(GpioSetup mode)
+{
+	numbering = mode;
+
+	if (options.chip == GpioChip::Auto)
+	{
+		options.chip = detect_chip();
+	}
+
+	bool rp1 = options.chip == GpioChip::Rp1;
+	if (options.device.empty())
+	{
+		options.device = rp1 ? "/dev/gpiomem0" : "/dev/gpiomem";
+	}
+
+	int fd = open(options.device.c_str(), O_RDWR | O_SYNC | O_CLOEXEC);
+	if (fd < 0)
+	{
+		printf("Unable to open %s: %s\n", options.device.c_str(), strerror(errno));
+		return false;
+	}
+
+	map_size = rp1 ? kRp1MapSize : kBcmMapSize;
+	map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, static_cast<off_t>(options.offset));
+	close(fd);
+
+	if (map == MAP_FAILED)
+	{
+		printf("Unable to map %s: %s\n", options.device.c_str(), strerror(errno));
+		map = nullptr;
+		return false;
+	}
+
+	registers = static_cast<volatile uint32_t*>(map);
+
+	return true;
+}
+
+int MmapGpio::to_gpio(int pin) const
+{
+	int gpio = pin;
+	if (numbering == GpioSetup::WiringPi)
+	{
+		gpio = pin >= 0 && pin < static_cast<int>(sizeof(wiringpi_to_gpio) / sizeof(int)) ? wiringpi_to_gpio[pin] : -1;
+	}
+	else if (numbering == GpioSetup::Phys)
+	{
+		gpio = pin >= 0 && pin < static_cast<int>(sizeof(phys_to_gpio) / sizeof(int)) ? phys_to_gpio[pin] : -1;
+	}
+
+	int count = options.chip == GpioChip::Rp1 ? kRp1GpioCount : kBcmGpioCount;
+	if (registers == nullptr || gpio < 0 || gpio >= count)
+	{
+		return -1;
+	}
+
+	return gpio;
+}
+
+volatile uint32_t* MmapGpio::reg(size_t offset) const
+{
+	return registers + offset / sizeof(uint32_t);
+}
+
+void MmapGpio::pin_mode(int pin, int mode)
+{
+	int gpio = to_gpio(pin);
+	if (gpio < 0 || (mode != INPUT && mode != OUTPUT))
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(config_mutex);
+
+	if (options.chip == GpioChip::Rp1)
+	{
+		// Hand the pin to the registered I/O block, with its input buffer on and output driver enabled:
+		volatile uint32_t* ctrl = reg(kRp1IoBank0 + gpio * 8 + 4);
+		*ctrl = (*ctrl & ~kRp1FuncselMask) | kRp1FuncselSysRio;
+
+		volatile uint32_t* pad = reg(kRp1PadsBank0 + 4 + gpio * 4);
+		*pad = (*pad & ~kRp1PadOutputDisable) | kRp1PadInputEnable;
+
+		*reg(kRp1SysRio0 + (mode == OUTPUT ? kRp1SetAlias : kRp1ClearAlias) + kRp1RioOe) = 1u << gpio;
+		return;
+	}
+
+	volatile uint32_t* fsel = reg(kGpfsel0 + (gpio / 10) * 4);
+	int shift = (gpio % 10) * 3;
+	*fsel = (*fsel & ~(7u << shift)) | ((mode == OUTPUT ? 1u : 0u) << shift);
+}
+
+void MmapGpio::pull_up_dn(int pin, int pud)
+{
+	int gpio = to_gpio(pin);
+	if (gpio < 0)
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(config_mutex);
+
+	switch (options.chip)
+	{
+	case GpioChip::Rp1:
+	{
+		volatile uint32_t* pad = reg(kRp1PadsBank0 + 4 + gpio * 4);
+		uint32_t value = *pad & ~(kRp1PadPullUp | kRp1PadPullDown);
+		if (pud == PUD_UP)
+		{
+			value |= kRp1PadPullUp;
+		}
+		else if (pud == PUD_DOWN)
+		{
+			value |= kRp1PadPullDown;
+		}
+		*pad = value;
+		break;
+	}
+	case GpioChip::Bcm2711:
+	{
+		// Two bits per pin, where 1 is up and 2 is down:
+		uint32_t bits = pud == PUD_UP ? 1 : (pud == PUD_DOWN ? 2 : 0);
+		volatile uint32_t* cntrl = reg(kGpioPupPdnCntrl0 + (gpio / 16) * 4);
+		int shift = (gpio % 16) * 2;
+		*cntrl = (*cntrl & ~(3u << shift)) | (bits << shift);
+		break;
+	}
+	default:
+	{
+		// Latch the control signal into the pin with the clock register, holding each step for 150 cycles:
+		*reg(kGppud) = pud == PUD_UP ? 2 : (pud == PUD_DOWN ? 1 : 0);
+		usleep(5);
+		*reg(kGppudclk0 + (gpio / 32) * 4) = 1u << (gpio % 32);
+		usleep(5);
+		*reg(kGppud) = 0;
+		*reg(kGppudclk0 + (gpio / 32) * 4) = 0;
+		break;
+	}
+	}
+}
+
+int MmapGpio::digital_read(int pin)
+{
+	int gpio = to_gpio(pin);
+	if (gpio < 0)
+	{
+		return LOW;
+	}
+
+	if (options.chip == GpioChip::Rp1)
+	{
+		return (*reg(kRp1SysRio0 + kRp1RioIn) >> gpio) & 1;
+	}
+
+	return (*reg(kGplev0 + (gpio / 32) * 4) >> (gpio % 32)) & 1;
+}
+
+void MmapGpio::digital_write(int pin, int value)
+{
+	int gpio = to_gpio(pin);
+	if (gpio < 0)
+	{
+		return;
+	}
+
+	// Set and clear registers change only the pins written, so no lock is needed:
+	if (options.chip == GpioChip::Rp1)
+	{
+		*reg(kRp1SysRio0 + (value ? kRp1SetAlias : kRp1ClearAlias) + kRp1RioOut) = 1u << gpio;
+	}
+	else
+	{
+		*reg((value ? kGpset0 : kGpclr0) + (gpio / 32) * 4) = 1u << (gpio % 32);
+	}
+}
+
+void MmapGpio::digital_write_mask(uint64_t set, uint64_t clear)
+{
+	if (registers == nullptr)
+	{
+		return;
+	}
+
+	// Translate each pin bit to its GPIO bit, unless pins are already GPIO numbers:
+	uint64_t gpio_set = 0;
+	uint64_t gpio_clear = 0;
+	if (numbering == GpioSetup::Gpio || numbering == GpioSetup::Sys)
+	{
+		gpio_set = set;
+		gpio_clear = clear;
+	}
+	else
+	{
+		for (int pin = 0; pin < 64; pin++)
+		{
+			int gpio = to_gpio(pin);
+			if (gpio >= 0)
+			{
+				gpio_set |= ((set >> pin) & 1) << gpio;
+				gpio_clear |= ((clear >> pin) & 1) << gpio;
+			}
+		}
+	}
+
+	if (options.chip == GpioChip::Rp1)
+	{
+		uint32_t bank_mask = (1u << kRp1GpioCount) - 1;
+		if (gpio_set & bank_mask)
+		{
+			*reg(kRp1SysRio0 + kRp1SetAlias + kRp1RioOut) = static_cast<uint32_t>(gpio_set) & bank_mask;
+		}
+		if (gpio_clear & bank_mask)
+		{
+			*reg(kRp1SysRio0 + kRp1ClearAlias + kRp1RioOut) = static_cast<uint32_t>(gpio_clear) & bank_mask;
+		}
+		return;
+	}
+
+	for (int bank = 0; bank < 2; bank++)
+	{
+		uint32_t bank_set = static_cast<uint32_t>(gpio_set >> (bank * 32));
+		uint32_t bank_clear = static_cast<uint32_t>(gpio_clear >> (bank * 32));
+		if (bank_set)
+		{
+			*reg(kGpset0 + bank * 4) = bank_set;
+		}
+		if (bank_clear)
+		{
+			*reg(kGpclr0 + bank * 4) = bank_clear;
+		}
+	}
+}
+
+void MmapGpio::pwm_write(int pin, int value)
+{
+}
+
+int MmapGpio::analog_read(int pin)
+{
+	return 0;
+}
+
+void MmapGpio::analog_write(int pin, int value)
+{
+}
@@ -0,0 +1,77 @@
+#ifndef LUAUPI_GPIOMMAP_H
+#define LUAUPI_GPIOMMAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "gpio.h"
+
+namespace LuauPi
+{
+
+enum class GpioChip
+{
+	// Read from /proc/device-tree/compatible at setup:
+	Auto,
+	// Pi 1 to 3 and Zero, which set pulls through the GPPUD clock sequence:
+	Bcm2835,
+	// Pi 4, with direct pull registers:
+	Bcm2711,
+	// Pi 5, where the header pins live on the RP1 south bridge:
+	Rp1,
+};
+
+struct MmapGpioOptions
+{
+	GpioChip chip = GpioChip::Auto;
+
+	// /dev/gpiomem, /dev/gpiomem0 on Pi 5, or empty for the chip's default. Any file laid
+	// out like the register block works, which is how the backend is tested without hardware:
+	std::string device;
+
+	// Where the GPIO block starts in device. Needed when mapping the RP1 PCI BAR directly. Must be page aligned:
+	size_t offset = 0;
+};
+
+// Pins driven by reading and writing the GPIO registers directly, through a mapping made once at setup.
+// Pin numbers follow the setup mode and are translated to the chip's GPIO numbers. PWM and analog
+// functions are not available, and pin modes other than INPUT and OUTPUT are ignored.
+class MmapGpio : public GpioBackend
+{
+private:
+	MmapGpioOptions options;
+	GpioSetup numbering;
+
+	void* map;
+	size_t map_size;
+	volatile uint32_t* registers;
+
+	// Guards read-modify-write of function select and pull registers:
+	std::mutex config_mutex;
+
+	int to_gpio(int pin) const;
+	volatile uint32_t* reg(size_t offset) const;
+
+public:
+	explicit MmapGpio(const MmapGpioOptions& options);
+	~MmapGpio();
+
+	static GpioChip detect_chip();
+
+	bool setup(GpioSetup mode) override;
+
+	void pin_mode(int pin, int mode) override;
+	void pull_up_dn(int pin, int pud) override;
+	int digital_read(int pin) override;
+	void digital_write(int pin, int value) override;
+	void digital_write_mask(uint64_t set, uint64_t clear) override;
+	void pwm_write(int pin, int value) override;
+	int analog_read(int pin) override;
+	void analog_write(int pin, int value) override;
+};
+
+}
+
+#endif
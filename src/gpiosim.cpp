@@ -0,0 +1,235 @@
+#include "gpiosim.h"
+
+#include <wiringPi.h>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+using namespace LuauPi;
+
+static bool valid_pin(int pin)
+{
+	return pin >= 0 && pin < Gpio::kMaxPins;
+}
+
+SimGpio::SimGpio() : log(nullptr)
+{
+	for (int pin = 0; pin < Gpio::kMaxPins; pin++)
+	{
+		modes[pin] = INPUT;
+		pulls[pin] = PUD_OFF;
+		values[pin] = LOW;
+	}
+}
+
+SimGpio::~SimGpio()
+{
+	if (log)
+	{
+		fclose(log);
+	}
+}
+
+bool SimGpio::load_trace(const std::string& filepath, std::string* error)
+{
+	FILE* file = fopen(filepath.c_str(), "r");
+	if (!file)
+	{
+		*error = filepath + ": " + strerror(errno);
+		return false;
+	}
+
+	char line[256];
+	int line_number = 0;
+	while (fgets(line, sizeof(line), file))
+	{
+		line_number++;
+
+		const char* p = line;
+		while (*p == ' ' || *p == '\t')
+		{
+			p++;
+		}
+		if (*p == '\0' || *p == '\n' || *p == '#')
+		{
+			continue;
+		}
+
+		double time;
+		int pin;
+		int value;
+		if (sscanf(p, "%lf %d %d", &time, &pin, &value) != 3 || !valid_pin(pin))
+		{
+			*error = filepath + ":" + std::to_string(line_number) + ": expected TIME PIN VALUE";
+			fclose(file);
+			return false;
+		}
+
+		trace[pin].emplace_back(time, value);
+	}
+	fclose(file);
+
+	for (int pin = 0; pin < Gpio::kMaxPins; pin++)
+	{
+		std::stable_sort(trace[pin].begin(), trace[pin].end(), [](const std::pair<double, int>& a, const std::pair<double, int>& b) {
+			return a.first < b.first;
+		});
+	}
+
+	return true;
+}
+
+void SimGpio::add_trace_event(double time, int pin, int value)
+{
+	if (valid_pin(pin))
+	{
+		trace[pin].emplace_back(time, value);
+	}
+}
+
+bool SimGpio::open_log(const std::string& filepath, std::string* error)
+{
+	log = fopen(filepath.c_str(), "w");
+	if (!log)
+	{
+		*error = filepath + ": " + strerror(errno);
+		return false;
+	}
+
+	return true;
+}
+
+void SimGpio::log_event(int pin, const char* kind, int value)
+{
+	if (log)
+	{
+		fprintf(log, "%.6f %d %s %d\n", Gpio::now(), pin, kind, value);
+	}
+}
+
+// Traced pins follow their trace; others read back what was last written, or their pull:
+int SimGpio::read_pin(int pin)
+{
+	const std::vector<std::pair<double, int>>& events = trace[pin];
+	if (!events.empty())
+	{
+		double now = Gpio::now();
+		auto it = std::upper_bound(events.begin(), events.end(), now, [](double time, const std::pair<double, int>& event) {
+			return time < event.first;
+		});
+		if (it != events.begin())
+		{
+			return (it - 1)->second;
+		}
+	}
+
+	if (modes[pin] == INPUT && pulls[pin] != PUD_OFF)
+	{
+		return pulls[pin] == PUD_UP ? HIGH : LOW;
+	}
+
+	return values[pin];
+}
+
+bool SimGpio::setup(GpioSetup mode)
+{
+	return true;
+}
+
+void SimGpio::pin_mode(int pin, int mode)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (valid_pin(pin))
+	{
+		modes[pin] = mode;
+		log_event(pin, "mode", mode);
+	}
+}
+
+void SimGpio::pull_up_dn(int pin, int pud)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (valid_pin(pin))
+	{
+		pulls[pin] = pud;
+		log_event(pin, "pull", pud);
+	}
+}
+
+int SimGpio::digital_read(int pin)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return valid_pin(pin) && read_pin(pin) != 0 ? HIGH : LOW;
+}
+
+void SimGpio::digital_write(int pin, int value)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (valid_pin(pin))
+	{
+		values[pin] = value != 0 ? HIGH : LOW;
+		log_event(pin, "write", values[pin]);
+	}
+}
+
+void SimGpio::pwm_write(int pin, int value)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (valid_pin(pin))
+	{
+		values[pin] = value;
+		log_event(pin, "pwm", value);
+	}
+}
+
+int SimGpio::analog_read(int pin)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	return valid_pin(pin) ? read_pin(pin) : 0;
+}
+
+void SimGpio::analog_write(int pin, int value)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+	if (valid_pin(pin))
+	{
+		values[pin] = value;
+		log_event(pin, "analog", value);
+	}
+}
+
+bool SimGpio::read_edges(int pin, double from, double to, std::vector<GpioEdge>* edges)
+{
+	if (!valid_pin(pin) || trace[pin].empty())
+	{
+		return false;
+	}
+
+	// Traces are not changed once the run starts, so no lock is needed:
+	const std::vector<std::pair<double, int>>& events = trace[pin];
+	auto it = std::upper_bound(events.begin(), events.end(), from, [](double time, const std::pair<double, int>& event) {
+		return time < event.first;
+	});
+	for (; it != events.end() && it->first <= to; ++it)
+	{
+		edges->push_back(GpioEdge{pin, it->second != 0 ? HIGH : LOW, it->first});
+	}
+
+	return true;
+}
+
+double SimGpio::next_edge(int pin, double from)
+{
+	if (!valid_pin(pin))
+	{
+		return HUGE_VAL;
+	}
+
+	const std::vector<std::pair<double, int>>& events = trace[pin];
+	auto it = std::upper_bound(events.begin(), events.end(), from, [](double time, const std::pair<double, int>& event) {
+		return time < event.first;
+	});
+
+	return it != events.end() ? it->first : HUGE_VAL;
+}
@@ -0,0 +1,59 @@
+#ifndef LUAUPI_GPIOSIM_H
+#define LUAUPI_GPIOSIM_H
+
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gpio.h"
+
+namespace LuauPi
+{
+
+// Simulated pins for running scripts without hardware. Inputs can be driven by a
+// recorded trace, and every change a script makes can be logged with its timestamp.
+class SimGpio : public GpioBackend
+{
+private:
+	std::mutex mutex;
+	int modes[Gpio::kMaxPins];
+	int pulls[Gpio::kMaxPins];
+	int values[Gpio::kMaxPins];
+
+	// Recorded input changes per pin, as (time, value) in time order:
+	std::vector<std::pair<double, int>> trace[Gpio::kMaxPins];
+
+	FILE* log;
+
+	int read_pin(int pin);
+	void log_event(int pin, const char* kind, int value);
+
+public:
+	SimGpio();
+	~SimGpio();
+
+	// Trace lines are "TIME PIN VALUE", with TIME in seconds. Blank lines and lines starting with # are skipped:
+	bool load_trace(const std::string& filepath, std::string* error);
+	bool open_log(const std::string& filepath, std::string* error);
+	// Appends to pin's trace. Times must not go backwards. Only valid before the backend is in use:
+	void add_trace_event(double time, int pin, int value);
+
+	bool setup(GpioSetup mode) override;
+
+	void pin_mode(int pin, int mode) override;
+	void pull_up_dn(int pin, int pud) override;
+	int digital_read(int pin) override;
+	void digital_write(int pin, int value) override;
+	void pwm_write(int pin, int value) override;
+	int analog_read(int pin) override;
+	void analog_write(int pin, int value) override;
+	// Edges come from the trace, so traced pins never miss a pulse however short:
+	bool read_edges(int pin, double from, double to, std::vector<GpioEdge>* edges) override;
+	double next_edge(int pin, double from) override;
+};
+
+}
+
+#endif
@@ -0,0 +1,62 @@
+#include "gpiowiringpi.h"
+
+#include <wiringPi.h>
+
+using namespace LuauPi;
+
+bool WiringPiGpio::setup(GpioSetup mode)
+{
+	int result = -1;
+	switch (mode)
+	{
+	case GpioSetup::WiringPi:
+		result = wiringPiSetup();
+		break;
+	case GpioSetup::Sys:
+		result = wiringPiSetupSys();
+		break;
+	case GpioSetup::Gpio:
+		result = wiringPiSetupGpio();
+		break;
+	case GpioSetup::Phys:
+		result = wiringPiSetupPhys();
+		break;
+	}
+
+	return result != -1;
+}
+
+void WiringPiGpio::pin_mode(int pin, int mode)
+{
+	pinMode(pin, mode);
+}
+
+void WiringPiGpio::pull_up_dn(int pin, int pud)
+{
+	pullUpDnControl(pin, pud);
+}
+
+int WiringPiGpio::digital_read(int pin)
+{
+	return digitalRead(pin);
+}
+
+void WiringPiGpio::digital_write(int pin, int value)
+{
+	digitalWrite(pin, value);
+}
+
+void WiringPiGpio::pwm_write(int pin, int value)
+{
+	pwmWrite(pin, value);
+}
+
+int WiringPiGpio::analog_read(int pin)
+{
+	return analogRead(pin);
+}
+
+void WiringPiGpio::analog_write(int pin, int value)
+{
+	analogWrite(pin, value);
+}
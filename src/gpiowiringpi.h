@@ -0,0 +1,26 @@
+#ifndef LUAUPI_GPIOWIRINGPI_H
+#define LUAUPI_GPIOWIRINGPI_H
+
+#include "gpio.h"
+
+namespace LuauPi
+{
+
+// Real hardware through wiringPi:
+class WiringPiGpio : public GpioBackend
+{
+public:
+	bool setup(GpioSetup mode) override;
+
+	void pin_mode(int pin, int mode) override;
+	void pull_up_dn(int pin, int pud) override;
+	int digital_read(int pin) override;
+	void digital_write(int pin, int value) override;
+	void pwm_write(int pin, int value) override;
+	int analog_read(int pin) override;
+	void analog_write(int pin, int value) override;
+};
+
+}
+
+#endif
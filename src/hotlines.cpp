@@ -0,0 +1,473 @@
+#include "hotlines.h"
+
+#include <lualib.h>
+#include <luacode.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "fs.h"
+
+using namespace LuauPi;
+
+// Statement and expression counters:
+static constexpr int kCoverageLevel = 2;
+
+// Counters live in the instrumented instructions and stop counting at this value:
+static constexpr int kMaxHits = (1 << 23) - 1;
+
+// Entries listed in each hot spot table:
+static constexpr size_t kTopEntries = 40;
+
+// Iterations of the loop used to measure what one counter costs:
+static constexpr int kCalibrationIterations = 2000000;
+
+struct FunctionCounts
+{
+	std::string name;
+	int line;
+	uint64_t hits;
+};
+
+struct ChunkCounts
+{
+	// State the chunk was loaded into, or nullptr once that state has been released:
+	lua_State* L;
+	int ref;
+	std::string chunkname;
+	std::string source;
+
+	// Hits per line, or -1 for lines without code:
+	std::vector<int64_t> lines;
+	std::vector<FunctionCounts> functions;
+	bool saturated;
+};
+
+static std::mutex counts_mutex;
+static std::vector<ChunkCounts> chunks;
+
+static bool enabled = false;
+static std::string report_path;
+static double enabled_at = 0;
+static double seconds_per_hit = 0;
+
+static int harvest_count = 0;
+static double harvest_seconds = 0;
+
+// Rewrites the report every kHarvestInterval while scripts run, so actors only ever harvest:
+static std::mutex writer_mutex;
+static std::condition_variable writer_cv;
+static std::thread writer;
+static bool stopping_writer = false;
+
+// Serializes writes of the report file between the writer and the final write at exit:
+static std::mutex report_mutex;
+
+static void append_format(std::string* out, const char* format, ...)
+{
+	char buffer[512];
+
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+
+	if (len > 0)
+	{
+		out->append(buffer, std::min(static_cast<size_t>(len), sizeof(buffer) - 1));
+	}
+}
+
+static void collect_hits(void* context, const char* function, int linedefined, int depth, const int* hits, size_t size)
+{
+	ChunkCounts* chunk = static_cast<ChunkCounts*>(context);
+
+	if (chunk->lines.size() < size)
+	{
+		chunk->lines.resize(size, -1);
+	}
+
+	uint64_t total = 0;
+	for (size_t i = 0; i < size; i++)
+	{
+		if (hits[i] < 0)
+		{
+			continue;
+		}
+
+		if (hits[i] >= kMaxHits)
+		{
+			chunk->saturated = true;
+		}
+
+		chunk->lines[i] = std::max<int64_t>(chunk->lines[i], 0) + hits[i];
+		total += hits[i];
+	}
+
+	FunctionCounts counts;
+	counts.name = depth == 0 ? "<main>" : (function ? function : "<anonymous>");
+	counts.line = linedefined;
+	counts.hits = total;
+	chunk->functions.push_back(std::move(counts));
+}
+
+// Runs a tight loop compiled with the given coverage level, returning its run time and counted hits:
+static double run_calibration(int coverage_level, uint64_t* hits)
+{
+	std::string source = "local x = 0\nfor i = 1, " + std::to_string(kCalibrationIterations) + " do\n\tx += i\nend\nreturn x\n";
+
+	lua_CompileOptions compile_options{};
+	compile_options.optimizationLevel = 1;
+	compile_options.debugLevel = 1;
+	compile_options.coverageLevel = coverage_level;
+
+	size_t bytecode_size;
+	std::unique_ptr<char, void(*)(void*)> bytecode(luau_compile(source.data(), source.size(), &compile_options, &bytecode_size), free);
+
+	lua_State* L = luaL_newstate();
+	double elapsed = 0;
+	if (luau_load(L, "=calibration", bytecode.get(), bytecode_size, 0) == LUA_OK)
+	{
+		lua_pushvalue(L, -1);
+
+		double start = lua_clock();
+		lua_pcall(L, 0, 0, 0);
+		elapsed = lua_clock() - start;
+
+		ChunkCounts counts{};
+		lua_getcoverage(L, -1, &counts, collect_hits);
+		for (const FunctionCounts& function : counts.functions)
+		{
+			*hits += function.hits;
+		}
+	}
+	lua_close(L);
+
+	return elapsed;
+}
+
+void HotLines::enable(const std::string& path)
+{
+	enabled = true;
+	report_path = path;
+
+	// Best of a few runs with and without counters, so the report can estimate what they cost:
+	double plain = HUGE_VAL;
+	double counted = HUGE_VAL;
+	uint64_t hits = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		uint64_t unused = 0;
+		plain = std::min(plain, run_calibration(0, &unused));
+
+		hits = 0;
+		counted = std::min(counted, run_calibration(kCoverageLevel, &hits));
+	}
+	seconds_per_hit = hits > 0 ? std::max(0.0, counted - plain) / static_cast<double>(hits) : 0;
+
+	enabled_at = lua_clock();
+
+	writer = std::thread([]() {
+		std::unique_lock<std::mutex> lock(writer_mutex);
+		while (!writer_cv.wait_for(lock, std::chrono::duration<double>(kHarvestInterval), []() {
+			return stopping_writer;
+		}))
+		{
+			// Write errors are reported once, by the final write at exit:
+			std::string error;
+			lock.unlock();
+			write_report(&error);
+			lock.lock();
+		}
+	});
+}
+
+// Stops the writer at exit:
+static struct WriterShutdown
+{
+	~WriterShutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lock(writer_mutex);
+			stopping_writer = true;
+		}
+		writer_cv.notify_all();
+
+		if (writer.joinable())
+		{
+			writer.join();
+		}
+	}
+} writer_shutdown;
+
+bool HotLines::is_enabled()
+{
+	return enabled;
+}
+
+int HotLines::coverage_level()
+{
+	return enabled ? kCoverageLevel : 0;
+}
+
+void HotLines::track(lua_State* L, const std::string& chunkname, const std::string& source)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	ChunkCounts chunk{};
+	chunk.L = L;
+	chunk.ref = lua_ref(L, -1);
+	chunk.chunkname = chunkname;
+	chunk.source = source;
+
+	std::lock_guard<std::mutex> lock(counts_mutex);
+	chunks.push_back(std::move(chunk));
+}
+
+void HotLines::harvest(lua_State* L)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	double start = lua_clock();
+
+	std::lock_guard<std::mutex> lock(counts_mutex);
+	for (ChunkCounts& chunk : chunks)
+	{
+		if (chunk.L != L)
+		{
+			continue;
+		}
+
+		// Counters are cumulative, so each harvest replaces the last:
+		chunk.lines.clear();
+		chunk.functions.clear();
+		chunk.saturated = false;
+
+		lua_getref(L, chunk.ref);
+		lua_getcoverage(L, -1, &chunk, collect_hits);
+		lua_pop(L, 1);
+	}
+
+	harvest_count++;
+	harvest_seconds += lua_clock() - start;
+}
+
+void HotLines::release(lua_State* L)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	harvest(L);
+
+	std::lock_guard<std::mutex> lock(counts_mutex);
+	for (ChunkCounts& chunk : chunks)
+	{
+		if (chunk.L == L)
+		{
+			lua_unref(L, chunk.ref);
+			chunk.L = nullptr;
+		}
+	}
+}
+
+static std::string format_hits(int64_t hits, bool saturated)
+{
+	std::string out = std::to_string(hits);
+	if (saturated && hits >= kMaxHits)
+	{
+		out += "+";
+	}
+	return out;
+}
+
+// The hot spot report followed by each chunk's annotated source:
+static std::string format_report()
+{
+	double start = lua_clock();
+
+	std::lock_guard<std::mutex> lock(counts_mutex);
+
+	// The same chunk may be loaded by several actors; their counts are added together:
+	std::map<std::string, ChunkCounts> merged;
+	std::map<std::pair<std::string, int>, FunctionCounts> functions;
+	uint64_t total_hits = 0;
+	bool saturated = false;
+	for (const ChunkCounts& chunk : chunks)
+	{
+		ChunkCounts& into = merged[chunk.chunkname];
+		if (into.chunkname.empty())
+		{
+			into.chunkname = chunk.chunkname;
+			into.source = chunk.source;
+		}
+		into.saturated = into.saturated || chunk.saturated;
+		saturated = saturated || chunk.saturated;
+
+		if (into.lines.size() < chunk.lines.size())
+		{
+			into.lines.resize(chunk.lines.size(), -1);
+		}
+		for (size_t i = 0; i < chunk.lines.size(); i++)
+		{
+			if (chunk.lines[i] >= 0)
+			{
+				into.lines[i] = std::max<int64_t>(into.lines[i], 0) + chunk.lines[i];
+				total_hits += chunk.lines[i];
+			}
+		}
+
+		for (const FunctionCounts& function : chunk.functions)
+		{
+			FunctionCounts& counts = functions[std::make_pair(chunk.chunkname, function.line)];
+			counts.name = function.name;
+			counts.line = function.line;
+			counts.hits += function.hits;
+		}
+	}
+
+	std::string report;
+	append_format(&report, "Hot lines report (coverage level %d)\n\n", kCoverageLevel);
+
+	double elapsed = lua_clock() - enabled_at;
+	double instrumentation = static_cast<double>(total_hits) * seconds_per_hit;
+	append_format(&report, "Overhead:\n");
+	append_format(&report, "   harvests:          %d (with reports) taking %.3f ms\n", harvest_count, harvest_seconds * 1000.0);
+	append_format(&report, "   counters:          ~%.3f ms estimated (%llu hits at %.2f ns each)\n",
+		instrumentation * 1000.0, static_cast<unsigned long long>(total_hits), seconds_per_hit * 1e9);
+	append_format(&report, "   elapsed:           %.3f s (%.2f%% spent counting)\n",
+		elapsed, elapsed > 0 ? (instrumentation + harvest_seconds) / elapsed * 100.0 : 0.0);
+	if (saturated)
+	{
+		append_format(&report, "   Counts marked + stopped counting at %d\n", kMaxHits);
+	}
+
+	std::vector<std::pair<std::string, FunctionCounts>> hot_functions;
+	for (auto it = functions.begin(); it != functions.end(); ++it)
+	{
+		if (it->second.hits > 0)
+		{
+			hot_functions.emplace_back(it->first.first + ":" + std::to_string(it->first.second), it->second);
+		}
+	}
+	std::stable_sort(hot_functions.begin(), hot_functions.end(), [](const auto& a, const auto& b) {
+		return a.second.hits > b.second.hits;
+	});
+	if (hot_functions.size() > kTopEntries)
+	{
+		hot_functions.resize(kTopEntries);
+	}
+
+	append_format(&report, "\nHot functions (line hits inside each function):\n");
+	append_format(&report, "   %12s  %-32s %s\n", "HITS", "LOCATION", "FUNCTION");
+	for (const auto& entry : hot_functions)
+	{
+		append_format(&report, "   %12llu  %-32s %s\n", static_cast<unsigned long long>(entry.second.hits), entry.first.c_str(), entry.second.name.c_str());
+	}
+
+	struct LineEntry
+	{
+		const ChunkCounts* chunk;
+		size_t line;
+		int64_t hits;
+	};
+	std::vector<LineEntry> hot_lines;
+	for (auto it = merged.begin(); it != merged.end(); ++it)
+	{
+		for (size_t i = 0; i < it->second.lines.size(); i++)
+		{
+			if (it->second.lines[i] > 0)
+			{
+				hot_lines.push_back(LineEntry{&it->second, i, it->second.lines[i]});
+			}
+		}
+	}
+	std::stable_sort(hot_lines.begin(), hot_lines.end(), [](const LineEntry& a, const LineEntry& b) {
+		return a.hits > b.hits;
+	});
+	if (hot_lines.size() > kTopEntries)
+	{
+		hot_lines.resize(kTopEntries);
+	}
+
+	// Line n of each chunk's source, split once for the hot line table and the annotated dump:
+	std::map<const ChunkCounts*, std::vector<std::string>> source_lines;
+	for (auto it = merged.begin(); it != merged.end(); ++it)
+	{
+		std::vector<std::string>& lines = source_lines[&it->second];
+		lines.push_back("");
+		size_t pos = 0;
+		const std::string& source = it->second.source;
+		while (pos <= source.size())
+		{
+			size_t end = source.find('\n', pos);
+			if (end == std::string::npos)
+			{
+				end = source.size();
+			}
+			lines.push_back(source.substr(pos, end - pos));
+			pos = end + 1;
+		}
+	}
+
+	append_format(&report, "\nHot lines:\n");
+	append_format(&report, "   %12s  %-32s %s\n", "HITS", "LOCATION", "SOURCE");
+	for (const LineEntry& entry : hot_lines)
+	{
+		const std::vector<std::string>& lines = source_lines[entry.chunk];
+		std::string text = entry.line < lines.size() ? lines[entry.line] : "";
+		text.erase(0, text.find_first_not_of(" \t"));
+
+		std::string location = entry.chunk->chunkname + ":" + std::to_string(entry.line);
+		append_format(&report, "   %12s  %-32s %s\n", format_hits(entry.hits, entry.chunk->saturated).c_str(), location.c_str(), text.c_str());
+	}
+
+	for (auto it = merged.begin(); it != merged.end(); ++it)
+	{
+		const ChunkCounts& chunk = it->second;
+		const std::vector<std::string>& lines = source_lines[&chunk];
+
+		append_format(&report, "\n==== %s ====\n", chunk.chunkname.c_str());
+		for (size_t i = 1; i < lines.size(); i++)
+		{
+			int64_t hits = i < chunk.lines.size() ? chunk.lines[i] : -1;
+			std::string count = hits >= 0 ? format_hits(hits, chunk.saturated) : "";
+
+			// Source lines can be longer than append_format's buffer:
+			append_format(&report, "%12s %5zu | ", count.c_str(), i);
+			report += lines[i];
+			report += "\n";
+		}
+	}
+
+	harvest_seconds += lua_clock() - start;
+
+	return report;
+}
+
+bool HotLines::write_report(std::string* error)
+{
+	// Held across formatting too, so an older report never overwrites a newer one. Harvests only
+	// wait for the formatting, not the write:
+	std::lock_guard<std::mutex> lock(report_mutex);
+
+	std::string report = format_report();
+	return FS::write_file(report_path, report, false, error);
+}
@@ -0,0 +1,39 @@
+#ifndef LUAUPI_HOTLINES_H
+#define LUAUPI_HOTLINES_H
+
+#include <lua.h>
+#include <string>
+
+namespace LuauPi
+{
+
+// Per-line and per-function execution counts for --hotlines runs. Chunks are compiled with
+// coverage instrumentation, and the counts of every actor's chunks are merged by chunk name.
+class HotLines
+{
+public:
+	// How often a running actor copies its counts, and the report is rewritten from them:
+	static constexpr double kHarvestInterval = 1.0;
+
+	// Instruments every chunk compiled afterwards, and starts a thread rewriting the report every
+	// kHarvestInterval. Only valid before any actor starts:
+	static void enable(const std::string& report_path);
+	static bool is_enabled();
+
+	// coverageLevel to compile chunks with:
+	static int coverage_level();
+
+	// Pins the function on top of L's stack, compiled from source, so its counts can be harvested:
+	static void track(lua_State* L, const std::string& chunkname, const std::string& source);
+	// Copies the current counts of every chunk tracked in L. Must run on L's thread:
+	static void harvest(lua_State* L);
+	// Harvests L one last time and unpins its chunks. Called before the state is closed:
+	static void release(lua_State* L);
+
+	// Writes the hot spot report followed by each chunk's annotated source. Safe to call from any thread:
+	static bool write_report(std::string* error);
+};
+
+}
+
+#endif
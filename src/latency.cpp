@@ -0,0 +1,135 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+
+using namespace LuauPi;
+
+static std::mutex report_mutex;
+static std::unique_ptr<LatencyHistogram> report;
+
+LatencyHistogram::LatencyHistogram() : buckets(kBuckets, 0), overflows(0), samples(0), total(0), min(HUGE_VAL), max(0)
+{
+}
+
+void LatencyHistogram::record(double seconds)
+{
+	double us = std::max(0.0, seconds * 1e6);
+	size_t bucket = static_cast<size_t>(us);
+	if (bucket < buckets.size())
+	{
+		buckets[bucket]++;
+	}
+	else
+	{
+		overflows++;
+	}
+
+	samples++;
+	total += us;
+	min = std::min(min, us);
+	max = std::max(max, us);
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+	for (size_t i = 0; i < buckets.size(); i++)
+	{
+		buckets[i] += other.buckets[i];
+	}
+	overflows += other.overflows;
+	samples += other.samples;
+	total += other.total;
+	min = std::min(min, other.min);
+	max = std::max(max, other.max);
+}
+
+// Upper edge of the bucket holding the given fraction of samples, in µs. HUGE_VAL if it is an overflow:
+double LatencyHistogram::percentile(double fraction) const
+{
+	uint64_t target = static_cast<uint64_t>(std::ceil(fraction * samples));
+	uint64_t seen = 0;
+	for (size_t i = 0; i < buckets.size(); i++)
+	{
+		seen += buckets[i];
+		if (seen >= target)
+		{
+			return static_cast<double>(i + 1);
+		}
+	}
+	return HUGE_VAL;
+}
+
+void LatencyHistogram::print() const
+{
+	printf("Latency report (scheduler wake-ups past their deadline):\n");
+	if (samples == 0)
+	{
+		printf("   no timed wake-ups\n");
+		return;
+	}
+
+	printf("   samples:   %llu\n", static_cast<unsigned long long>(samples));
+	printf("   min:       %.1f us\n", min);
+	printf("   avg:       %.1f us\n", total / samples);
+	printf("   max:       %.1f us\n", max);
+
+	const double fractions[] = {0.5, 0.9, 0.99, 0.999};
+	const char* names[] = {"p50", "p90", "p99", "p99.9"};
+	for (int i = 0; i < 4; i++)
+	{
+		double value = percentile(fractions[i]);
+		if (value == HUGE_VAL)
+		{
+			printf("   %-9s  > %d us\n", names[i], kBuckets);
+		}
+		else
+		{
+			printf("   %-9s  <= %.0f us\n", names[i], value);
+		}
+	}
+	printf("   overflows: %llu (>= %d us)\n", static_cast<unsigned long long>(overflows), kBuckets);
+
+	// Power of two ranges keep the table short:
+	printf("   %14s  %12s\n", "RANGE (us)", "COUNT");
+	for (size_t low = 0, high = 1; low < buckets.size(); low = high, high *= 2)
+	{
+		uint64_t count = 0;
+		for (size_t i = low; i < std::min(high, buckets.size()); i++)
+		{
+			count += buckets[i];
+		}
+		if (count > 0)
+		{
+			printf("   %6zu - %-6zu  %12llu\n", low, std::min(high, buckets.size()), static_cast<unsigned long long>(count));
+		}
+	}
+	if (overflows > 0)
+	{
+		printf("   %6d+          %12llu\n", kBuckets, static_cast<unsigned long long>(overflows));
+	}
+}
+
+void LatencyHistogram::add_to_report(const LatencyHistogram& histogram)
+{
+	std::lock_guard<std::mutex> lock(report_mutex);
+	if (!report)
+	{
+		report.reset(new LatencyHistogram());
+	}
+	report->merge(histogram);
+}
+
+void LatencyHistogram::print_report()
+{
+	std::lock_guard<std::mutex> lock(report_mutex);
+	if (!report)
+	{
+		LatencyHistogram().print();
+		return;
+	}
+	report->print();
+}
@@ -0,0 +1,40 @@
+#ifndef LUAUPI_LATENCY_H
+#define LUAUPI_LATENCY_H
+
+#include <cstdint>
+#include <vector>
+
+namespace LuauPi
+{
+
+// How late scheduler wake-ups are past their deadline, in 1 µs buckets, in the manner of cyclictest:
+class LatencyHistogram
+{
+private:
+	std::vector<uint64_t> buckets;
+	uint64_t overflows;
+	uint64_t samples;
+	double total;
+	double min;
+	double max;
+
+	double percentile(double fraction) const;
+
+public:
+	// Buckets of 1 µs, covering up to 10 ms. Later wake-ups count as overflows:
+	static constexpr int kBuckets = 10000;
+
+	LatencyHistogram();
+
+	void record(double seconds);
+	void merge(const LatencyHistogram& other);
+	void print() const;
+
+	// Histograms from every actor, merged as each one stops, for the report at exit:
+	static void add_to_report(const LatencyHistogram& histogram);
+	static void print_report();
+};
+
+}
+
+#endif
@@ -4,17 +4,25 @@
 #include <lua.h>
 #include <lualib.h>
 #include <luacode.h>
+#include <cerrno>
 #include <cstdio>
 #include <cstdlib>
 #include <csignal>
-#include <thread>
-#include <chrono>
+#include <sched.h>
+#include <memory>
+#include <vector>
 
-#include "state.h"
-#include "script.h"
-#include "scheduler.h"
-#include "pilib.h"
+#include "actor.h"
+#include "gpiosim.h"
 #include "fs.h"
+#include "hotlines.h"
+#include "allocprofiler.h"
+#include "bundle.h"
+#include "script.h"
+#include "realtime.h"
+#include "latency.h"
+#include "daemon.h"
+#include "workerpool.h"
 
 #define VERSION "luau-pi v0.1.0"
 
@@ -22,9 +30,43 @@ using namespace LuauPi;
 
 volatile bool stop_script = false;
 
+// Wakes the main loop so it notices stop_script:
+static Waker* interrupt_waker = nullptr;
+
+struct RunOptions
+{
+	const char* filepath = nullptr;
+	ActorOptions actor;
+	bool gpio_sim = false;
+	const char* gpio_trace = nullptr;
+	const char* gpio_log = nullptr;
+	const char* hotlines = nullptr;
+	const char* alloc_profile = nullptr;
+	size_t alloc_rate = AllocProfiler::kDefaultSampleRate;
+	bool native = false;
+	bool realtime = false;
+	RealtimeOptions realtime_options;
+	const char* socket = nullptr;
+};
+
 static void handle_sigint(int s)
 {
 	stop_script = true;
+
+	if (interrupt_waker)
+	{
+		interrupt_waker->wake();
+	}
+}
+
+static void handle_sigusr1(int s)
+{
+	AllocProfiler::request_report();
+
+	if (interrupt_waker)
+	{
+		interrupt_waker->wake();
+	}
 }
 
 static void print_version()
@@ -38,50 +80,527 @@ static void print_help()
 	printf("\n");
 	printf("Usage: luaupi [COMMAND]\n\n");
 	printf("Commands:\n");
-	printf("   run [FILE]\n");
+	printf("   run [FILE] [OPTIONS]\n");
+	printf("   daemon [FILE] [OPTIONS] [--socket=PATH]\n");
+	printf("   ctl load [FILE] | reload | stop [--socket=PATH]\n");
+	printf("   build [FILE] -o [OUTPUT]\n");
 	printf("   version\n");
 	printf("   help\n");
 	printf("\n");
+	printf("Run options:\n");
+	printf("   --budget=MS              Preempt tasks that run longer than MS milliseconds without yielding\n");
+	printf("   --budget-policy=POLICY   What to do with tasks over budget: yield (default) or error\n");
+	printf("   --low-budget=MS          Stop running due low priority tasks once they have taken MS milliseconds in a tick\n");
+	printf("   --virtual-time           Jump the clock to the next deadline instead of sleeping\n");
+	printf("   --gpio=BACKEND           GPIO backend: wiringpi (default) or sim\n");
+	printf("   --gpio-trace=FILE        Drive simulated inputs from FILE (lines of TIME PIN VALUE)\n");
+	printf("   --gpio-log=FILE          Log simulated pin changes to FILE with timestamps\n");
+	printf("   --hotlines[=FILE]        Count line and function hits and write a hot spot report to FILE (hotlines.txt)\n");
+	printf("   --alloc-profile[=FILE]   Sample VM allocations and write folded stacks to FILE (alloc.folded) at exit or on SIGUSR1\n");
+	printf("   --alloc-rate=BYTES       Take an allocation sample every BYTES bytes allocated (default 65536)\n");
+	printf("   --native                 Compile scripts and modules to native code as they load, where supported\n");
+	printf("   --realtime[=PRIO]        Run scheduler threads as SCHED_FIFO at PRIO (1-99, default 50) with memory locked\n");
+	printf("   --cpu=LIST               Pin scheduler threads to the comma separated CPUs in LIST, and other threads off them\n");
+	printf("   --engine-cpu=LIST        Pin the stepper and input engine threads to CPUs in LIST instead of the --cpu ones\n");
+	printf("   --latency-report         Print a histogram of how late timed wake-ups were at exit\n");
+	printf("\n");
+	printf("Build compiles FILE and every module it requires or spawns as an actor into one bundle,\n");
+	printf("which run accepts in place of a script.\n");
+	printf("\n");
+	printf("Daemon keeps the runtime and GPIO backend up and runs FILE, if given, taking run options.\n");
+	printf("ctl sends it commands over its control socket (%s by default): load swaps FILE in\n", Daemon::kDefaultSocket);
+	printf("for the running script once it compiles, reload loads the script again, and stop stops it.\n");
+	printf("\n");
+}
+
+// Matches "--name" and "--name=value". value is set to nullptr when no value is given:
+static bool match_option(const char* arg, const char* name, const char** value)
+{
+	size_t len = strlen(name);
+	if (strncmp(arg, name, len) != 0)
+	{
+		return false;
+	}
+
+	if (arg[len] == '\0')
+	{
+		*value = nullptr;
+		return true;
+	}
+	else if (arg[len] == '=')
+	{
+		*value = arg + len + 1;
+		return true;
+	}
+
+	return false;
 }
 
-static int run_script(const char* filepath)
+// Parses a comma separated list of CPU numbers. Returns false for an empty or malformed list:
+static bool parse_cpus(const char* value, std::vector<int>* cpus)
+{
+	cpus->clear();
+	for (const char* next = value; next && *next;)
+	{
+		char* end;
+		long cpu = strtol(next, &end, 10);
+		if (end == next || cpu < 0 || cpu >= CPU_SETSIZE || (*end != ',' && *end != '\0'))
+		{
+			cpus->clear();
+			break;
+		}
+		cpus->push_back(static_cast<int>(cpu));
+		next = *end == ',' ? end + 1 : end;
+	}
+
+	return !cpus->empty();
+}
+
+static bool parse_run_options(int argc, char** argv, RunOptions* options, bool daemon)
+{
+	for (int i = 2; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		const char* value;
+
+		if (strncmp(arg, "--", 2) != 0)
+		{
+			if (options->filepath != nullptr)
+			{
+				printf("Unexpected argument: %s\n", arg);
+				return false;
+			}
+			options->filepath = arg;
+		}
+		else if (match_option(arg, "--budget", &value))
+		{
+			options->actor.budget = value ? atof(value) / 1000.0 : 0;
+			if (options->actor.budget <= 0)
+			{
+				printf("Expected a positive number of milliseconds for --budget\n");
+				return false;
+			}
+		}
+		else if (match_option(arg, "--budget-policy", &value))
+		{
+			if (value && strcmp(value, "yield") == 0)
+			{
+				options->actor.budget_policy = BudgetPolicy::Yield;
+			}
+			else if (value && strcmp(value, "error") == 0)
+			{
+				options->actor.budget_policy = BudgetPolicy::Error;
+			}
+			else
+			{
+				printf("Expected yield or error for --budget-policy\n");
+				return false;
+			}
+		}
+		else if (match_option(arg, "--low-budget", &value))
+		{
+			options->actor.low_priority_budget = value ? atof(value) / 1000.0 : 0;
+			if (options->actor.low_priority_budget <= 0)
+			{
+				printf("Expected a positive number of milliseconds for --low-budget\n");
+				return false;
+			}
+		}
+		else if (match_option(arg, "--virtual-time", &value) && value == nullptr)
+		{
+			options->actor.virtual_time = true;
+		}
+		else if (match_option(arg, "--gpio", &value))
+		{
+			if (value && strcmp(value, "sim") == 0)
+			{
+				options->gpio_sim = true;
+			}
+			else if (value && strcmp(value, "wiringpi") == 0)
+			{
+				options->gpio_sim = false;
+			}
+			else
+			{
+				printf("Expected wiringpi or sim for --gpio\n");
+				return false;
+			}
+		}
+		else if (match_option(arg, "--gpio-trace", &value) && value)
+		{
+			options->gpio_trace = value;
+		}
+		else if (match_option(arg, "--gpio-log", &value) && value)
+		{
+			options->gpio_log = value;
+		}
+		else if (match_option(arg, "--hotlines", &value))
+		{
+			options->hotlines = value ? value : "hotlines.txt";
+		}
+		else if (match_option(arg, "--alloc-profile", &value))
+		{
+			options->alloc_profile = value ? value : "alloc.folded";
+		}
+		else if (match_option(arg, "--alloc-rate", &value))
+		{
+			long long rate = value ? atoll(value) : 0;
+			if (rate <= 0)
+			{
+				printf("Expected a positive number of bytes for --alloc-rate\n");
+				return false;
+			}
+			options->alloc_rate = static_cast<size_t>(rate);
+		}
+		else if (match_option(arg, "--native", &value) && value == nullptr)
+		{
+			options->native = true;
+		}
+		else if (match_option(arg, "--realtime", &value))
+		{
+			int priority = value ? atoi(value) : Realtime::kDefaultPriority;
+			if (priority < 1 || priority > 99)
+			{
+				printf("Expected a priority from 1 to 99 for --realtime\n");
+				return false;
+			}
+			options->realtime = true;
+			options->realtime_options.priority = priority;
+		}
+		else if (match_option(arg, "--cpu", &value))
+		{
+			if (!parse_cpus(value, &options->realtime_options.cpus))
+			{
+				printf("Expected a comma separated list of CPU numbers for --cpu\n");
+				return false;
+			}
+			options->realtime = true;
+		}
+		else if (match_option(arg, "--engine-cpu", &value))
+		{
+			if (!parse_cpus(value, &options->realtime_options.engine_cpus))
+			{
+				printf("Expected a comma separated list of CPU numbers for --engine-cpu\n");
+				return false;
+			}
+			options->realtime = true;
+		}
+		else if (match_option(arg, "--latency-report", &value) && value == nullptr)
+		{
+			options->actor.latency_report = true;
+		}
+		else if (daemon && match_option(arg, "--socket", &value) && value)
+		{
+			options->socket = value;
+		}
+		else
+		{
+			printf("Unknown option: %s\n", arg);
+			return false;
+		}
+	}
+
+	if ((options->gpio_trace || options->gpio_log) && !options->gpio_sim)
+	{
+		printf("--gpio-trace and --gpio-log require --gpio=sim\n");
+		return false;
+	}
+
+	if (options->filepath == nullptr && !daemon)
+	{
+		printf("No file provided\n");
+		return false;
+	}
+
+	return true;
+}
+
+// Process-wide setup shared by run and daemon. Returns false if a file the options name could not be opened:
+static bool setup_runtime(const RunOptions& options)
+{
+	LuauScript::set_native(options.native);
+
+	if (options.gpio_sim)
+	{
+		std::unique_ptr<SimGpio> sim(new SimGpio());
+
+		std::string error;
+		if (options.gpio_trace && !sim->load_trace(options.gpio_trace, &error))
+		{
+			printf("%s\n", error.c_str());
+			return false;
+		}
+		if (options.gpio_log && !sim->open_log(options.gpio_log, &error))
+		{
+			printf("%s\n", error.c_str());
+			return false;
+		}
+
+		Gpio::set_backend(std::move(sim));
+	}
+
+	if (options.hotlines)
+	{
+		HotLines::enable(options.hotlines);
+	}
+	if (options.alloc_profile)
+	{
+		AllocProfiler::enable(options.alloc_profile, options.alloc_rate);
+	}
+	if (options.realtime)
+	{
+		Realtime::enable(options.realtime_options);
+	}
+
+	return true;
+}
+
+static void install_signal_handlers(const RunOptions& options, bool daemon)
 {
 	struct sigaction sigint_handler{};
 	sigint_handler.sa_handler = handle_sigint;
 	sigemptyset(&sigint_handler.sa_mask);
 	sigint_handler.sa_flags = 0;
-
 	sigaction(SIGINT, &sigint_handler, nullptr);
 
-	LuauState state;
-	lua_State* L = state.get();
+	// Service managers stop daemons with SIGTERM:
+	if (daemon)
+	{
+		sigaction(SIGTERM, &sigint_handler, nullptr);
+	}
+
+	if (options.alloc_profile)
+	{
+		struct sigaction sigusr1_handler{};
+		sigusr1_handler.sa_handler = handle_sigusr1;
+		sigemptyset(&sigusr1_handler.sa_mask);
+		sigusr1_handler.sa_flags = 0;
+		sigaction(SIGUSR1, &sigusr1_handler, nullptr);
+	}
+}
+
+static void write_reports(const RunOptions& options)
+{
+	if (options.hotlines)
+	{
+		std::string error;
+		if (HotLines::write_report(&error))
+		{
+			printf("Hot lines report written to %s\n", options.hotlines);
+		}
+		else
+		{
+			printf("%s\n", error.c_str());
+		}
+	}
 
-	LuauTaskScheduler* scheduler = LuauTaskScheduler::get(L);
+	if (options.alloc_profile)
+	{
+		std::string error;
+		if (!AllocProfiler::write_report(&error))
+		{
+			printf("%s\n", error.c_str());
+		}
+	}
 
-	if (LuauScript::load_and_run(L, filepath, nullptr) == nullptr)
+	if (options.actor.latency_report)
+	{
+		LatencyHistogram::print_report();
+	}
+}
+
+static int run_script(const RunOptions& options)
+{
+	std::string script = options.filepath;
+	if (Bundle::is_bundle(script))
+	{
+		if (options.hotlines)
+		{
+			printf("--hotlines needs source files, not a bundle\n");
+			return 1;
+		}
+
+		std::string error;
+		std::unique_ptr<Bundle> bundle = Bundle::open(script, &error);
+		if (!bundle)
+		{
+			printf("%s\n", error.c_str());
+			return 1;
+		}
+
+		script = bundle->get_entry();
+		Bundle::mount(std::move(bundle));
+	}
+
+	if (!setup_runtime(options))
 	{
 		return 1;
 	}
 
-	double last = lua_clock();
-	while (!stop_script)
+	Waker interrupt;
+	interrupt_waker = &interrupt;
+
+	install_signal_handlers(options, false);
+
+	// The main script is the root actor and runs on this thread:
+	std::shared_ptr<Actor> actor = std::make_shared<Actor>(script, options.actor, nullptr);
+	int exit_code = actor->run(&stop_script, &interrupt);
+
+	// Files the script left open are flushed and closed on the worker pool:
+	WorkerPool::get().wait_detached();
+
+	interrupt_waker = nullptr;
+
+	write_reports(options);
+
+	return exit_code;
+}
+
+static int run_daemon(const RunOptions& options)
+{
+	// A bundle is mounted for the whole process, so scripts could not be swapped for ones outside it:
+	if (options.filepath && Bundle::is_bundle(options.filepath))
+	{
+		printf("daemon runs source files, not bundles\n");
+		return 1;
+	}
+
+	if (!setup_runtime(options))
+	{
+		return 1;
+	}
+
+	Waker interrupt;
+	interrupt_waker = &interrupt;
+
+	install_signal_handlers(options, true);
+
+	int exit_code = 0;
 	{
-		double now = lua_clock();
-		double dt = now - last;
-		last = now;
+		Daemon daemon(options.actor);
 
-		bool has_more = scheduler->update(now, dt);
-		if (!has_more)
+		std::string error;
+		DaemonTiming timing;
+		if (options.filepath && !daemon.load(options.filepath, &timing, &error))
 		{
-			break;
+			printf("Failed to load %s\n", options.filepath);
+		}
+		else if (options.filepath)
+		{
+			printf("Loaded %s: first tick after %.3f ms\n", options.filepath, timing.first_tick * 1000);
 		}
 
-		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		if (!daemon.serve(options.socket ? options.socket : Daemon::kDefaultSocket, &stop_script, &interrupt, &error))
+		{
+			printf("%s\n", error.c_str());
+			exit_code = 1;
+		}
 	}
 
-	pilib_call_exit_callbacks(L);
+	WorkerPool::get().wait_detached();
+
+	interrupt_waker = nullptr;
+
+	write_reports(options);
 
-	return stop_script ? 1 : 0;
+	return exit_code;
+}
+
+static int send_control(int argc, char** argv)
+{
+	const char* socket = Daemon::kDefaultSocket;
+	std::vector<const char*> args;
+	for (int i = 2; i < argc; i++)
+	{
+		const char* value;
+		if (match_option(argv[i], "--socket", &value) && value)
+		{
+			socket = value;
+		}
+		else
+		{
+			args.push_back(argv[i]);
+		}
+	}
+
+	std::string command;
+	if (args.size() == 2 && strcmp(args[0], "load") == 0)
+	{
+		// The daemon resolves paths from its own working directory, so send an absolute one:
+		char* path = realpath(args[1], nullptr);
+		if (path == nullptr)
+		{
+			printf("%s: %s\n", args[1], strerror(errno));
+			return 1;
+		}
+		command = std::string("load ") + path;
+		free(path);
+	}
+	else if (args.size() == 1 && (strcmp(args[0], "reload") == 0 || strcmp(args[0], "stop") == 0))
+	{
+		command = args[0];
+	}
+	else
+	{
+		printf("Usage: luaupi ctl load [FILE] | reload | stop [--socket=PATH]\n");
+		return 1;
+	}
+
+	std::string reply;
+	std::string error;
+	if (!Daemon::send_command(socket, command, &reply, &error))
+	{
+		printf("%s\n", error.c_str());
+		return 1;
+	}
+
+	printf("%s\n", reply.c_str());
+
+	return strncmp(reply.c_str(), "ok", 2) == 0 ? 0 : 1;
+}
+
+static int build_bundle(int argc, char** argv)
+{
+	const char* filepath = nullptr;
+	const char* output = nullptr;
+	for (int i = 2; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+		{
+			output = argv[++i];
+		}
+		else if (filepath == nullptr && strncmp(argv[i], "-", 1) != 0)
+		{
+			filepath = argv[i];
+		}
+		else
+		{
+			printf("Unexpected argument: %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	if (filepath == nullptr || output == nullptr)
+	{
+		printf("Usage: luaupi build [FILE] -o [OUTPUT]\n");
+		return 1;
+	}
+
+	std::vector<std::string> names;
+	std::string error;
+	if (!Bundle::build(filepath, output, &names, &error))
+	{
+		printf("%s\n", error.c_str());
+		return 1;
+	}
+
+	printf("Bundled %zu module(s) into %s:\n", names.size(), output);
+	for (const std::string& name : names)
+	{
+		printf("   %s\n", name.c_str());
+	}
+
+	return 0;
 }
 
 int main(int argc, char** argv)
@@ -105,12 +624,29 @@ int main(int argc, char** argv)
 	}
 	else if (strcmp(argv[1], "run") == 0)
 	{
-		if (argc <= 2)
+		RunOptions options;
+		if (!parse_run_options(argc, argv, &options, false))
+		{
+			return 1;
+		}
+		return run_script(options);
+	}
+	else if (strcmp(argv[1], "daemon") == 0)
+	{
+		RunOptions options;
+		if (!parse_run_options(argc, argv, &options, true))
 		{
-			printf("No file provided\n");
 			return 1;
 		}
-		return run_script(argv[2]);
+		return run_daemon(options);
+	}
+	else if (strcmp(argv[1], "ctl") == 0)
+	{
+		return send_control(argc, argv);
+	}
+	else if (strcmp(argv[1], "build") == 0)
+	{
+		return build_bundle(argc, argv);
 	}
 
 	printf("Unknown command: %s\n", argv[1]);
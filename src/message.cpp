@@ -0,0 +1,201 @@
+#include "message.h"
+
+#include <lualib.h>
+#include <cstring>
+#include <cstdint>
+
+using namespace LuauPi;
+
+static constexpr int kMaxMessageDepth = 32;
+
+enum MessageTag : char
+{
+	kTagNil,
+	kTagFalse,
+	kTagTrue,
+	kTagNumber,
+	kTagString,
+	kTagBuffer,
+	kTagVector,
+	kTagTable,
+	kTagTableEnd,
+};
+
+static void pack_value(lua_State* L, int idx, std::string& out, int depth)
+{
+	switch (lua_type(L, idx))
+	{
+	case LUA_TNIL:
+		out += kTagNil;
+		break;
+	case LUA_TBOOLEAN:
+		out += lua_toboolean(L, idx) ? kTagTrue : kTagFalse;
+		break;
+	case LUA_TNUMBER:
+	{
+		double n = lua_tonumber(L, idx);
+		out += kTagNumber;
+		out.append(reinterpret_cast<const char*>(&n), sizeof(n));
+		break;
+	}
+	case LUA_TSTRING:
+	case LUA_TBUFFER:
+	{
+		size_t len;
+		const char* data;
+		if (lua_type(L, idx) == LUA_TSTRING)
+		{
+			data = lua_tolstring(L, idx, &len);
+			out += kTagString;
+		}
+		else
+		{
+			data = static_cast<const char*>(lua_tobuffer(L, idx, &len));
+			out += kTagBuffer;
+		}
+		uint32_t size = static_cast<uint32_t>(len);
+		out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+		out.append(data, len);
+		break;
+	}
+	case LUA_TVECTOR:
+	{
+		const float* v = lua_tovector(L, idx);
+		out += kTagVector;
+		out.append(reinterpret_cast<const char*>(v), sizeof(float) * 3);
+		break;
+	}
+	case LUA_TTABLE:
+	{
+		if (depth >= kMaxMessageDepth)
+		{
+			luaL_error(L, "cannot send tables nested more than %d levels deep", kMaxMessageDepth);
+		}
+		luaL_checkstack(L, 3, "message too deep");
+
+		out += kTagTable;
+		lua_pushnil(L);
+		while (lua_next(L, idx))
+		{
+			pack_value(L, lua_gettop(L) - 1, out, depth + 1);
+			pack_value(L, lua_gettop(L), out, depth + 1);
+			lua_pop(L, 1);
+		}
+		out += kTagTableEnd;
+		break;
+	}
+	default:
+		luaL_error(L, "cannot send value of type %s to an actor", luaL_typename(L, idx));
+	}
+}
+
+static void unpack_value(lua_State* L, const char*& p, int depth)
+{
+	lua_rawcheckstack(L, 3);
+
+	char tag = *p++;
+	switch (tag)
+	{
+	case kTagNil:
+		lua_pushnil(L);
+		break;
+	case kTagFalse:
+	case kTagTrue:
+		lua_pushboolean(L, tag == kTagTrue);
+		break;
+	case kTagNumber:
+	{
+		double n;
+		memcpy(&n, p, sizeof(n));
+		p += sizeof(n);
+		lua_pushnumber(L, n);
+		break;
+	}
+	case kTagString:
+	case kTagBuffer:
+	{
+		uint32_t size;
+		memcpy(&size, p, sizeof(size));
+		p += sizeof(size);
+		if (tag == kTagString)
+		{
+			lua_pushlstring(L, p, size);
+		}
+		else
+		{
+			void* data = lua_newbuffer(L, size);
+			memcpy(data, p, size);
+		}
+		p += size;
+		break;
+	}
+	case kTagVector:
+	{
+		float v[3];
+		memcpy(v, p, sizeof(v));
+		p += sizeof(v);
+		lua_pushvector(L, v[0], v[1], v[2]);
+		break;
+	}
+	case kTagTable:
+	{
+		lua_newtable(L);
+		while (*p != kTagTableEnd)
+		{
+			unpack_value(L, p, depth + 1);
+			unpack_value(L, p, depth + 1);
+			lua_rawset(L, -3);
+		}
+		p++;
+		break;
+	}
+	}
+}
+
+void Message::push_nil()
+{
+	data += kTagNil;
+}
+
+void Message::push_boolean(bool value)
+{
+	data += value ? kTagTrue : kTagFalse;
+}
+
+void Message::push_number(double value)
+{
+	data += kTagNumber;
+	data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void Message::push_string(const char* value, size_t len)
+{
+	uint32_t size = static_cast<uint32_t>(len);
+	data += kTagString;
+	data.append(reinterpret_cast<const char*>(&size), sizeof(size));
+	data.append(value, len);
+}
+
+void Message::pack(lua_State* L, int idx)
+{
+	pack_value(L, idx, data, 0);
+}
+
+int Message::unpack(lua_State* L) const
+{
+	int top = lua_gettop(L);
+
+	const char* p = data.data();
+	const char* end = p + data.size();
+	while (p < end)
+	{
+		unpack_value(L, p, 0);
+	}
+
+	return lua_gettop(L) - top;
+}
+
+bool Message::empty() const
+{
+	return data.empty();
+}
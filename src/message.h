@@ -0,0 +1,34 @@
+#ifndef LUAUPI_MESSAGE_H
+#define LUAUPI_MESSAGE_H
+
+#include <lua.h>
+#include <string>
+
+namespace LuauPi
+{
+
+// A list of values serialized so they can cross threads and VM heaps. Packed
+// from Lua values on one VM, or built by native code, and unpacked on another:
+class Message
+{
+private:
+	std::string data;
+
+public:
+	void push_nil();
+	void push_boolean(bool value);
+	void push_number(double value);
+	void push_string(const char* value, size_t len);
+
+	// Serializes the Lua value at idx. Raises a Lua error for unsupported types:
+	void pack(lua_State* L, int idx);
+
+	// Pushes the values onto L and returns how many were pushed:
+	int unpack(lua_State* L) const;
+
+	bool empty() const;
+};
+
+}
+
+#endif
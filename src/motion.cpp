@@ -0,0 +1,418 @@
+#include "motion.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <sched.h>
+#include <thread>
+
+#include "gpio.h"
+#include "scheduler.h"
+#include "realtime.h"
+
+using namespace LuauPi;
+
+static std::mutex engine_mutex;
+static std::condition_variable engine_cv;
+static std::vector<std::shared_ptr<Stepper>> steppers;
+static std::thread engine;
+static bool stopping_engine = false;
+// Set while the engine spins and pulses without the lock. Moves wait for it to clear, so a step's
+// direction and position are settled before a new move reads them:
+static bool pulse_in_flight = false;
+
+MotionProfile::MotionProfile()
+	: steps(0), v0(0), peak(0), acceleration(1), accel_steps(0), accel_time(0), cruise_steps(0), cruise_time(0), duration(0)
+{
+}
+
+MotionProfile::MotionProfile(double steps, double v0, double max_velocity, double acceleration)
+	: steps(steps), v0(v0), acceleration(acceleration)
+{
+	// The highest peak that still leaves room to decelerate to rest by the last step:
+	peak = std::max(v0, std::min(max_velocity, std::sqrt((2 * acceleration * steps + v0 * v0) / 2)));
+
+	accel_steps = (peak * peak - v0 * v0) / (2 * acceleration);
+	accel_time = (peak - v0) / acceleration;
+
+	double decel_steps = peak * peak / (2 * acceleration);
+	cruise_steps = std::max(0.0, steps - accel_steps - decel_steps);
+	cruise_time = peak > 0 ? cruise_steps / peak : 0;
+
+	duration = accel_time + cruise_time + peak / acceleration;
+}
+
+double MotionProfile::time_at(double s) const
+{
+	if (s <= accel_steps)
+	{
+		return (std::sqrt(v0 * v0 + 2 * acceleration * s) - v0) / acceleration;
+	}
+	if (s <= accel_steps + cruise_steps)
+	{
+		return accel_time + (s - accel_steps) / peak;
+	}
+
+	return duration - std::sqrt(std::max(0.0, 2 * (steps - s) / acceleration));
+}
+
+double MotionProfile::velocity_at(double s) const
+{
+	if (s <= accel_steps)
+	{
+		return std::sqrt(v0 * v0 + 2 * acceleration * s);
+	}
+	if (s <= accel_steps + cruise_steps)
+	{
+		return peak;
+	}
+
+	return std::sqrt(std::max(0.0, 2 * acceleration * (steps - s)));
+}
+
+double MotionProfile::get_duration() const
+{
+	return duration;
+}
+
+double MotionProfile::get_acceleration() const
+{
+	return acceleration;
+}
+
+Stepper::Stepper(int step_pin, int dir_pin, const StepperOptions& options, LuauTaskScheduler* scheduler)
+	: step_pin(step_pin), dir_pin(dir_pin), options(options), scheduler(scheduler), position(0), moving(false), target(0), direction(1),
+	  move_start(0), move_steps(0), steps_done(0), stopping(false), timed_steps(0), total_late(0), max_late(0)
+{
+}
+
+void Stepper::begin(int64_t new_target, const MotionProfile& new_profile, double start, std::shared_ptr<MoveWaiter> new_waiter)
+{
+	int64_t from = position.load();
+
+	target = new_target;
+	direction = new_target >= from ? 1 : -1;
+	profile = new_profile;
+	move_start = start;
+	move_steps = std::llabs(new_target - from);
+	steps_done = 0;
+	stopping = false;
+	waiter = std::move(new_waiter);
+
+	// The first step is at least a few hundred microseconds away, which covers the driver's direction setup time:
+	Gpio::digital_write(dir_pin, (direction > 0) != options.invert_direction);
+
+	moving = true;
+}
+
+void Stepper::finish()
+{
+	moving = false;
+
+	if (!waiter)
+	{
+		return;
+	}
+
+	if (stopping)
+	{
+		waiter->completed = false;
+	}
+	if (--waiter->remaining == 0 && waiter->scheduler)
+	{
+		Message values;
+		values.push_boolean(waiter->completed);
+		waiter->scheduler->post_resume(waiter->thread_ref, std::move(values), true);
+	}
+	waiter.reset();
+}
+
+double Stepper::next_step() const
+{
+	return move_start + profile.time_at(static_cast<double>(steps_done + 1));
+}
+
+int Stepper::get_step_pin() const
+{
+	return step_pin;
+}
+
+int Stepper::get_dir_pin() const
+{
+	return dir_pin;
+}
+
+const StepperOptions& Stepper::get_options() const
+{
+	return options;
+}
+
+int64_t Stepper::get_position() const
+{
+	return position.load(std::memory_order_relaxed);
+}
+
+bool Stepper::is_moving() const
+{
+	return moving.load(std::memory_order_relaxed);
+}
+
+// On a CPU shared with scheduler threads the spin yields each pass, so a script can still run (and stop
+// a move) while steps are back to back, at the cost of pulses going out late while it does:
+static void spin_until(double time, bool step_aside)
+{
+	while (Gpio::now() < time)
+	{
+		if (step_aside)
+		{
+			sched_yield();
+		}
+	}
+}
+
+void MotionEngine::run()
+{
+	Realtime::configure_engine_thread();
+	bool step_aside = Realtime::engine_shares_cpu();
+
+	// Steppers stepping in this pulse, with when each step was due:
+	std::vector<std::pair<std::shared_ptr<Stepper>, double>> due;
+
+	std::unique_lock<std::mutex> lock(engine_mutex);
+	while (!stopping_engine)
+	{
+		double next = HUGE_VAL;
+		for (const std::shared_ptr<Stepper>& stepper : steppers)
+		{
+			if (stepper->is_moving())
+			{
+				next = std::min(next, stepper->next_step());
+			}
+		}
+
+		if (next == HUGE_VAL)
+		{
+			engine_cv.wait(lock);
+			continue;
+		}
+
+		// Sleep while there is time to, then look again in case a move started or stopped meanwhile:
+		double delay = next - Gpio::now();
+		if (delay > kSpinMargin)
+		{
+			engine_cv.wait_for(lock, std::chrono::duration<double>(delay - kSpinMargin));
+			continue;
+		}
+		// Take the steps due by next, then spin and pulse unlocked so moves can be stopped meanwhile:
+		uint64_t mask = 0;
+		double pulse_width = 0;
+		for (const std::shared_ptr<Stepper>& stepper : steppers)
+		{
+			if (stepper->is_moving() && stepper->next_step() <= next)
+			{
+				mask |= uint64_t(1) << stepper->step_pin;
+				pulse_width = std::max(pulse_width, stepper->options.pulse_width);
+				due.emplace_back(stepper, stepper->next_step());
+			}
+		}
+		pulse_in_flight = true;
+		lock.unlock();
+
+		spin_until(next, step_aside);
+
+		double now = Gpio::now();
+		Gpio::digital_write_mask(mask, 0);
+		spin_until(now + pulse_width, step_aside);
+		Gpio::digital_write_mask(0, mask);
+
+		lock.lock();
+		pulse_in_flight = false;
+		for (const std::pair<std::shared_ptr<Stepper>, double>& step : due)
+		{
+			Stepper* stepper = step.first.get();
+
+			double late = now - step.second;
+			stepper->timed_steps++;
+			stepper->total_late += late;
+			stepper->max_late = std::max(stepper->max_late, late);
+
+			// The pulse went out even if the stepper was stopped or removed during it:
+			stepper->position += stepper->direction;
+			if (!stepper->is_moving())
+			{
+				continue;
+			}
+
+			stepper->steps_done++;
+			if (stepper->steps_done >= stepper->move_steps)
+			{
+				stepper->finish();
+			}
+		}
+		due.clear();
+		engine_cv.notify_all();
+	}
+}
+
+// Stops the engine at exit. Steppers are all released by then, so it is idle:
+static struct EngineShutdown
+{
+	~EngineShutdown()
+	{
+		{
+			std::lock_guard<std::mutex> lock(engine_mutex);
+			stopping_engine = true;
+		}
+		engine_cv.notify_all();
+
+		if (engine.joinable())
+		{
+			engine.join();
+		}
+	}
+} engine_shutdown;
+
+void MotionEngine::add(std::shared_ptr<Stepper> stepper)
+{
+	std::lock_guard<std::mutex> lock(engine_mutex);
+	if (!engine.joinable())
+	{
+		engine = std::thread(run);
+	}
+	steppers.push_back(std::move(stepper));
+}
+
+void MotionEngine::remove(Stepper* stepper)
+{
+	std::lock_guard<std::mutex> lock(engine_mutex);
+	if (stepper->is_moving())
+	{
+		stepper->stopping = true;
+		stepper->finish();
+	}
+	steppers.erase(std::remove_if(steppers.begin(), steppers.end(), [stepper](const std::shared_ptr<Stepper>& entry) {
+		return entry.get() == stepper;
+	}), steppers.end());
+}
+
+int MotionEngine::move(const std::vector<std::pair<Stepper*, int64_t>>& moves, double max_velocity, double acceleration,
+	std::shared_ptr<MoveWaiter> waiter)
+{
+	std::unique_lock<std::mutex> lock(engine_mutex);
+	engine_cv.wait(lock, [] { return !pulse_in_flight; });
+
+	int64_t longest = 0;
+	int count = 0;
+	for (const std::pair<Stepper*, int64_t>& move : moves)
+	{
+		if (move.first->is_moving())
+		{
+			return -1;
+		}
+
+		int64_t distance = std::llabs(move.second - move.first->get_position());
+		longest = std::max(longest, distance);
+		count += distance > 0 ? 1 : 0;
+	}
+
+	if (count == 0)
+	{
+		return 0;
+	}
+
+	waiter->remaining = count;
+
+	double start = Gpio::now();
+	for (const std::pair<Stepper*, int64_t>& move : moves)
+	{
+		int64_t distance = std::llabs(move.second - move.first->get_position());
+		if (distance == 0)
+		{
+			continue;
+		}
+
+		// Shorter axes run slower in proportion, so every axis arrives together:
+		double scale = static_cast<double>(distance) / static_cast<double>(longest);
+		MotionProfile profile(static_cast<double>(distance), 0, max_velocity * scale, acceleration * scale);
+		move.first->begin(move.second, profile, start, waiter);
+	}
+
+	engine_cv.notify_all();
+
+	return count;
+}
+
+void MotionEngine::stop(Stepper* stepper)
+{
+	std::lock_guard<std::mutex> lock(engine_mutex);
+	if (!stepper->is_moving())
+	{
+		return;
+	}
+
+	// Decelerate from the speed of the last step taken:
+	double done = static_cast<double>(stepper->steps_done);
+	double velocity = stepper->profile.velocity_at(done);
+	double acceleration = stepper->profile.get_acceleration();
+	double at = stepper->move_start + stepper->profile.time_at(done);
+
+	int64_t stop_steps = static_cast<int64_t>(std::ceil(velocity * velocity / (2 * acceleration)));
+	if (stop_steps >= stepper->move_steps - stepper->steps_done)
+	{
+		// Already close enough to the target to stop there:
+		return;
+	}
+
+	stepper->stopping = true;
+	if (stop_steps == 0)
+	{
+		stepper->finish();
+		return;
+	}
+
+	stepper->profile = MotionProfile(static_cast<double>(stop_steps), velocity, velocity, acceleration);
+	stepper->move_start = at;
+	stepper->move_steps = stop_steps;
+	stepper->steps_done = 0;
+	stepper->target = stepper->get_position() + stepper->direction * stop_steps;
+
+	engine_cv.notify_all();
+}
+
+int64_t MotionEngine::get_target(Stepper* stepper)
+{
+	std::lock_guard<std::mutex> lock(engine_mutex);
+	return stepper->is_moving() ? stepper->target : stepper->get_position();
+}
+
+StepperTiming MotionEngine::get_timing(Stepper* stepper)
+{
+	std::lock_guard<std::mutex> lock(engine_mutex);
+
+	StepperTiming timing;
+	timing.steps = stepper->timed_steps;
+	timing.mean_late = stepper->timed_steps > 0 ? stepper->total_late / stepper->timed_steps : 0;
+	timing.max_late = stepper->max_late;
+
+	return timing;
+}
+
+void MotionEngine::release(LuauTaskScheduler* scheduler)
+{
+	std::lock_guard<std::mutex> lock(engine_mutex);
+	steppers.erase(std::remove_if(steppers.begin(), steppers.end(), [scheduler](const std::shared_ptr<Stepper>& stepper) {
+		if (stepper->scheduler != scheduler)
+		{
+			return false;
+		}
+		if (stepper->is_moving())
+		{
+			stepper->stopping = true;
+			stepper->finish();
+		}
+		return true;
+	}), steppers.end());
+}
@@ -0,0 +1,152 @@
+#ifndef LUAUPI_MOTION_H
+#define LUAUPI_MOTION_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+class LuauTaskScheduler;
+
+namespace LuauPi
+{
+
+struct StepperOptions
+{
+	// Move defaults, in steps per second and steps per second squared:
+	double max_velocity = 1000;
+	double acceleration = 1000;
+
+	// How long each step pulse is held high, in seconds:
+	double pulse_width = 5e-6;
+	bool invert_direction = false;
+};
+
+// Time against distance for a move of steps: accelerating from v0 to a peak no higher than
+// max_velocity, cruising, then decelerating to rest on the last step. A trapezoid, or a triangle
+// when the move is too short to reach max_velocity. Times are from the start of the move:
+class MotionProfile
+{
+private:
+	double steps;
+	double v0;
+	double peak;
+	double acceleration;
+
+	double accel_steps;
+	double accel_time;
+	double cruise_steps;
+	double cruise_time;
+	double duration;
+
+public:
+	MotionProfile();
+	MotionProfile(double steps, double v0, double max_velocity, double acceleration);
+
+	double time_at(double s) const;
+	double velocity_at(double s) const;
+	double get_duration() const;
+	double get_acceleration() const;
+};
+
+// Resumes a task once every axis of its move has finished:
+struct MoveWaiter
+{
+	LuauTaskScheduler* scheduler = nullptr;
+	int thread_ref = 0;
+	int remaining = 0;
+
+	// Cleared if any axis was stopped short of its target:
+	bool completed = true;
+};
+
+struct StepperTiming
+{
+	uint64_t steps;
+
+	// How late pulses went out against the profile, in seconds:
+	double mean_late;
+	double max_late;
+};
+
+// A step and direction driver, moved by the motion engine. The move state is only
+// touched with the engine's lock held; position and moving can be read at any time.
+class Stepper
+{
+private:
+	int step_pin;
+	int dir_pin;
+	StepperOptions options;
+	LuauTaskScheduler* scheduler;
+
+	std::atomic<int64_t> position;
+	std::atomic<bool> moving;
+
+	int64_t target;
+	int direction;
+	MotionProfile profile;
+	double move_start;
+	int64_t move_steps;
+	int64_t steps_done;
+	bool stopping;
+	std::shared_ptr<MoveWaiter> waiter;
+
+	uint64_t timed_steps;
+	double total_late;
+	double max_late;
+
+	void begin(int64_t new_target, const MotionProfile& new_profile, double start, std::shared_ptr<MoveWaiter> new_waiter);
+	void finish();
+	double next_step() const;
+
+	friend class MotionEngine;
+
+public:
+	Stepper(int step_pin, int dir_pin, const StepperOptions& options, LuauTaskScheduler* scheduler);
+
+	int get_step_pin() const;
+	int get_dir_pin() const;
+	const StepperOptions& get_options() const;
+
+	int64_t get_position() const;
+	bool is_moving() const;
+};
+
+// Generates step pulses for every stepper from one timing thread. The thread sleeps until just
+// before the next step is due, then spins, so pulses go out within microseconds of the profile.
+// Steps due together on several axes share one pulse.
+class MotionEngine
+{
+private:
+	// The timing thread:
+	static void run();
+
+public:
+	// How long before a step the thread stops sleeping and spins:
+	static constexpr double kSpinMargin = 0.0001;
+
+	static void add(std::shared_ptr<Stepper> stepper);
+	// Stops the stepper where it is and resumes its waiter with false:
+	static void remove(Stepper* stepper);
+
+	// Starts moving each stepper to its target position, together. The axis with the furthest to go
+	// uses max_velocity and acceleration, and the rest are scaled down to finish at the same time.
+	// waiter is resumed once all have finished. Returns how many axes had to move, or -1 without
+	// starting any if one of them is already moving:
+	static int move(const std::vector<std::pair<Stepper*, int64_t>>& moves, double max_velocity, double acceleration,
+		std::shared_ptr<MoveWaiter> waiter);
+
+	// Decelerates to rest as quickly as the move's acceleration allows. Its waiter is resumed with false:
+	static void stop(Stepper* stepper);
+
+	static int64_t get_target(Stepper* stepper);
+	static StepperTiming get_timing(Stepper* stepper);
+
+	// Stops and removes every stepper of scheduler. Called before it closes:
+	static void release(LuauTaskScheduler* scheduler);
+};
+
+}
+
+#endif
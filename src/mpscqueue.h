@@ -0,0 +1,55 @@
+#ifndef LUAUPI_MPSCQUEUE_H
+#define LUAUPI_MPSCQUEUE_H
+
+#include <atomic>
+
+namespace LuauPi
+{
+
+// Lock-free multi-producer, single-consumer queue of items linked through T::next.
+// Any thread may push; the consumer takes everything at once.
+template <typename T>
+class MpscQueue
+{
+private:
+	std::atomic<T*> head;
+
+public:
+	MpscQueue() : head(nullptr)
+	{
+	}
+
+	// Returns true if the queue was empty, in which case the consumer may need waking:
+	bool push(T* item)
+	{
+		T* old_head = head.load(std::memory_order_relaxed);
+		do
+		{
+			item->next = old_head;
+		} while (!head.compare_exchange_weak(old_head, item, std::memory_order_release, std::memory_order_relaxed));
+
+		return old_head == nullptr;
+	}
+
+	// Returns the queued items in the order they were pushed, linked through T::next:
+	T* take_all()
+	{
+		T* item = head.exchange(nullptr, std::memory_order_acquire);
+
+		// Pushed newest first; reverse into push order:
+		T* ordered = nullptr;
+		while (item)
+		{
+			T* next = item->next;
+			item->next = ordered;
+			ordered = item;
+			item = next;
+		}
+
+		return ordered;
+	}
+};
+
+}
+
+#endif
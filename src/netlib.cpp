@@ -0,0 +1,663 @@
+#include "netlib.h"
+
+#include <lualib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "scheduler.h"
+
+static constexpr const char* kSocket = "Socket";
+static constexpr int kDefaultReadSize = 64 * 1024;
+static constexpr int kDefaultBacklog = 128;
+
+enum class SocketKind
+{
+	Stream,
+	Listener,
+	Datagram,
+};
+
+struct Socket
+{
+	int fd;
+	SocketKind kind;
+	bool closed;
+};
+
+// Received data is read here first, then copied into a buffer of the exact size:
+static thread_local std::vector<char> read_scratch;
+
+static void socket_destructor(void* ud)
+{
+	Socket* sock = static_cast<Socket*>(ud);
+	if (!sock->closed)
+	{
+		close(sock->fd);
+	}
+}
+
+static void push_socket(lua_State* L, int fd, SocketKind kind)
+{
+	Socket* sock = static_cast<Socket*>(lua_newuserdatadtor(L, sizeof(Socket), socket_destructor));
+	sock->fd = fd;
+	sock->kind = kind;
+	sock->closed = false;
+
+	luaL_getmetatable(L, kSocket);
+	lua_setmetatable(L, -2);
+}
+
+static Socket* check_socket(lua_State* L, int idx, SocketKind kind)
+{
+	Socket* sock = static_cast<Socket*>(luaL_checkudata(L, idx, kSocket));
+	if (sock->closed)
+	{
+		luaL_error(L, "attempt to use a closed socket");
+	}
+	if (sock->kind != kind)
+	{
+		luaL_error(L, "operation not supported on this kind of socket");
+	}
+
+	return sock;
+}
+
+static std::string describe_errno(const char* what)
+{
+	return std::string(what) + ": " + strerror(errno);
+}
+
+static bool set_nonblocking(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+	return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+static bool would_block()
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+// Tries attempt right away, and if it would block, parks the task until fd is ready and tries again:
+static int run_io(lua_State* L, int fd, IoDirection direction, std::function<int(lua_State* T)> attempt)
+{
+	int n = attempt(L);
+	if (n == LuauTaskScheduler::kIoRetry)
+	{
+		return LuauTaskScheduler::get(L)->wait_io(L, fd, direction, std::move(attempt));
+	}
+	if (n < 0)
+	{
+		lua_error(L);
+	}
+
+	return n;
+}
+
+// Resolves host and port. Blocking, so it only runs on worker threads:
+static bool resolve(const std::string& host, int port, int socktype, bool passive, sockaddr_storage* addr, socklen_t* len, std::string* error)
+{
+	addrinfo hints{};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = socktype;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+
+	std::string service = std::to_string(port);
+	addrinfo* result;
+	int status = getaddrinfo(host.empty() ? nullptr : host.c_str(), service.c_str(), &hints, &result);
+	if (status != 0)
+	{
+		*error = host + ": " + gai_strerror(status);
+		return false;
+	}
+
+	memcpy(addr, result->ai_addr, result->ai_addrlen);
+	*len = result->ai_addrlen;
+	freeaddrinfo(result);
+
+	return true;
+}
+
+static bool unix_address(const std::string& path, sockaddr_storage* addr, socklen_t* len, std::string* error)
+{
+	sockaddr_un* un = reinterpret_cast<sockaddr_un*>(addr);
+	if (path.size() >= sizeof(un->sun_path))
+	{
+		*error = path + ": path too long";
+		return false;
+	}
+
+	memset(un, 0, sizeof(sockaddr_un));
+	un->sun_family = AF_UNIX;
+	memcpy(un->sun_path, path.c_str(), path.size() + 1);
+	*len = sizeof(sockaddr_un);
+
+	return true;
+}
+
+struct OpenResult
+{
+	int fd = -1;
+	std::string error;
+
+	// Closes a socket no task took, when the task was cancelled or its actor stopped while it opened:
+	~OpenResult()
+	{
+		if (fd != -1)
+		{
+			close(fd);
+		}
+	}
+};
+
+// Creates, connects or binds a socket on the worker pool, then resumes the task with the handle:
+static int open_socket(lua_State* L, std::function<void(OpenResult* result)> open, SocketKind kind)
+{
+	std::shared_ptr<OpenResult> result = std::make_shared<OpenResult>();
+
+	return LuauTaskScheduler::get(L)->offload(
+		L,
+		[open, result]() {
+			open(result.get());
+			if (result->fd != -1 && !set_nonblocking(result->fd))
+			{
+				result->error = describe_errno("fcntl");
+				close(result->fd);
+				result->fd = -1;
+			}
+		},
+		[result, kind](lua_State* T) {
+			if (result->fd == -1)
+			{
+				lua_pushlstring(T, result->error.data(), result->error.size());
+				return -1;
+			}
+			push_socket(T, result->fd, kind);
+			result->fd = -1;
+			return 1;
+		}
+	);
+}
+
+static void connect_to(OpenResult* result, const sockaddr_storage& addr, socklen_t len)
+{
+	int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+	{
+		result->error = describe_errno("socket");
+		return;
+	}
+
+	if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), len) == -1)
+	{
+		result->error = describe_errno("connect");
+		close(fd);
+		return;
+	}
+
+	if (addr.ss_family != AF_UNIX)
+	{
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+
+	result->fd = fd;
+}
+
+static void bind_to(OpenResult* result, const sockaddr_storage& addr, socklen_t len, int type, int backlog)
+{
+	int fd = socket(addr.ss_family, type | SOCK_CLOEXEC, 0);
+	if (fd == -1)
+	{
+		result->error = describe_errno("socket");
+		return;
+	}
+
+	if (addr.ss_family != AF_UNIX)
+	{
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	}
+
+	if (bind(fd, reinterpret_cast<const sockaddr*>(&addr), len) == -1)
+	{
+		result->error = describe_errno("bind");
+		close(fd);
+		return;
+	}
+
+	if (type == SOCK_STREAM && listen(fd, backlog) == -1)
+	{
+		result->error = describe_errno("listen");
+		close(fd);
+		return;
+	}
+
+	result->fd = fd;
+}
+
+static int check_port(lua_State* L, int idx)
+{
+	int port = luaL_checkinteger(L, idx);
+	luaL_argcheck(L, port >= 0 && port <= 65535, idx, "port out of range");
+	return port;
+}
+
+static int net_connect(lua_State* L)
+{
+	std::string host = luaL_checkstring(L, 1);
+	int port = check_port(L, 2);
+
+	return open_socket(L, [host, port](OpenResult* result) {
+		sockaddr_storage addr;
+		socklen_t len;
+		if (resolve(host, port, SOCK_STREAM, false, &addr, &len, &result->error))
+		{
+			connect_to(result, addr, len);
+		}
+	}, SocketKind::Stream);
+}
+
+static int net_connectUnix(lua_State* L)
+{
+	std::string path = luaL_checkstring(L, 1);
+
+	return open_socket(L, [path](OpenResult* result) {
+		sockaddr_storage addr;
+		socklen_t len;
+		if (unix_address(path, &addr, &len, &result->error))
+		{
+			connect_to(result, addr, len);
+		}
+	}, SocketKind::Stream);
+}
+
+static int net_listen(lua_State* L)
+{
+	std::string host = luaL_checkstring(L, 1);
+	int port = check_port(L, 2);
+	int backlog = luaL_optinteger(L, 3, kDefaultBacklog);
+
+	return open_socket(L, [host, port, backlog](OpenResult* result) {
+		sockaddr_storage addr;
+		socklen_t len;
+		if (resolve(host, port, SOCK_STREAM, true, &addr, &len, &result->error))
+		{
+			bind_to(result, addr, len, SOCK_STREAM, backlog);
+		}
+	}, SocketKind::Listener);
+}
+
+static int net_listenUnix(lua_State* L)
+{
+	std::string path = luaL_checkstring(L, 1);
+	int backlog = luaL_optinteger(L, 2, kDefaultBacklog);
+
+	return open_socket(L, [path, backlog](OpenResult* result) {
+		sockaddr_storage addr;
+		socklen_t len;
+		if (unix_address(path, &addr, &len, &result->error))
+		{
+			bind_to(result, addr, len, SOCK_STREAM, backlog);
+		}
+	}, SocketKind::Listener);
+}
+
+static int net_udp(lua_State* L)
+{
+	std::string host = luaL_optstring(L, 1, "0.0.0.0");
+	int port = lua_isnoneornil(L, 2) ? 0 : check_port(L, 2);
+
+	return open_socket(L, [host, port](OpenResult* result) {
+		sockaddr_storage addr;
+		socklen_t len;
+		if (resolve(host, port, SOCK_DGRAM, true, &addr, &len, &result->error))
+		{
+			bind_to(result, addr, len, SOCK_DGRAM, 0);
+		}
+	}, SocketKind::Datagram);
+}
+
+static void check_data(lua_State* L, int idx, std::string* out)
+{
+	size_t len;
+	const char* bytes;
+	if (lua_isbuffer(L, idx))
+	{
+		bytes = static_cast<const char*>(lua_tobuffer(L, idx, &len));
+	}
+	else
+	{
+		bytes = luaL_checklstring(L, idx, &len);
+	}
+
+	out->assign(bytes, len);
+}
+
+static void push_received(lua_State* L, ssize_t n)
+{
+	void* data = lua_newbuffer(L, n);
+	memcpy(data, read_scratch.data(), n);
+}
+
+static int socket_read(lua_State* L)
+{
+	Socket* sock = check_socket(L, 1, SocketKind::Stream);
+	int max = luaL_optinteger(L, 2, kDefaultReadSize);
+	luaL_argcheck(L, max > 0, 2, "expected a positive size");
+
+	int fd = sock->fd;
+	return run_io(L, fd, kIoRead, [fd, max](lua_State* T) {
+		read_scratch.resize(max);
+
+		ssize_t n;
+		do
+		{
+			n = recv(fd, read_scratch.data(), max, 0);
+		} while (n == -1 && errno == EINTR);
+
+		if (n == -1)
+		{
+			if (would_block())
+			{
+				return LuauTaskScheduler::kIoRetry;
+			}
+			lua_pushstring(T, describe_errno("recv").c_str());
+			return -1;
+		}
+
+		// nil at end of stream:
+		if (n == 0)
+		{
+			lua_pushnil(T);
+		}
+		else
+		{
+			push_received(T, n);
+		}
+		return 1;
+	});
+}
+
+static int socket_write(lua_State* L)
+{
+	Socket* sock = check_socket(L, 1, SocketKind::Stream);
+
+	std::shared_ptr<std::string> data = std::make_shared<std::string>();
+	check_data(L, 2, data.get());
+	std::shared_ptr<size_t> written = std::make_shared<size_t>(0);
+
+	// Resumes once everything has been written:
+	int fd = sock->fd;
+	return run_io(L, fd, kIoWrite, [fd, data, written](lua_State* T) {
+		while (*written < data->size())
+		{
+			ssize_t n = send(fd, data->data() + *written, data->size() - *written, MSG_NOSIGNAL);
+			if (n == -1)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				if (would_block())
+				{
+					return LuauTaskScheduler::kIoRetry;
+				}
+				lua_pushstring(T, describe_errno("send").c_str());
+				return -1;
+			}
+			*written += n;
+		}
+		return 0;
+	});
+}
+
+static int socket_accept(lua_State* L)
+{
+	Socket* sock = check_socket(L, 1, SocketKind::Listener);
+
+	int fd = sock->fd;
+	return run_io(L, fd, kIoRead, [fd](lua_State* T) {
+		int client;
+		do
+		{
+			client = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		} while (client == -1 && errno == EINTR);
+
+		if (client == -1)
+		{
+			if (would_block() || errno == ECONNABORTED)
+			{
+				return LuauTaskScheduler::kIoRetry;
+			}
+			lua_pushstring(T, describe_errno("accept").c_str());
+			return -1;
+		}
+
+		int one = 1;
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		push_socket(T, client, SocketKind::Stream);
+		return 1;
+	});
+}
+
+static int socket_sendTo(lua_State* L)
+{
+	Socket* sock = check_socket(L, 1, SocketKind::Datagram);
+
+	std::shared_ptr<std::string> data = std::make_shared<std::string>();
+	check_data(L, 2, data.get());
+	const char* host = luaL_checkstring(L, 3);
+	int port = check_port(L, 4);
+
+	// Only numeric addresses, so sending never blocks on a lookup:
+	std::shared_ptr<sockaddr_storage> addr = std::make_shared<sockaddr_storage>();
+	socklen_t len;
+	sockaddr_in* in4 = reinterpret_cast<sockaddr_in*>(addr.get());
+	sockaddr_in6* in6 = reinterpret_cast<sockaddr_in6*>(addr.get());
+	memset(addr.get(), 0, sizeof(sockaddr_storage));
+	if (inet_pton(AF_INET, host, &in4->sin_addr) == 1)
+	{
+		in4->sin_family = AF_INET;
+		in4->sin_port = htons(port);
+		len = sizeof(sockaddr_in);
+	}
+	else if (inet_pton(AF_INET6, host, &in6->sin6_addr) == 1)
+	{
+		in6->sin6_family = AF_INET6;
+		in6->sin6_port = htons(port);
+		len = sizeof(sockaddr_in6);
+	}
+	else
+	{
+		luaL_argerror(L, 3, "expected a numeric IP address");
+	}
+
+	int fd = sock->fd;
+	return run_io(L, fd, kIoWrite, [fd, data, addr, len](lua_State* T) {
+		ssize_t n;
+		do
+		{
+			n = sendto(fd, data->data(), data->size(), 0, reinterpret_cast<const sockaddr*>(addr.get()), len);
+		} while (n == -1 && errno == EINTR);
+
+		if (n == -1)
+		{
+			if (would_block())
+			{
+				return LuauTaskScheduler::kIoRetry;
+			}
+			lua_pushstring(T, describe_errno("sendto").c_str());
+			return -1;
+		}
+		return 0;
+	});
+}
+
+static int socket_recvFrom(lua_State* L)
+{
+	Socket* sock = check_socket(L, 1, SocketKind::Datagram);
+	int max = luaL_optinteger(L, 2, kDefaultReadSize);
+	luaL_argcheck(L, max > 0, 2, "expected a positive size");
+
+	int fd = sock->fd;
+	return run_io(L, fd, kIoRead, [fd, max](lua_State* T) {
+		read_scratch.resize(max);
+
+		sockaddr_storage addr;
+		socklen_t len = sizeof(addr);
+		ssize_t n;
+		do
+		{
+			n = recvfrom(fd, read_scratch.data(), max, 0, reinterpret_cast<sockaddr*>(&addr), &len);
+		} while (n == -1 && errno == EINTR);
+
+		if (n == -1)
+		{
+			if (would_block())
+			{
+				return LuauTaskScheduler::kIoRetry;
+			}
+			lua_pushstring(T, describe_errno("recvfrom").c_str());
+			return -1;
+		}
+
+		char host[INET6_ADDRSTRLEN] = "";
+		int port = 0;
+		if (addr.ss_family == AF_INET)
+		{
+			sockaddr_in* in4 = reinterpret_cast<sockaddr_in*>(&addr);
+			inet_ntop(AF_INET, &in4->sin_addr, host, sizeof(host));
+			port = ntohs(in4->sin_port);
+		}
+		else if (addr.ss_family == AF_INET6)
+		{
+			sockaddr_in6* in6 = reinterpret_cast<sockaddr_in6*>(&addr);
+			inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+			port = ntohs(in6->sin6_port);
+		}
+
+		push_received(T, n);
+		lua_pushstring(T, host);
+		lua_pushinteger(T, port);
+		return 3;
+	});
+}
+
+static int socket_close(lua_State* L)
+{
+	Socket* sock = static_cast<Socket*>(luaL_checkudata(L, 1, kSocket));
+	if (sock->closed)
+	{
+		return 0;
+	}
+
+	sock->closed = true;
+
+	// Tasks still waiting on the socket get an error:
+	LuauTaskScheduler::get(L)->unwatch_io(sock->fd);
+	close(sock->fd);
+
+	return 0;
+}
+
+static int socket_port(Socket* sock)
+{
+	sockaddr_storage addr;
+	socklen_t len = sizeof(addr);
+	if (getsockname(sock->fd, reinterpret_cast<sockaddr*>(&addr), &len) == -1)
+	{
+		return 0;
+	}
+
+	if (addr.ss_family == AF_INET)
+	{
+		return ntohs(reinterpret_cast<sockaddr_in*>(&addr)->sin_port);
+	}
+	if (addr.ss_family == AF_INET6)
+	{
+		return ntohs(reinterpret_cast<sockaddr_in6*>(&addr)->sin6_port);
+	}
+
+	return 0;
+}
+
+static int socket_index(lua_State* L)
+{
+	Socket* sock = static_cast<Socket*>(luaL_checkudata(L, 1, kSocket));
+	const char* key = luaL_checkstring(L, 2);
+
+	if (strcmp(key, "read") == 0 && sock->kind == SocketKind::Stream)
+	{
+		lua_pushcfunction(L, socket_read, "read");
+	}
+	else if (strcmp(key, "write") == 0 && sock->kind == SocketKind::Stream)
+	{
+		lua_pushcfunction(L, socket_write, "write");
+	}
+	else if (strcmp(key, "accept") == 0 && sock->kind == SocketKind::Listener)
+	{
+		lua_pushcfunction(L, socket_accept, "accept");
+	}
+	else if (strcmp(key, "sendTo") == 0 && sock->kind == SocketKind::Datagram)
+	{
+		lua_pushcfunction(L, socket_sendTo, "sendTo");
+	}
+	else if (strcmp(key, "recvFrom") == 0 && sock->kind == SocketKind::Datagram)
+	{
+		lua_pushcfunction(L, socket_recvFrom, "recvFrom");
+	}
+	else if (strcmp(key, "close") == 0)
+	{
+		lua_pushcfunction(L, socket_close, "close");
+	}
+	else if (strcmp(key, "closed") == 0)
+	{
+		lua_pushboolean(L, sock->closed);
+	}
+	else if (strcmp(key, "port") == 0)
+	{
+		lua_pushinteger(L, sock->closed ? 0 : socket_port(sock));
+	}
+	else
+	{
+		luaL_error(L, "%s is not a valid member of Socket", key);
+	}
+
+	return 1;
+}
+
+static const luaL_Reg net_lib[] = {
+	{"connect", net_connect},
+	{"connectUnix", net_connectUnix},
+	{"listen", net_listen},
+	{"listenUnix", net_listenUnix},
+	{"udp", net_udp},
+	{nullptr, nullptr},
+};
+
+void net_lib_open(lua_State* L)
+{
+	luaL_register(L, "net", net_lib);
+	lua_pop(L, 1);
+
+	// Socket handle metatable:
+	luaL_newmetatable(L, kSocket);
+	lua_pushcfunction(L, socket_index, "__index");
+	lua_setfield(L, -2, "__index");
+	lua_pushstring(L, "The metatable is locked");
+	lua_setfield(L, -2, "__metatable");
+	lua_pop(L, 1);
+}
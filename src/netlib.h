@@ -0,0 +1,8 @@
+#ifndef NETLIB_H
+#define NETLIB_H
+
+#include <lua.h>
+
+void net_lib_open(lua_State* L);
+
+#endif
@@ -2,12 +2,39 @@
 
 #include <lualib.h>
 #include <wiringPi.h>
+#include <cmath>
 #include <cstdio>
+#include <memory>
+#include <cstring>
+#include <new>
 
 #include "scheduler.h"
+#include "gpio.h"
+#include "gpiommap.h"
+#include "gpioinput.h"
+#include "motion.h"
+
+using namespace LuauPi;
 
 constexpr const char* k_on_exit_callbacks = "OnExitCallbacks";
 
+static constexpr const char* kCounter = "GpioCounter";
+static constexpr const char* kEncoder = "GpioEncoder";
+static constexpr const char* kDebouncedInput = "DebouncedInput";
+static constexpr const char* kStepper = "Stepper";
+
+// Keeps the native input alive for as long as its handle. Collected handles stop being updated:
+struct InputHandle
+{
+	std::shared_ptr<GpioInput> input;
+};
+
+// Collected steppers stop where they are:
+struct StepperHandle
+{
+	std::shared_ptr<Stepper> stepper;
+};
+
 #define PUSH_ENUM(L, name) lua_pushinteger((L), (name)); lua_rawsetfield((L), -2, #name)
 
 static int pi_wiringPiGpioDeviceGetFd(lua_State* L)
@@ -21,7 +48,12 @@ static int pi_pinMode(lua_State* L)
 	int pin = luaL_checkinteger(L, 1);
 	int mode = luaL_checkinteger(L, 2);
 
-	pinMode(pin, mode);
+	if (!Gpio::claim(pin))
+	{
+		luaL_error(L, "pin %d is owned by another actor", pin);
+	}
+
+	Gpio::pin_mode(pin, mode);
 
 	return 0;
 }
@@ -31,7 +63,12 @@ static int pi_pullUpDnControl(lua_State* L)
 	int pin = luaL_checkinteger(L, 1);
 	int pud = luaL_checkinteger(L, 2);
 
-	pullUpDnControl(pin, pud);
+	if (!Gpio::can_write(pin))
+	{
+		luaL_error(L, "pin %d is owned by another actor", pin);
+	}
+
+	Gpio::pull_up_dn(pin, pud);
 
 	return 0;
 }
@@ -40,7 +77,7 @@ static int pi_digitalRead(lua_State* L)
 {
 	int pin = luaL_checkinteger(L, 1);
 
-	lua_pushboolean(L, digitalRead(pin));
+	lua_pushboolean(L, Gpio::digital_read(pin));
 
 	return 1;
 }
@@ -60,7 +97,36 @@ static int pi_digitalWrite(lua_State* L)
 		state = lua_tointeger(L, 2) != 0;
 	}
 
-	digitalWrite(pin, state);
+	if (!Gpio::can_write(pin))
+	{
+		luaL_error(L, "pin %d is owned by another actor", pin);
+	}
+
+	Gpio::digital_write(pin, state);
+
+	return 0;
+}
+
+// Bit n of pins selects pin n, which is driven to bit n of values:
+static int pi_digitalWriteMask(lua_State* L)
+{
+	double pins_arg = luaL_checknumber(L, 1);
+	double values_arg = luaL_checknumber(L, 2);
+	luaL_argcheck(L, pins_arg >= 0 && pins_arg < 9007199254740992.0, 1, "expected a non-negative integer mask");
+	luaL_argcheck(L, values_arg >= 0 && values_arg < 9007199254740992.0, 2, "expected a non-negative integer mask");
+
+	uint64_t pins = static_cast<uint64_t>(pins_arg);
+	uint64_t values = static_cast<uint64_t>(values_arg);
+
+	for (int pin = 0; pin < 64; pin++)
+	{
+		if (((pins >> pin) & 1) && !Gpio::can_write(pin))
+		{
+			luaL_error(L, "pin %d is owned by another actor", pin);
+		}
+	}
+
+	Gpio::digital_write_mask(pins & values, pins & ~values);
 
 	return 0;
 }
@@ -70,7 +136,12 @@ static int pi_pwmWrite(lua_State* L)
 	int pin = luaL_checkinteger(L, 1);
 	int value = luaL_checkinteger(L, 2);
 
-	pwmWrite(pin, value);
+	if (!Gpio::can_write(pin))
+	{
+		luaL_error(L, "pin %d is owned by another actor", pin);
+	}
+
+	Gpio::pwm_write(pin, value);
 
 	return 0;
 }
@@ -79,7 +150,7 @@ static int pi_analogRead(lua_State* L)
 {
 	int pin = luaL_checkinteger(L, 1);
 
-	lua_pushinteger(L, analogRead(pin));
+	lua_pushinteger(L, Gpio::analog_read(pin));
 
 	return 1;
 }
@@ -89,35 +160,590 @@ static int pi_analogWrite(lua_State* L)
 	int pin = luaL_checkinteger(L, 1);
 	int value = luaL_checkinteger(L, 2);
 
-	analogWrite(pin, value);
+	if (!Gpio::can_write(pin))
+	{
+		luaL_error(L, "pin %d is owned by another actor", pin);
+	}
+
+	Gpio::analog_write(pin, value);
 
 	return 0;
 }
 
-static int pi_setup(lua_State* L)
+static int check_pin(lua_State* L, int idx)
 {
-	lua_pushboolean(L, wiringPiSetup() != -1);
+	int pin = luaL_checkinteger(L, idx);
+	luaL_argcheck(L, pin >= 0 && pin < Gpio::kMaxPins, idx, "pin out of range");
+	return pin;
+}
+
+// Pulses shorter than the optional glitch time, in microseconds, are ignored. Returns seconds:
+static double check_glitch(lua_State* L, int idx)
+{
+	double glitch = luaL_optnumber(L, idx, 0);
+	luaL_argcheck(L, glitch >= 0, idx, "expected a non-negative number of microseconds");
+	return glitch / 1e6;
+}
+
+static InputHandle* check_input(lua_State* L, int idx, const char* kind)
+{
+	return static_cast<InputHandle*>(luaL_checkudata(L, idx, kind));
+}
+
+// Pushes a handle for input and starts keeping it up to date:
+static void add_input(lua_State* L, std::shared_ptr<GpioInput> input, const char* kind)
+{
+	void* data = lua_newuserdatadtor(L, sizeof(InputHandle), [](void* ud) {
+		InputHandle* handle = static_cast<InputHandle*>(ud);
+		GpioInputs::remove(handle->input.get());
+		handle->~InputHandle();
+	});
+	new (data) InputHandle{input};
+
+	luaL_getmetatable(L, kind);
+	lua_setmetatable(L, -2);
+
+	GpioInputs::add(std::move(input), LuauTaskScheduler::get(L));
+}
+
+static void close_input(InputHandle* handle)
+{
+	GpioInputs::remove(handle->input.get());
+	handle->input->detach();
+}
+
+static int pi_counter(lua_State* L)
+{
+	int pin = check_pin(L, 1);
+	int edge = luaL_optinteger(L, 2, INT_EDGE_RISING);
+	luaL_argcheck(L, edge == INT_EDGE_RISING || edge == INT_EDGE_FALLING || edge == INT_EDGE_BOTH, 2,
+		"expected INT_EDGE_RISING, INT_EDGE_FALLING or INT_EDGE_BOTH");
+	double glitch = check_glitch(L, 3);
+
+	add_input(L, std::make_shared<GpioCounter>(pin, edge != INT_EDGE_FALLING, edge != INT_EDGE_RISING, glitch), kCounter);
+
 	return 1;
 }
 
-static int pi_setupSys(lua_State* L)
+static int pi_encoder(lua_State* L)
 {
-	lua_pushboolean(L, wiringPiSetupSys() != -1);
+	int pin_a = check_pin(L, 1);
+	int pin_b = check_pin(L, 2);
+	luaL_argcheck(L, pin_a != pin_b, 2, "expected a different pin to pin A");
+	double glitch = check_glitch(L, 3);
+
+	add_input(L, std::make_shared<GpioEncoder>(pin_a, pin_b, glitch), kEncoder);
+
 	return 1;
 }
 
-static int pi_setupGpio(lua_State* L)
+static int pi_debounced(lua_State* L)
+{
+	int pin = check_pin(L, 1);
+	double ms = luaL_checknumber(L, 2);
+	luaL_argcheck(L, ms >= 0, 2, "expected a non-negative number of milliseconds");
+
+	add_input(L, std::make_shared<GpioDebouncer>(pin, ms / 1000.0, LuauTaskScheduler::get(L)), kDebouncedInput);
+
+	return 1;
+}
+
+static int counter_reset(lua_State* L)
 {
-	lua_pushboolean(L, wiringPiSetupGpio() != -1);
+	GpioCounter* counter = static_cast<GpioCounter*>(check_input(L, 1, kCounter)->input.get());
+	lua_pushnumber(L, static_cast<double>(counter->reset()));
 	return 1;
 }
 
-static int pi_setupPhys(lua_State* L)
+static int counter_close(lua_State* L)
+{
+	close_input(check_input(L, 1, kCounter));
+	return 0;
+}
+
+static int counter_index(lua_State* L)
+{
+	GpioCounter* counter = static_cast<GpioCounter*>(check_input(L, 1, kCounter)->input.get());
+	const char* key = luaL_checkstring(L, 2);
+
+	if (strcmp(key, "count") == 0)
+	{
+		lua_pushnumber(L, static_cast<double>(counter->get_count()));
+	}
+	else if (strcmp(key, "pin") == 0)
+	{
+		lua_pushinteger(L, counter->get_pins()[0]);
+	}
+	else if (strcmp(key, "reset") == 0)
+	{
+		lua_pushcfunction(L, counter_reset, "reset");
+	}
+	else if (strcmp(key, "close") == 0)
+	{
+		lua_pushcfunction(L, counter_close, "close");
+	}
+	else
+	{
+		luaL_error(L, "%s is not a valid member of GpioCounter", key);
+	}
+
+	return 1;
+}
+
+static int encoder_reset(lua_State* L)
+{
+	GpioEncoder* encoder = static_cast<GpioEncoder*>(check_input(L, 1, kEncoder)->input.get());
+	lua_pushnumber(L, static_cast<double>(encoder->reset()));
+	return 1;
+}
+
+static int encoder_close(lua_State* L)
+{
+	close_input(check_input(L, 1, kEncoder));
+	return 0;
+}
+
+static int encoder_index(lua_State* L)
+{
+	GpioEncoder* encoder = static_cast<GpioEncoder*>(check_input(L, 1, kEncoder)->input.get());
+	const char* key = luaL_checkstring(L, 2);
+
+	if (strcmp(key, "position") == 0)
+	{
+		lua_pushnumber(L, static_cast<double>(encoder->get_position()));
+	}
+	else if (strcmp(key, "errors") == 0)
+	{
+		lua_pushnumber(L, static_cast<double>(encoder->get_errors()));
+	}
+	else if (strcmp(key, "reset") == 0)
+	{
+		lua_pushcfunction(L, encoder_reset, "reset");
+	}
+	else if (strcmp(key, "close") == 0)
+	{
+		lua_pushcfunction(L, encoder_close, "close");
+	}
+	else
+	{
+		luaL_error(L, "%s is not a valid member of GpioEncoder", key);
+	}
+
+	return 1;
+}
+
+static int debounced_wait(lua_State* L)
+{
+	GpioDebouncer* debouncer = static_cast<GpioDebouncer*>(check_input(L, 1, kDebouncedInput)->input.get());
+	return debouncer->wait(L);
+}
+
+static int debounced_close(lua_State* L)
+{
+	close_input(check_input(L, 1, kDebouncedInput));
+	return 0;
+}
+
+static int debounced_index(lua_State* L)
+{
+	GpioDebouncer* debouncer = static_cast<GpioDebouncer*>(check_input(L, 1, kDebouncedInput)->input.get());
+	const char* key = luaL_checkstring(L, 2);
+
+	if (strcmp(key, "value") == 0)
+	{
+		lua_pushboolean(L, debouncer->get_value());
+	}
+	else if (strcmp(key, "changes") == 0)
+	{
+		lua_pushnumber(L, static_cast<double>(debouncer->get_changes()));
+	}
+	else if (strcmp(key, "pin") == 0)
+	{
+		lua_pushinteger(L, debouncer->get_pins()[0]);
+	}
+	else if (strcmp(key, "wait") == 0)
+	{
+		lua_pushcfunction(L, debounced_wait, "wait");
+	}
+	else if (strcmp(key, "close") == 0)
+	{
+		lua_pushcfunction(L, debounced_close, "close");
+	}
+	else
+	{
+		luaL_error(L, "%s is not a valid member of DebouncedInput", key);
+	}
+
+	return 1;
+}
+
+static void create_input_metatable(lua_State* L, const char* kind, lua_CFunction index)
+{
+	luaL_newmetatable(L, kind);
+	lua_pushcfunction(L, index, "__index");
+	lua_setfield(L, -2, "__index");
+	lua_pushstring(L, "The metatable is locked");
+	lua_setfield(L, -2, "__metatable");
+	lua_pop(L, 1);
+}
+
+// Reads the optional { maxVelocity, acceleration, pulseUs, invertDir } table pi.stepper takes:
+static StepperOptions check_stepper_options(lua_State* L, int idx)
+{
+	StepperOptions options;
+	if (lua_isnoneornil(L, idx))
+	{
+		return options;
+	}
+	luaL_checktype(L, idx, LUA_TTABLE);
+
+	lua_rawgetfield(L, idx, "maxVelocity");
+	if (!lua_isnil(L, -1))
+	{
+		luaL_argcheck(L, lua_isnumber(L, -1) && lua_tonumber(L, -1) > 0, idx, "expected positive number for 'maxVelocity'");
+		options.max_velocity = lua_tonumber(L, -1);
+	}
+	lua_pop(L, 1);
+
+	lua_rawgetfield(L, idx, "acceleration");
+	if (!lua_isnil(L, -1))
+	{
+		luaL_argcheck(L, lua_isnumber(L, -1) && lua_tonumber(L, -1) > 0, idx, "expected positive number for 'acceleration'");
+		options.acceleration = lua_tonumber(L, -1);
+	}
+	lua_pop(L, 1);
+
+	lua_rawgetfield(L, idx, "pulseUs");
+	if (!lua_isnil(L, -1))
+	{
+		luaL_argcheck(L, lua_isnumber(L, -1) && lua_tonumber(L, -1) > 0, idx, "expected positive number for 'pulseUs'");
+		options.pulse_width = lua_tonumber(L, -1) / 1e6;
+	}
+	lua_pop(L, 1);
+
+	lua_rawgetfield(L, idx, "invertDir");
+	if (!lua_isnil(L, -1))
+	{
+		luaL_argcheck(L, lua_isboolean(L, -1), idx, "expected boolean for 'invertDir'");
+		options.invert_direction = lua_toboolean(L, -1);
+	}
+	lua_pop(L, 1);
+
+	return options;
+}
+
+static Stepper* check_stepper(lua_State* L, int idx)
+{
+	return static_cast<StepperHandle*>(luaL_checkudata(L, idx, kStepper))->stepper.get();
+}
+
+static int64_t check_position(lua_State* L, int idx)
+{
+	double position = luaL_checknumber(L, idx);
+	luaL_argcheck(L, position == std::floor(position) && std::fabs(position) < 9007199254740992.0, idx, "expected a whole number of steps");
+	return static_cast<int64_t>(position);
+}
+
+static double check_positive(lua_State* L, int idx, double def, const char* message)
 {
-	lua_pushboolean(L, wiringPiSetupPhys() != -1);
+	double value = luaL_optnumber(L, idx, def);
+	luaL_argcheck(L, value > 0, idx, message);
+	return value;
+}
+
+// Starts the moves and yields L until they have all finished. Resumes with false if any were stopped short:
+static int move_steppers(lua_State* L, const std::vector<std::pair<Stepper*, int64_t>>& moves, double max_velocity, double acceleration)
+{
+	if (!lua_isyieldable(L))
+	{
+		luaL_error(L, "attempt to move a stepper from a thread that cannot yield");
+	}
+
+	std::shared_ptr<MoveWaiter> waiter = std::make_shared<MoveWaiter>();
+	waiter->scheduler = LuauTaskScheduler::get(L);
+	lua_pushthread(L);
+	waiter->thread_ref = lua_ref(L, -1);
+	lua_pop(L, 1);
+
+	int started = MotionEngine::move(moves, max_velocity, acceleration, waiter);
+	if (started <= 0)
+	{
+		lua_unref(L, waiter->thread_ref);
+		if (started < 0)
+		{
+			luaL_error(L, "stepper is already moving");
+		}
+
+		lua_pushboolean(L, true);
+		return 1;
+	}
+
+	// Resumed by the motion engine once the last axis arrives. Counted so the script stays alive until then:
+	waiter->scheduler->begin_external_wait();
+	return lua_yield(L, 0);
+}
+
+static int pi_stepper(lua_State* L)
+{
+	int step_pin = check_pin(L, 1);
+	int dir_pin = check_pin(L, 2);
+	luaL_argcheck(L, step_pin != dir_pin, 2, "expected a different pin to the step pin");
+	StepperOptions options = check_stepper_options(L, 3);
+
+	// The motion engine times pulses against real time, which a virtual-time run has stopped following:
+	if (Gpio::uses_virtual_time())
+	{
+		luaL_error(L, "steppers are not available in virtual-time runs");
+	}
+
+	if (!Gpio::claim(step_pin))
+	{
+		luaL_error(L, "pin %d is owned by another actor", step_pin);
+	}
+	if (!Gpio::claim(dir_pin))
+	{
+		luaL_error(L, "pin %d is owned by another actor", dir_pin);
+	}
+	Gpio::pin_mode(step_pin, OUTPUT);
+	Gpio::pin_mode(dir_pin, OUTPUT);
+	Gpio::digital_write(step_pin, LOW);
+
+	std::shared_ptr<Stepper> stepper = std::make_shared<Stepper>(step_pin, dir_pin, options, LuauTaskScheduler::get(L));
+
+	void* data = lua_newuserdatadtor(L, sizeof(StepperHandle), [](void* ud) {
+		StepperHandle* handle = static_cast<StepperHandle*>(ud);
+		MotionEngine::remove(handle->stepper.get());
+		handle->~StepperHandle();
+	});
+	new (data) StepperHandle{stepper};
+
+	luaL_getmetatable(L, kStepper);
+	lua_setmetatable(L, -2);
+
+	MotionEngine::add(std::move(stepper));
+
+	return 1;
+}
+
+// Moves several steppers together, from a table of stepper to target position:
+static int pi_moveSteppers(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	std::vector<std::pair<Stepper*, int64_t>> moves;
+	double default_velocity = HUGE_VAL;
+	double default_acceleration = HUGE_VAL;
+
+	lua_pushnil(L);
+	while (lua_next(L, 1))
+	{
+		Stepper* stepper = check_stepper(L, -2);
+		moves.emplace_back(stepper, check_position(L, -1));
+
+		// Without explicit limits, the most limited stepper sets them:
+		default_velocity = std::min(default_velocity, stepper->get_options().max_velocity);
+		default_acceleration = std::min(default_acceleration, stepper->get_options().acceleration);
+
+		lua_pop(L, 1);
+	}
+
+	if (moves.empty())
+	{
+		lua_pushboolean(L, true);
+		return 1;
+	}
+
+	double max_velocity = check_positive(L, 2, default_velocity, "expected a positive number of steps per second");
+	double acceleration = check_positive(L, 3, default_acceleration, "expected a positive number of steps per second squared");
+
+	return move_steppers(L, moves, max_velocity, acceleration);
+}
+
+static int stepper_moveTo(lua_State* L)
+{
+	Stepper* stepper = check_stepper(L, 1);
+	int64_t position = check_position(L, 2);
+	double max_velocity = check_positive(L, 3, stepper->get_options().max_velocity, "expected a positive number of steps per second");
+	double acceleration = check_positive(L, 4, stepper->get_options().acceleration, "expected a positive number of steps per second squared");
+
+	return move_steppers(L, {{stepper, position}}, max_velocity, acceleration);
+}
+
+static int stepper_stop(lua_State* L)
+{
+	MotionEngine::stop(check_stepper(L, 1));
+	return 0;
+}
+
+static int stepper_getTiming(lua_State* L)
+{
+	StepperTiming timing = MotionEngine::get_timing(check_stepper(L, 1));
+
+	lua_createtable(L, 0, 3);
+	lua_pushnumber(L, static_cast<double>(timing.steps));
+	lua_rawsetfield(L, -2, "steps");
+	lua_pushnumber(L, timing.mean_late * 1e6);
+	lua_rawsetfield(L, -2, "meanLateUs");
+	lua_pushnumber(L, timing.max_late * 1e6);
+	lua_rawsetfield(L, -2, "maxLateUs");
+
 	return 1;
 }
 
+static int stepper_close(lua_State* L)
+{
+	MotionEngine::remove(check_stepper(L, 1));
+	return 0;
+}
+
+static int stepper_index(lua_State* L)
+{
+	Stepper* stepper = check_stepper(L, 1);
+	const char* key = luaL_checkstring(L, 2);
+
+	if (strcmp(key, "position") == 0)
+	{
+		lua_pushnumber(L, static_cast<double>(stepper->get_position()));
+	}
+	else if (strcmp(key, "target") == 0)
+	{
+		lua_pushnumber(L, static_cast<double>(MotionEngine::get_target(stepper)));
+	}
+	else if (strcmp(key, "moving") == 0)
+	{
+		lua_pushboolean(L, stepper->is_moving());
+	}
+	else if (strcmp(key, "moveTo") == 0)
+	{
+		lua_pushcfunction(L, stepper_moveTo, "moveTo");
+	}
+	else if (strcmp(key, "stop") == 0)
+	{
+		lua_pushcfunction(L, stepper_stop, "stop");
+	}
+	else if (strcmp(key, "getTiming") == 0)
+	{
+		lua_pushcfunction(L, stepper_getTiming, "getTiming");
+	}
+	else if (strcmp(key, "close") == 0)
+	{
+		lua_pushcfunction(L, stepper_close, "close");
+	}
+	else
+	{
+		luaL_error(L, "%s is not a valid member of Stepper", key);
+	}
+
+	return 1;
+}
+
+struct SetupOptions
+{
+	bool mmap = false;
+	MmapGpioOptions mmap_options;
+};
+
+// Reads the optional { backend, chip, device, offset } table the setup functions take:
+static SetupOptions check_setup_options(lua_State* L, int idx)
+{
+	SetupOptions options;
+	if (lua_isnoneornil(L, idx))
+	{
+		return options;
+	}
+	luaL_checktype(L, idx, LUA_TTABLE);
+
+	lua_rawgetfield(L, idx, "backend");
+	if (!lua_isnil(L, -1))
+	{
+		const char* backend = lua_tostring(L, -1);
+		bool valid = backend && (strcmp(backend, "wiringpi") == 0 || strcmp(backend, "mmap") == 0);
+		luaL_argcheck(L, valid, idx, "expected 'wiringpi' or 'mmap' for 'backend'");
+		options.mmap = strcmp(backend, "mmap") == 0;
+	}
+	lua_pop(L, 1);
+
+	lua_rawgetfield(L, idx, "chip");
+	if (!lua_isnil(L, -1))
+	{
+		static const char* const chips[] = {"auto", "bcm2835", "bcm2711", "rp1", nullptr};
+		options.mmap_options.chip = static_cast<GpioChip>(luaL_checkoption(L, -1, nullptr, chips));
+	}
+	lua_pop(L, 1);
+
+	lua_rawgetfield(L, idx, "device");
+	if (!lua_isnil(L, -1))
+	{
+		luaL_argcheck(L, lua_isstring(L, -1), idx, "expected string for 'device'");
+		options.mmap_options.device = lua_tostring(L, -1);
+	}
+	lua_pop(L, 1);
+
+	lua_rawgetfield(L, idx, "offset");
+	if (!lua_isnil(L, -1))
+	{
+		luaL_argcheck(L, lua_isnumber(L, -1) && lua_tonumber(L, -1) >= 0, idx, "expected non-negative number for 'offset'");
+		options.mmap_options.offset = static_cast<size_t>(lua_tonumber(L, -1));
+	}
+	lua_pop(L, 1);
+
+	return options;
+}
+
+static std::unique_ptr<GpioBackend> create_backend(const SetupOptions& options)
+{
+	if (!options.mmap)
+	{
+		return nullptr;
+	}
+
+	return std::unique_ptr<GpioBackend>(new MmapGpio(options.mmap_options));
+}
+
+// wiringPi setup can block for a while, so it runs on the worker pool when the caller can yield:
+static int setup_gpio(lua_State* L, GpioSetup mode)
+{
+	SetupOptions options = check_setup_options(L, 1);
+
+	if (!lua_isyieldable(L))
+	{
+		lua_pushboolean(L, Gpio::setup(mode, create_backend(options)));
+		return 1;
+	}
+
+	std::shared_ptr<bool> result = std::make_shared<bool>(false);
+	return LuauTaskScheduler::get(L)->offload(
+		L,
+		[mode, options, result]() {
+			*result = Gpio::setup(mode, create_backend(options));
+		},
+		[result](lua_State* T) {
+			lua_pushboolean(T, *result);
+			return 1;
+		}
+	);
+}
+
+static int pi_setup(lua_State* L)
+{
+	return setup_gpio(L, GpioSetup::WiringPi);
+}
+
+static int pi_setupSys(lua_State* L)
+{
+	return setup_gpio(L, GpioSetup::Sys);
+}
+
+static int pi_setupGpio(lua_State* L)
+{
+	return setup_gpio(L, GpioSetup::Gpio);
+}
+
+static int pi_setupPhys(lua_State* L)
+{
+	return setup_gpio(L, GpioSetup::Phys);
+}
+
 static int pi_onExit(lua_State* L)
 {
 	luaL_checktype(L, 1, LUA_TFUNCTION);
@@ -138,9 +764,15 @@ static const luaL_Reg pi_lib[] = {
 	{"pullUpDownControl", pi_pullUpDnControl},
 	{"digitalRead", pi_digitalRead},
 	{"digitalWrite", pi_digitalWrite},
+	{"digitalWriteMask", pi_digitalWriteMask},
 	{"pwmWrite", pi_pwmWrite},
 	{"analogRead", pi_analogRead},
 	{"analogWrite", pi_analogWrite},
+	{"counter", pi_counter},
+	{"encoder", pi_encoder},
+	{"debounced", pi_debounced},
+	{"stepper", pi_stepper},
+	{"moveSteppers", pi_moveSteppers},
 	{"setup", pi_setup},
 	{"setupSys", pi_setupSys},
 	{"setupGpio", pi_setupGpio},
@@ -236,6 +868,11 @@ void pilib_open(lua_State* L)
 
 	lua_pop(L, 1);
 
+	create_input_metatable(L, kCounter, counter_index);
+	create_input_metatable(L, kEncoder, encoder_index);
+	create_input_metatable(L, kDebouncedInput, debounced_index);
+	create_input_metatable(L, kStepper, stepper_index);
+
 	// OnExitCallbacks table:
 	lua_newtable(L);
 	lua_rawsetfield(L, LUA_REGISTRYINDEX, k_on_exit_callbacks);
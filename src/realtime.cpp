@@ -0,0 +1,186 @@
+#include "realtime.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace LuauPi;
+
+// Stack each timing thread touches up front, so its first deep call does not fault:
+static constexpr size_t kStackPrefault = 256 * 1024;
+
+// Heap touched and kept by the allocator, for the VMs to grow into without faulting. glibc gives
+// threads arenas of their own, so the main arena gets the most and each timing thread a share:
+static constexpr size_t kHeapPrefault = 16 * 1024 * 1024;
+static constexpr size_t kThreadHeapPrefault = 4 * 1024 * 1024;
+
+static constexpr size_t kPageSize = 4096;
+
+static bool enabled = false;
+static RealtimeOptions options;
+
+static std::atomic<bool> warned_lock(false);
+static std::atomic<bool> warned_policy(false);
+static std::atomic<bool> warned_affinity(false);
+
+static void warn_once(std::atomic<bool>& warned, const char* what, int error, const char* hint)
+{
+	if (!warned.exchange(true))
+	{
+		printf("[WARN] realtime: %s failed (%s), continuing without it. %s\n", what, strerror(error), hint);
+	}
+}
+
+__attribute__((noinline)) static void prefault_stack()
+{
+	volatile char stack[kStackPrefault];
+	for (size_t i = 0; i < sizeof(stack); i += kPageSize)
+	{
+		stack[i] = 0;
+	}
+}
+
+// Touches size bytes of the calling thread's malloc arena, which keeps them as trimming is off:
+static void prefault_heap(size_t size)
+{
+	char* heap = static_cast<char*>(malloc(size));
+	if (heap)
+	{
+		for (size_t i = 0; i < size; i += kPageSize)
+		{
+			heap[i] = 0;
+		}
+		free(heap);
+	}
+}
+
+void Realtime::enable(const RealtimeOptions& new_options)
+{
+	options = new_options;
+	enabled = true;
+
+	if (options.priority <= 0)
+	{
+		return;
+	}
+
+	if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+	{
+		warn_once(warned_lock, "mlockall", errno, "Raise the memlock limit or grant CAP_IPC_LOCK.");
+	}
+
+	// Freed memory stays in the heap instead of going back to the system, so the pre-faulted pages stay mapped:
+	mallopt(M_TRIM_THRESHOLD, -1);
+	mallopt(M_MMAP_MAX, 0);
+
+	prefault_heap(kHeapPrefault);
+}
+
+bool Realtime::is_enabled()
+{
+	return enabled;
+}
+
+static void configure_timing_thread(const std::vector<int>& cpus)
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	if (!cpus.empty())
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu : cpus)
+		{
+			CPU_SET(cpu, &set);
+		}
+
+		int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		if (error != 0)
+		{
+			warn_once(warned_affinity, "CPU pinning", error, "Check the --cpu and --engine-cpu lists against the CPUs online.");
+		}
+	}
+
+	if (options.priority > 0)
+	{
+		sched_param param{};
+		param.sched_priority = options.priority;
+
+		int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (error != 0)
+		{
+			warn_once(warned_policy, "SCHED_FIFO", error, "Run as root, or grant CAP_SYS_NICE or an rtprio limit.");
+		}
+
+		prefault_stack();
+		prefault_heap(kThreadHeapPrefault);
+	}
+}
+
+void Realtime::configure_thread()
+{
+	configure_timing_thread(options.cpus);
+}
+
+void Realtime::configure_engine_thread()
+{
+	configure_timing_thread(options.engine_cpus.empty() ? options.cpus : options.engine_cpus);
+}
+
+bool Realtime::engine_shares_cpu()
+{
+	return enabled && options.priority > 0 && options.engine_cpus.empty();
+}
+
+void Realtime::configure_background_thread()
+{
+	if (!enabled)
+	{
+		return;
+	}
+
+	// Threads inherit the policy of the thread that created them:
+	sched_param param{};
+	pthread_setschedparam(pthread_self(), SCHED_OTHER, &param);
+
+	if (!options.cpus.empty())
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		for (int cpu = 0; cpu < online; cpu++)
+		{
+			CPU_SET(cpu, &set);
+		}
+		for (int cpu : options.cpus)
+		{
+			CPU_CLR(cpu, &set);
+		}
+		for (int cpu : options.engine_cpus)
+		{
+			CPU_CLR(cpu, &set);
+		}
+
+		// With every CPU reserved, share them rather than leave the thread nowhere to run:
+		if (CPU_COUNT(&set) == 0)
+		{
+			for (int cpu = 0; cpu < online; cpu++)
+			{
+				CPU_SET(cpu, &set);
+			}
+		}
+
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+}
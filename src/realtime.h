@@ -0,0 +1,47 @@
+#ifndef LUAUPI_REALTIME_H
+#define LUAUPI_REALTIME_H
+
+#include <vector>
+
+namespace LuauPi
+{
+
+struct RealtimeOptions
+{
+	// SCHED_FIFO priority from 1 to 99, or 0 to keep the normal policy:
+	int priority = 0;
+
+	// CPUs scheduler threads are pinned to. Empty to leave affinity alone:
+	std::vector<int> cpus;
+
+	// CPUs engine threads are pinned to, apart from the scheduler threads. Empty to share theirs:
+	std::vector<int> engine_cpus;
+};
+
+// Process-wide real-time setup for --realtime and --cpu runs. Anything the system refuses,
+// usually for lack of privileges, is reported once and the run carries on without it.
+class Realtime
+{
+public:
+	static constexpr int kDefaultPriority = 50;
+
+	// Locks memory for the process and pre-faults the main malloc arena. Only valid before any actor starts:
+	static void enable(const RealtimeOptions& options);
+	static bool is_enabled();
+
+	// Moves the calling thread onto the real-time policy and chosen CPUs, and pre-faults its stack and
+	// its malloc arena. Called by actor scheduler threads:
+	static void configure_thread();
+	// As configure_thread, for engine threads (the motion engine, the input poller), which go on the
+	// engine CPUs when there are any:
+	static void configure_engine_thread();
+	// Whether engine threads may share a CPU with scheduler threads at the same FIFO priority. An engine
+	// spinning there keeps the scheduler from running until it stops, so it must step aside as it spins:
+	static bool engine_shares_cpu();
+	// Keeps threads doing blocking work, such as the worker pool, on the normal policy and off the chosen CPUs:
+	static void configure_background_thread();
+};
+
+}
+
+#endif
@@ -0,0 +1,76 @@
+#include "requirelib.h"
+
+#include <lualib.h>
+#include <string>
+
+#include "script.h"
+
+// Registry table of module results, keyed by module name:
+static constexpr const char* kModules = "Modules";
+
+// Stored in place of a module's result while it runs, to catch cycles:
+static int loading_marker;
+
+static int require(lua_State* L)
+{
+	const char* path = luaL_checkstring(L, 1);
+
+	// Paths are relative to the chunk require was called from:
+	lua_Debug ar;
+	std::string from;
+	if (lua_getinfo(L, 1, "s", &ar) && ar.source && ar.source[0] == '=')
+	{
+		from = ar.source + 1;
+	}
+
+	std::string name;
+	if (!LuauScript::resolve_module(from, path, &name))
+	{
+		luaL_error(L, "cannot find module '%s'", path);
+	}
+
+	lua_rawgetfield(L, LUA_REGISTRYINDEX, kModules);
+	lua_rawgetfield(L, -1, name.c_str());
+	if (lua_touserdata(L, -1) == &loading_marker)
+	{
+		luaL_error(L, "cyclic require of '%s'", name.c_str());
+	}
+	if (!lua_isnil(L, -1))
+	{
+		return 1;
+	}
+	lua_pop(L, 1);
+
+	lua_pushlightuserdata(L, &loading_marker);
+	lua_rawsetfield(L, -2, name.c_str());
+
+	// Bytecode is only loaded the first time a module is required:
+	bool loaded = LuauScript::load(L, name);
+	if (!loaded || lua_pcall(L, 0, 1, 0) != LUA_OK)
+	{
+		lua_pushnil(L);
+		lua_rawsetfield(L, -3, name.c_str());
+		lua_error(L);
+	}
+
+	if (lua_isnil(L, -1))
+	{
+		lua_pushnil(L);
+		lua_rawsetfield(L, -3, name.c_str());
+		luaL_error(L, "module '%s' must return a value", name.c_str());
+	}
+
+	lua_pushvalue(L, -1);
+	lua_rawsetfield(L, -3, name.c_str());
+
+	return 1;
+}
+
+void require_lib_open(lua_State* L)
+{
+	lua_newtable(L);
+	lua_rawsetfield(L, LUA_REGISTRYINDEX, kModules);
+
+	lua_pushcfunction(L, require, "require");
+	lua_setglobal(L, "require");
+}
@@ -0,0 +1,8 @@
+#ifndef REQUIRELIB_H
+#define REQUIRELIB_H
+
+#include <lua.h>
+
+void require_lib_open(lua_State* L);
+
+#endif
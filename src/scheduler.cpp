@@ -6,23 +6,29 @@
 #include <cstdio>
 #include <algorithm>
 #include <exception>
+#include <cmath>
+#include <sys/epoll.h>
+#include <unistd.h>
 
 #include "threaddata.h"
+#include "tasksync.h"
+#include "traceback.h"
+
+using namespace LuauPi;
 
 static constexpr const char* kTaskScheduler = "TaskScheduler";
 static constexpr int kMaxDeferEntryDepth = 40;
+static constexpr size_t kMaxPooledThreads = 128;
+static constexpr unsigned int kBudgetCheckInterval = 64;
+// Due low priority tasks run each tick however long the higher lanes took:
+static constexpr int kMinLowPriorityTasks = 1;
+static constexpr int kMaxIoEvents = 64;
 
 static std::string get_traceback(lua_State* L, int level)
 {
 	std::string s = "Begin Traceback\n";
 
-	lua_Debug ar;
-	for (int i = level; lua_getinfo(L, i, "sln", &ar); i++)
-	{
-		if (strcmp(ar.what, "C") == 0)
-		{
-			continue;
-		}
+	for_each_frame(L, level, [&s](const lua_Debug& ar) {
 		if (ar.source) {
 			s += "  ";
 			s += ar.short_src;
@@ -45,23 +51,72 @@ static std::string get_traceback(lua_State* L, int level)
 			s += ar.name;
 		}
 		s += '\n';
-	}
+	});
 	s += "End Traceback\n";
 	return s;
 }
 
+// Heap ordering: earliest deadline first, then first scheduled first:
+static bool runs_later(const ScheduledTask* a, const ScheduledTask* b)
+{
+	if (a->resume_at != b->resume_at)
+	{
+		return a->resume_at > b->resume_at;
+	}
+	return a->sequence > b->sequence;
+}
+
+static bool is_cancelled(const ScheduledTask* scheduled)
+{
+	return scheduled->erase || (scheduled->periodic && !scheduled->periodic->active);
+}
+
+static void interrupt(lua_State* L, int gc)
+{
+	if (gc >= 0)
+	{
+		return;
+	}
+
+	LuauTaskScheduler* scheduler = static_cast<LuauTaskScheduler*>(lua_callbacks(L)->userdata);
+	scheduler->check_budget(L);
+}
+
 LuauTaskScheduler* LuauTaskScheduler::create(lua_State* L)
 {
 	LuauTaskScheduler* scheduler = static_cast<LuauTaskScheduler*>(lua_newuserdata(L, sizeof(LuauTaskScheduler)));
 	scheduler->state = L;
-	scheduler->scheduled_tasks = new std::vector<ScheduledTask*>();
+	for (int i = 0; i < kPriorityCount; i++)
+	{
+		scheduler->scheduled_tasks[i] = new std::vector<ScheduledTask*>();
+	}
 	scheduler->scheduled_tasks_temp = new std::vector<ScheduledTask*>();
 	scheduler->deferred_tasks = new std::vector<ScheduledTask*>();
 	scheduler->deferred_tasks_temp = new std::vector<ScheduledTask*>();
+	scheduler->thread_pool = new std::vector<int>();
 	scheduler->updating = false;
-	scheduler->time = 0;
+	scheduler->purge_pending = false;
+	scheduler->time = lua_clock();
+	scheduler->sequence = 0;
+	scheduler->low_priority_budget = 0;
+	scheduler->resume_budget = 0;
+	scheduler->budget_policy = BudgetPolicy::Yield;
+	scheduler->slice_deadline = 0;
+	scheduler->resumed_thread = nullptr;
+	scheduler->interrupt_count = 0;
+	scheduler->waker = new Waker();
+	scheduler->wake_reset = false;
+	scheduler->job_sink = new std::shared_ptr<JobSink>(std::make_shared<JobSink>(scheduler->waker));
+	scheduler->pending_jobs = 0;
+	scheduler->external_waits = 0;
+	scheduler->posted = new MpscQueue<PostedEvent>();
+	scheduler->io_fd = epoll_create1(EPOLL_CLOEXEC);
+	scheduler->io_watches = new std::unordered_map<int, IoWatch>();
+	scheduler->poll_fd = -1;
 	lua_rawsetfield(L, LUA_REGISTRYINDEX, kTaskScheduler);
 
+	lua_callbacks(L)->userdata = scheduler;
+
 	return scheduler;
 }
 
@@ -77,10 +132,55 @@ LuauTaskScheduler* LuauTaskScheduler::get(lua_State* L)
 
 void LuauTaskScheduler::close()
 {
-	for (auto it = scheduled_tasks->begin(); it != scheduled_tasks->end(); ++it)
+	// Jobs still running are left to finish on their own, and freed by the worker that ran them:
 	{
-		ScheduledTask* scheduled = *it;
-		delete scheduled;
+		std::lock_guard<std::mutex> lock((*job_sink)->mutex);
+		(*job_sink)->orphaned = true;
+	}
+
+	WorkerJob* job = (*job_sink)->done.take_all();
+	while (job)
+	{
+		WorkerJob* next = job->next;
+		delete job;
+		job = next;
+	}
+	pending_jobs = 0;
+	delete job_sink;
+
+	PostedEvent* event = posted->take_all();
+	while (event)
+	{
+		PostedEvent* next = event->next;
+		lua_unref(state, event->ref);
+		delete event;
+		event = next;
+	}
+	delete posted;
+	delete waker;
+
+	for (auto it = io_watches->begin(); it != io_watches->end(); ++it)
+	{
+		for (int i = 0; i < kIoDirections; i++)
+		{
+			lua_unref(state, it->second.thread_refs[i]);
+		}
+	}
+	delete io_watches;
+	::close(io_fd);
+	if (poll_fd >= 0)
+	{
+		::close(poll_fd);
+	}
+
+	for (int i = 0; i < kPriorityCount; i++)
+	{
+		for (auto it = scheduled_tasks[i]->begin(); it != scheduled_tasks[i]->end(); ++it)
+		{
+			ScheduledTask* scheduled = *it;
+			delete scheduled;
+		}
+		delete scheduled_tasks[i];
 	}
 	for (auto it = scheduled_tasks_temp->begin(); it != scheduled_tasks_temp->end(); ++it)
 	{
@@ -97,23 +197,82 @@ void LuauTaskScheduler::close()
 		ScheduledTask* scheduled = *it;
 		delete scheduled;
 	}
-	delete scheduled_tasks;
+	for (auto it = thread_pool->begin(); it != thread_pool->end(); ++it)
+	{
+		lua_unref(state, *it);
+	}
 	delete scheduled_tasks_temp;
 	delete deferred_tasks;
 	delete deferred_tasks_temp;
+	delete thread_pool;
 }
 
-lua_State* LuauTaskScheduler::create_thread(lua_State* L)
+lua_State* LuauTaskScheduler::create_thread(lua_State* L, bool recyclable)
 {
-	lua_State* T = lua_newthread(L);
-	luaL_sandboxthread(T);
+	lua_State* T;
+
+	if (recyclable && !thread_pool->empty())
+	{
+		// Reuse a thread that previously finished cleanly:
+		int ref = thread_pool->back();
+		thread_pool->pop_back();
+
+		lua_getref(L, ref);
+		lua_unref(L, ref);
+		T = lua_tothread(L, -1);
+	}
+	else
+	{
+		T = lua_newthread(L);
+		luaL_sandboxthread(T);
+	}
+
+	ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(T));
+	ThreadData* parent_td = static_cast<ThreadData*>(lua_getthreaddata(L));
+	td->recyclable = recyclable;
+	td->priority = parent_td ? parent_td->priority : kPriorityNormal;
 
 	return T;
 }
 
+void LuauTaskScheduler::release_thread(lua_State* T)
+{
+	ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(T));
+	if (!td || !td->recyclable || thread_pool->size() >= kMaxPooledThreads)
+	{
+		return;
+	}
+
+	lua_resetthread(T);
+	td->defer_depth = 0;
+	td->budget_warned = false;
+	td->pending_wait = nullptr;
+	td->pending_fd = -1;
+
+	lua_pushthread(T);
+	thread_pool->push_back(lua_ref(T, -1));
+	lua_pop(T, 1);
+}
+
 int LuauTaskScheduler::spawn(lua_State* T, lua_State* from, int n_args, bool can_yield)
 {
-	int status = lua_resume(T, from, n_args);
+	return resume(T, from, n_args, can_yield, false);
+}
+
+// Resumes T, or raises the error on top of its stack when error is set:
+int LuauTaskScheduler::resume(lua_State* T, lua_State* from, int n_args, bool can_yield, bool error)
+{
+	// Nested resumes (e.g. task.spawn from within a task) share the slice of the outermost one:
+	lua_State* outer_thread = resumed_thread;
+	if (resume_budget > 0 && outer_thread == nullptr)
+	{
+		slice_deadline = lua_clock() + resume_budget;
+	}
+	resumed_thread = T;
+
+	int status = error ? lua_resumeerror(T, from) : lua_resume(T, from, n_args);
+
+	resumed_thread = outer_thread;
 
 	if (status != LUA_OK && (status != LUA_YIELD || !can_yield))
 	{
@@ -124,30 +283,39 @@ int LuauTaskScheduler::spawn(lua_State* T, lua_State* from, int n_args, bool can
 		}
 		else
 		{
-			std::string err;
+			printf("%s\n", describe_error(T).c_str());
+		}
+	}
+	else if (status == LUA_OK)
+	{
+		release_thread(T);
+	}
 
-			if (const char* str = lua_tostring(T, -1))
-			{
-				err += str;
-			}
-			else
-			{
-				err += "Unknown error";
-			}
+	return status;
+}
 
-			err += '\n';
-			err += get_traceback(T, 1);
+std::string LuauTaskScheduler::describe_error(lua_State* T)
+{
+	std::string err;
 
-			printf("%s\n", err.c_str());
-		}
+	if (const char* str = lua_tostring(T, -1))
+	{
+		err += str;
+	}
+	else
+	{
+		err += "Unknown error";
 	}
 
-	return status;
+	err += '\n';
+	err += get_traceback(T, 1);
+
+	return err;
 }
 
 void LuauTaskScheduler::delay(lua_State* T, lua_State* from, int n_args, int thread_ref, double delay_time, bool yield_delta)
 {
-	(void)T;
+	ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(T));
 
 	ScheduledTask* scheduled = new ScheduledTask();
 	scheduled->n_args = n_args;
@@ -155,20 +323,128 @@ void LuauTaskScheduler::delay(lua_State* T, lua_State* from, int n_args, int thr
 	scheduled->thread_ref = thread_ref;
 	scheduled->erase = false;
 	scheduled->start = time;
+	scheduled->priority = td ? td->priority : kPriorityNormal;
 	scheduled->yield_delta = yield_delta;
+	scheduled->periodic = nullptr;
 
 	lua_pushthread(from);
 	scheduled->from_thread_ref = lua_ref(from, -1);
 	lua_pop(from, 1);
 
-	auto tasks = updating ? scheduled_tasks_temp : scheduled_tasks;
+	schedule(scheduled);
+}
+
+void LuauTaskScheduler::schedule(ScheduledTask* scheduled)
+{
+	scheduled->sequence = sequence++;
+
+	if (updating)
+	{
+		scheduled_tasks_temp->push_back(scheduled);
+		return;
+	}
+
+	std::vector<ScheduledTask*>* tasks = scheduled_tasks[scheduled->priority];
 	tasks->push_back(scheduled);
+	std::push_heap(tasks->begin(), tasks->end(), runs_later);
 }
 
-bool LuauTaskScheduler::defer(lua_State* T, lua_State* from, int n_args, int thread_ref)
+void LuauTaskScheduler::release_task(ScheduledTask* scheduled)
+{
+	lua_unref(state, scheduled->thread_ref);
+	lua_unref(state, scheduled->from_thread_ref);
+	delete scheduled;
+}
+
+void LuauTaskScheduler::purge()
+{
+	purge_pending = false;
+
+	for (int i = 0; i < kPriorityCount; i++)
+	{
+		std::vector<ScheduledTask*>* tasks = scheduled_tasks[i];
+		auto end = std::remove_if(tasks->begin(), tasks->end(), [this](ScheduledTask* scheduled) {
+			if (!is_cancelled(scheduled))
+			{
+				return false;
+			}
+			release_task(scheduled);
+			return true;
+		});
+
+		if (end != tasks->end())
+		{
+			tasks->erase(end, tasks->end());
+			std::make_heap(tasks->begin(), tasks->end(), runs_later);
+		}
+	}
+}
+
+void LuauTaskScheduler::every(PeriodicTask* periodic, int args_ref, int n_args)
+{
+	// Deadlines are always computed as origin + period * interval, so neither
+	// the run time of the callback nor tick lateness accumulates as drift:
+	periodic->origin = time;
+	periodic->period = 1;
+
+	ScheduledTask* scheduled = new ScheduledTask();
+	scheduled->n_args = n_args;
+	scheduled->resume_at = periodic->origin + periodic->interval;
+	scheduled->thread_ref = args_ref;
+	scheduled->from_thread_ref = LUA_NOREF;
+	scheduled->erase = false;
+	scheduled->start = time;
+	scheduled->priority = periodic->priority;
+	scheduled->yield_delta = false;
+	scheduled->periodic = periodic;
+
+	schedule(scheduled);
+}
+
+void LuauTaskScheduler::run_periodic(ScheduledTask* scheduled, double now)
 {
-	(void)T;
+	PeriodicTask* periodic = scheduled->periodic;
 
+	// Args table is laid out as { handle, fn, args... }:
+	lua_getref(state, scheduled->thread_ref);
+	lua_State* T = create_thread(state, true);
+	for (int i = 2; i <= scheduled->n_args + 2; i++)
+	{
+		lua_rawgeti(state, -2, i);
+		lua_xmove(state, T, 1);
+	}
+
+	spawn(T, nullptr, scheduled->n_args);
+	lua_pop(state, 2);
+
+	// Re-arm from the previous absolute deadline:
+	periodic->period++;
+	double next = periodic->origin + periodic->period * periodic->interval;
+
+	if (!periodic->catch_up && next <= now)
+	{
+		// Skip every period whose deadline has already passed:
+		uint64_t period = static_cast<uint64_t>((now - periodic->origin) / periodic->interval) + 1;
+		if (period > periodic->period)
+		{
+			periodic->missed += period - periodic->period;
+			periodic->period = period;
+		}
+
+		next = periodic->origin + periodic->period * periodic->interval;
+		while (next <= now)
+		{
+			periodic->missed++;
+			periodic->period++;
+			next = periodic->origin + periodic->period * periodic->interval;
+		}
+	}
+
+	scheduled->resume_at = next;
+}
+
+bool LuauTaskScheduler::defer(lua_State* T, lua_State* from, int n_args, int thread_ref)
+{
 	size_t defer_depth = 1;
 	if (from)
 	{
@@ -184,11 +460,17 @@ bool LuauTaskScheduler::defer(lua_State* T, lua_State* from, int n_args, int thr
 		return false;
 	}
 
+	if (ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(T)))
+	{
+		td->defer_depth = defer_depth;
+	}
+
 	ScheduledTask* scheduled = new ScheduledTask();
 	scheduled->n_args = n_args;
 	scheduled->resume_at = 0;
 	scheduled->thread_ref = thread_ref;
 	scheduled->erase = false;
+	scheduled->periodic = nullptr;
 
 	lua_pushthread(from);
 	scheduled->from_thread_ref = lua_ref(from, -1);
@@ -200,41 +482,139 @@ bool LuauTaskScheduler::defer(lua_State* T, lua_State* from, int n_args, int thr
 	return true;
 }
 
+void LuauTaskScheduler::set_resume_budget(double budget, BudgetPolicy policy)
+{
+	resume_budget = budget;
+	budget_policy = policy;
+
+	lua_callbacks(state)->interrupt = budget > 0 ? interrupt : nullptr;
+}
+
+void LuauTaskScheduler::check_budget(lua_State* L)
+{
+	if (resumed_thread == nullptr || ++interrupt_count % kBudgetCheckInterval != 0 || lua_clock() < slice_deadline)
+	{
+		return;
+	}
+
+	if (budget_policy == BudgetPolicy::Error)
+	{
+		luaL_error(L, "task exceeded resume budget of %.3f ms", resume_budget * 1000.0);
+	}
+
+	// Only the thread resumed by the scheduler can be preempted. Yielding a
+	// coroutine resumed from Luau would hand control back to its resumer:
+	if (L != resumed_thread || !lua_isyieldable(L))
+	{
+		return;
+	}
+
+	ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(L));
+	if (td && !td->budget_warned)
+	{
+		td->budget_warned = true;
+
+		printf("[WARN] task exceeded resume budget of %.3f ms and was preempted\n%s\n", resume_budget * 1000.0, get_traceback(L, 0).c_str());
+	}
+
+	// Resume where it left off on the next tick, behind every other due task:
+	lua_pushthread(L);
+	int thread_ref = lua_ref(L, -1);
+	lua_pop(L, 1);
+
+	delay(L, L, 0, thread_ref, 0, false);
+
+	lua_yield(L, 0);
+}
+
+void LuauTaskScheduler::wake(lua_State* T, lua_State* from, int n_args)
+{
+	if (!from)
+	{
+		from = state;
+	}
+
+	lua_pushthread(T);
+	int thread_ref = lua_ref(T, -1);
+	lua_pop(T, 1);
+
+	// Fall back to the next tick once the defer depth is exhausted, e.g. for
+	// two tasks passing values back and forth through a channel:
+	if (!defer(T, from, n_args, thread_ref))
+	{
+		delay(T, from, n_args, thread_ref, 0, false);
+	}
+}
+
 void LuauTaskScheduler::cancel(lua_State* T)
 {
 	lua_resetthread(T);
 
-	auto it = scheduled_tasks->begin();
-	while (it != scheduled_tasks->end())
+	ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(T));
+	if (td)
 	{
-		ScheduledTask* scheduled = *it;
+		td->pending_wait = nullptr;
+		td->pending_fd = -1;
+	}
 
-		lua_getref(state, scheduled->thread_ref);
-		lua_State* thread = lua_tothread(state, -1);
-		lua_pop(state, 1);
+	// Scheduled tasks are only marked here, and removed from their heaps by purge:
+	auto cancel_scheduled = [this, T](std::vector<ScheduledTask*>* tasks) {
+		for (auto it = tasks->begin(); it != tasks->end(); ++it)
+		{
+			ScheduledTask* scheduled = *it;
 
-		lua_getref(state, scheduled->from_thread_ref);
-		lua_State* from = lua_tothread(state, -1);
-		lua_pop(state, 1);
+			lua_getref(state, scheduled->thread_ref);
+			lua_State* thread = lua_tothread(state, -1);
+			lua_pop(state, 1);
 
-		if (T == thread || T == from)
-		{
-			if (updating)
+			lua_getref(state, scheduled->from_thread_ref);
+			lua_State* from = lua_tothread(state, -1);
+			lua_pop(state, 1);
+
+			if (T == thread || T == from)
 			{
 				scheduled->erase = true;
-				++it;
-			}
-			else
-			{
-				it = scheduled_tasks->erase(it);
-				delete scheduled;
+				purge_pending = true;
 			}
 		}
-		else
+	};
+	for (int i = 0; i < kPriorityCount; i++)
+	{
+		cancel_scheduled(scheduled_tasks[i]);
+	}
+	cancel_scheduled(scheduled_tasks_temp);
+	// Tasks deferred during this update wait here until the deferred pass merges them, and are skipped then:
+	cancel_scheduled(deferred_tasks_temp);
+
+	// Give up any I/O the thread was waiting on:
+	std::vector<int> watched_fds;
+	for (auto it = io_watches->begin(); it != io_watches->end(); ++it)
+	{
+		for (int i = 0; i < kIoDirections; i++)
 		{
-			++it;
+			int ref = it->second.thread_refs[i];
+			if (ref == LUA_NOREF)
+			{
+				continue;
+			}
+
+			lua_getref(state, ref);
+			lua_State* thread = lua_tothread(state, -1);
+			lua_pop(state, 1);
+
+			if (thread == T)
+			{
+				lua_unref(state, ref);
+				it->second.thread_refs[i] = LUA_NOREF;
+				it->second.ready[i] = nullptr;
+				watched_fds.push_back(it->first);
+			}
 		}
 	}
+	for (auto it = watched_fds.begin(); it != watched_fds.end(); ++it)
+	{
+		update_io_interest(*it);
+	}
 
 	auto it_deferred = deferred_tasks->begin();
 	while (it_deferred != deferred_tasks->end())
@@ -258,6 +638,8 @@ void LuauTaskScheduler::cancel(lua_State* T)
 			}
 			else
 			{
+				lua_unref(state, scheduled->thread_ref);
+				lua_unref(state, scheduled->from_thread_ref);
 				it_deferred = deferred_tasks->erase(it_deferred);
 				delete scheduled;
 			}
@@ -269,18 +651,474 @@ void LuauTaskScheduler::cancel(lua_State* T)
 	}
 }
 
+void LuauTaskScheduler::cancel(PeriodicTask* periodic)
+{
+	periodic->active = false;
+	purge_pending = true;
+}
+
+int LuauTaskScheduler::offload(lua_State* L, std::function<void()> work, std::function<int(lua_State* T)> complete)
+{
+	if (!lua_isyieldable(L))
+	{
+		luaL_error(L, "attempt to offload work from a thread that cannot yield");
+	}
+
+	WorkerJob* job = new WorkerJob();
+	job->work = std::move(work);
+	job->complete = std::move(complete);
+	job->sink = *job_sink;
+	job->next = nullptr;
+
+	lua_pushthread(L);
+	job->thread_ref = lua_ref(L, -1);
+	lua_pop(L, 1);
+
+	ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(L));
+	td->pending_wait = job;
+
+	pending_jobs++;
+	WorkerPool::get().submit(job);
+
+	return lua_yield(L, 0);
+}
+
+void LuauTaskScheduler::run_completions()
+{
+	WorkerJob* job = (*job_sink)->done.take_all();
+	while (job)
+	{
+		WorkerJob* next = job->next;
+		pending_jobs--;
+
+		lua_getref(state, job->thread_ref);
+		lua_State* T = lua_tothread(state, -1);
+		lua_pop(state, 1);
+
+		// Dropped if the task was cancelled while the work ran:
+		ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(T));
+		if (td && td->pending_wait == job && lua_status(T) == LUA_YIELD)
+		{
+			td->pending_wait = nullptr;
+
+			int n = job->complete(T);
+			if (n < 0)
+			{
+				resume(T, nullptr, 0, true, true);
+			}
+			else
+			{
+				resume(T, nullptr, n, true, false);
+			}
+		}
+
+		lua_unref(state, job->thread_ref);
+		delete job;
+
+		job = next;
+	}
+}
+
+void LuauTaskScheduler::run_posted()
+{
+	PostedEvent* event = posted->take_all();
+	while (event)
+	{
+		PostedEvent* next = event->next;
+
+		if (event->kind == PostKind::Resume)
+		{
+			// Counted until it is taken off the queue here, so update() never reports no work while it is in flight:
+			if (event->ends_external_wait)
+			{
+				external_waits--;
+			}
+
+			lua_getref(state, event->ref);
+			lua_State* T = lua_tothread(state, -1);
+			lua_pop(state, 1);
+
+			if (T && lua_status(T) == LUA_YIELD)
+			{
+				int n = event->values.unpack(T);
+				resume(T, nullptr, n, true, false);
+			}
+
+			lua_unref(state, event->ref);
+		}
+		else
+		{
+			lua_pushcfunction(state, task_signal_fire, "fire");
+			lua_getref(state, event->ref);
+			int n = event->values.unpack(state);
+			if (lua_pcall(state, n + 1, 0, 0) != LUA_OK)
+			{
+				printf("%s\n", lua_tostring(state, -1));
+				lua_pop(state, 1);
+			}
+		}
+
+		delete event;
+		event = next;
+	}
+}
+
+int LuauTaskScheduler::wait_io(lua_State* L, int fd, IoDirection direction, std::function<int(lua_State* T)> ready)
+{
+	if (!lua_isyieldable(L))
+	{
+		luaL_error(L, "attempt to wait for I/O from a thread that cannot yield");
+	}
+
+	auto it = io_watches->find(fd);
+	if (it == io_watches->end())
+	{
+		IoWatch watch;
+		watch.thread_refs[kIoRead] = LUA_NOREF;
+		watch.thread_refs[kIoWrite] = LUA_NOREF;
+		watch.registered_events = 0;
+		it = io_watches->emplace(fd, std::move(watch)).first;
+	}
+
+	IoWatch& watch = it->second;
+	if (watch.thread_refs[direction] != LUA_NOREF)
+	{
+		luaL_error(L, "another task is already %s this socket", direction == kIoRead ? "reading from" : "writing to");
+	}
+
+	lua_pushthread(L);
+	watch.thread_refs[direction] = lua_ref(L, -1);
+	lua_pop(L, 1);
+	watch.ready[direction] = std::move(ready);
+
+	ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(L));
+	td->pending_fd = fd;
+	td->pending_direction = direction;
+
+	update_io_interest(fd);
+
+	return lua_yield(L, 0);
+}
+
+void LuauTaskScheduler::unwatch_io(int fd)
+{
+	auto it = io_watches->find(fd);
+	if (it == io_watches->end())
+	{
+		return;
+	}
+
+	IoWatch watch = std::move(it->second);
+	io_watches->erase(it);
+	if (watch.registered_events != 0)
+	{
+		epoll_ctl(io_fd, EPOLL_CTL_DEL, fd, nullptr);
+	}
+
+	for (int i = 0; i < kIoDirections; i++)
+	{
+		int ref = watch.thread_refs[i];
+		if (ref == LUA_NOREF)
+		{
+			continue;
+		}
+
+		lua_getref(state, ref);
+		lua_State* T = lua_tothread(state, -1);
+		lua_pop(state, 1);
+
+		ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(T));
+		if (td && td->pending_fd == fd && td->pending_direction == i && lua_status(T) == LUA_YIELD)
+		{
+			td->pending_fd = -1;
+			lua_pushstring(T, "socket closed");
+			resume(T, nullptr, 0, true, true);
+		}
+
+		lua_unref(state, ref);
+	}
+}
+
+void LuauTaskScheduler::update_io_interest(int fd)
+{
+	auto it = io_watches->find(fd);
+	if (it == io_watches->end())
+	{
+		return;
+	}
+
+	IoWatch& watch = it->second;
+	uint32_t events = 0;
+	if (watch.thread_refs[kIoRead] != LUA_NOREF)
+	{
+		events |= EPOLLIN;
+	}
+	if (watch.thread_refs[kIoWrite] != LUA_NOREF)
+	{
+		events |= EPOLLOUT;
+	}
+
+	if (events == watch.registered_events)
+	{
+		return;
+	}
+
+	epoll_event ev{};
+	ev.events = events;
+	ev.data.fd = fd;
+	if (events == 0)
+	{
+		epoll_ctl(io_fd, EPOLL_CTL_DEL, fd, nullptr);
+		io_watches->erase(it);
+		return;
+	}
+
+	epoll_ctl(io_fd, watch.registered_events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+	watch.registered_events = events;
+}
+
+void LuauTaskScheduler::run_io_waiter(int fd, IoDirection direction)
+{
+	auto it = io_watches->find(fd);
+	if (it == io_watches->end() || it->second.thread_refs[direction] == LUA_NOREF)
+	{
+		return;
+	}
+
+	IoWatch& watch = it->second;
+	int ref = watch.thread_refs[direction];
+
+	lua_getref(state, ref);
+	lua_State* T = lua_tothread(state, -1);
+	lua_pop(state, 1);
+
+	ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(T));
+	bool waiting = td && td->pending_fd == fd && td->pending_direction == direction && lua_status(T) == LUA_YIELD;
+
+	int n = 0;
+	if (waiting)
+	{
+		n = watch.ready[direction](T);
+		if (n == kIoRetry)
+		{
+			// Spurious wake-up; stay parked:
+			return;
+		}
+	}
+
+	// The watch may be rehashed away once T runs, so it is cleared first:
+	watch.thread_refs[direction] = LUA_NOREF;
+	watch.ready[direction] = nullptr;
+
+	if (waiting)
+	{
+		td->pending_fd = -1;
+		resume(T, nullptr, n < 0 ? 0 : n, true, n < 0);
+	}
+
+	lua_unref(state, ref);
+}
+
+void LuauTaskScheduler::run_io()
+{
+	if (io_watches->empty())
+	{
+		return;
+	}
+
+	epoll_event events[kMaxIoEvents];
+	int n = epoll_wait(io_fd, events, kMaxIoEvents, 0);
+	for (int i = 0; i < n; i++)
+	{
+		int fd = events[i].data.fd;
+		uint32_t ev = events[i].events;
+
+		// Errors and hang-ups wake both directions, so the ready callbacks can report them:
+		if (ev & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		{
+			run_io_waiter(fd, kIoRead);
+		}
+		if (ev & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+		{
+			run_io_waiter(fd, kIoWrite);
+		}
+
+		update_io_interest(fd);
+	}
+}
+
+void LuauTaskScheduler::post_resume(int thread_ref, Message&& values, bool ends_external_wait)
+{
+	PostedEvent* event = new PostedEvent();
+	event->kind = PostKind::Resume;
+	event->ref = thread_ref;
+	event->values = std::move(values);
+	event->ends_external_wait = ends_external_wait;
+
+	if (posted->push(event))
+	{
+		waker->wake();
+	}
+}
+
+void LuauTaskScheduler::post_fire(int signal_ref, Message&& values)
+{
+	PostedEvent* event = new PostedEvent();
+	event->kind = PostKind::Fire;
+	event->ref = signal_ref;
+	event->values = std::move(values);
+	event->ends_external_wait = false;
+
+	if (posted->push(event))
+	{
+		waker->wake();
+	}
+}
+
+void LuauTaskScheduler::begin_external_wait()
+{
+	external_waits++;
+}
+
+void LuauTaskScheduler::wake()
+{
+	waker->wake();
+}
+
+void LuauTaskScheduler::reset_wake()
+{
+	waker->reset();
+	wake_reset = true;
+}
+
+double LuauTaskScheduler::next_deadline() const
+{
+	if (!deferred_tasks->empty())
+	{
+		return time;
+	}
+
+	double deadline = HUGE_VAL;
+	for (int i = 0; i < kPriorityCount; i++)
+	{
+		if (!scheduled_tasks[i]->empty())
+		{
+			deadline = std::min(deadline, scheduled_tasks[i]->front()->resume_at);
+		}
+	}
+
+	return deadline;
+}
+
+void LuauTaskScheduler::wait(double until, int extra_fd)
+{
+	// The epoll fd polls readable whenever a watched socket is ready:
+	if (until == HUGE_VAL)
+	{
+		waker->wait(-1, {io_fd, extra_fd});
+		return;
+	}
+
+	double timeout = until - lua_clock();
+	if (timeout > 0)
+	{
+		waker->wait(timeout, {io_fd, extra_fd});
+	}
+}
+
+int LuauTaskScheduler::get_poll_fd()
+{
+	if (poll_fd >= 0)
+	{
+		return poll_fd;
+	}
+
+	// Both are level-triggered, and update() drains them, so poll_fd stays readable until it runs:
+	poll_fd = epoll_create1(EPOLL_CLOEXEC);
+	int fds[] = { waker->get_fd(), io_fd };
+	for (int fd : fds)
+	{
+		epoll_event ev{};
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+		epoll_ctl(poll_fd, EPOLL_CTL_ADD, fd, &ev);
+	}
+
+	return poll_fd;
+}
+
+double LuauTaskScheduler::get_time() const
+{
+	return time;
+}
+
+void LuauTaskScheduler::set_time(double now)
+{
+	time = now;
+}
+
+void LuauTaskScheduler::set_low_priority_budget(double budget)
+{
+	low_priority_budget = budget;
+}
+
 bool LuauTaskScheduler::update(double now, double dt)
 {
 	updating = true;
 	time = now;
 
-	// Run scheduled tasks:
-	auto it = scheduled_tasks->begin();
-	while (it != scheduled_tasks->end())
+	if (purge_pending)
 	{
-		ScheduledTask* scheduled = *it;
-		if (now >= scheduled->resume_at)
+		purge();
+	}
+
+	// Cleared before draining, so anything posted from here on wakes the next wait:
+	if (!wake_reset)
+	{
+		waker->reset();
+	}
+	wake_reset = false;
+
+	// Resume tasks whose offloaded work has finished, then run events posted from other threads:
+	run_completions();
+	run_posted();
+
+	// Resume tasks whose sockets are ready:
+	run_io();
+
+	// Run due scheduled tasks, lane by lane. Low priority work stops once it has used up its own budget,
+	// timed from the start of the low lane so busy higher lanes cannot starve it:
+	for (int i = 0; i < kPriorityCount; i++)
+	{
+		std::vector<ScheduledTask*>* tasks = scheduled_tasks[i];
+		double lane_start = i == kPriorityLow && low_priority_budget > 0 ? lua_clock() : 0;
+		int lane_count = 0;
+		while (!tasks->empty() && now >= tasks->front()->resume_at)
 		{
+			if (i == kPriorityLow && low_priority_budget > 0 && lane_count >= kMinLowPriorityTasks && lua_clock() - lane_start >= low_priority_budget)
+			{
+				break;
+			}
+			lane_count++;
+
+			std::pop_heap(tasks->begin(), tasks->end(), runs_later);
+			ScheduledTask* scheduled = tasks->back();
+			tasks->pop_back();
+
+			if (is_cancelled(scheduled))
+			{
+				release_task(scheduled);
+				continue;
+			}
+
+			if (scheduled->periodic)
+			{
+				// Re-armed in place and queued again below:
+				run_periodic(scheduled, now);
+				scheduled_tasks_temp->push_back(scheduled);
+				continue;
+			}
+
 			lua_getref(state, scheduled->thread_ref);
 			lua_State* T = lua_tothread(state, -1);
 			lua_pop(state, 1);
@@ -300,48 +1138,43 @@ bool LuauTaskScheduler::update(double now, double dt)
 				spawn(T, T == from ? nullptr : from, scheduled->n_args);
 			}
 
-			lua_unref(state, scheduled->from_thread_ref);
-			it = scheduled_tasks->erase(it);
-			delete scheduled;
-		}
-		else if (scheduled->erase)
-		{
-			it = scheduled_tasks->erase(it);
-			delete scheduled;
-		}
-		else
-		{
-			++it;
+			release_task(scheduled);
 		}
 	}
 
-	// Append the swapped scheduled tasks to the actual scheduled tasks vector:
-	if (scheduled_tasks_temp->size() > 0)
+	// Move tasks scheduled while updating into their heaps:
+	for (auto it = scheduled_tasks_temp->begin(); it != scheduled_tasks_temp->end(); ++it)
 	{
-		scheduled_tasks->insert(scheduled_tasks->end(), scheduled_tasks_temp->begin(), scheduled_tasks_temp->end());
-		scheduled_tasks_temp->clear();
+		ScheduledTask* scheduled = *it;
+		std::vector<ScheduledTask*>* tasks = scheduled_tasks[scheduled->priority];
+		tasks->push_back(scheduled);
+		std::push_heap(tasks->begin(), tasks->end(), runs_later);
 	}
+	scheduled_tasks_temp->clear();
 
-	// Run deferred tasks:
-	auto it2 = deferred_tasks->begin();
-	while (it2 != deferred_tasks->end())
+	// Run deferred tasks. Tasks deferred while running are appended to the end and run in this same pass:
+	for (size_t i = 0; i < deferred_tasks->size(); i++)
 	{
-		ScheduledTask* scheduled = *it2;
+		ScheduledTask* scheduled = (*deferred_tasks)[i];
 
-		lua_getref(state, scheduled->thread_ref);
-		lua_State* T = lua_tothread(state, -1);
-		lua_pop(state, 1);
+		if (!scheduled->erase)
+		{
+			lua_getref(state, scheduled->thread_ref);
+			lua_State* T = lua_tothread(state, -1);
+			lua_pop(state, 1);
 
-		lua_getref(state, scheduled->from_thread_ref);
-		lua_State* from = lua_tothread(state, -1);
-		lua_pop(state, 1);
+			lua_getref(state, scheduled->from_thread_ref);
+			lua_State* from = lua_tothread(state, -1);
+			lua_pop(state, 1);
 
-		spawn(T, T == from ? nullptr : from, scheduled->n_args);
+			spawn(T, T == from ? nullptr : from, scheduled->n_args);
 
-		// Reset defer depth:
-		ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(T));
-		td->defer_depth = 0;
+			// Reset defer depth:
+			ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(T));
+			td->defer_depth = 0;
+		}
 
+		lua_unref(state, scheduled->thread_ref);
 		lua_unref(state, scheduled->from_thread_ref);
 		delete scheduled;
 
@@ -349,20 +1182,28 @@ bool LuauTaskScheduler::update(double now, double dt)
 		{
 			deferred_tasks->insert(deferred_tasks->end(), deferred_tasks_temp->begin(), deferred_tasks_temp->end());
 			deferred_tasks_temp->clear();
-
-			// Inserting invalidates all iterators, so we need to find the iterator again:
-			it2 = std::find(deferred_tasks->begin(), deferred_tasks->end(), scheduled);
-			if (it2 == deferred_tasks->end())
-			{
-				break;
-			}
 		}
-
-		++it2;
 	}
 	deferred_tasks->clear();
-	
+
+	if (purge_pending)
+	{
+		purge();
+	}
+
 	updating = false;
 
-	return !scheduled_tasks->empty();
+	if (pending_jobs > 0 || external_waits > 0 || !io_watches->empty())
+	{
+		return true;
+	}
+
+	for (int i = 0; i < kPriorityCount; i++)
+	{
+		if (!scheduled_tasks[i]->empty())
+		{
+			return true;
+		}
+	}
+	return false;
 }
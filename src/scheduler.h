@@ -2,8 +2,30 @@
 #define SCHEDULER_H
 
 #include <lua.h>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "threaddata.h"
+#include "workerpool.h"
+#include "mpscqueue.h"
+#include "waker.h"
+#include "message.h"
+
+struct PeriodicTask
+{
+	double interval;
+	double origin;
+	uint64_t period;
+	uint64_t missed;
+	TaskPriority priority;
+	bool catch_up;
+	bool active;
+};
+
 struct ScheduledTask
 {
 	int thread_ref;
@@ -11,31 +33,168 @@ struct ScheduledTask
 	int n_args;
 	double resume_at;
 	double start;
+	uint64_t sequence;
+	TaskPriority priority;
 	bool yield_delta;
 	bool erase;
+
+	// Set for task.every; such tasks stay queued and are re-armed after each run:
+	PeriodicTask* periodic;
+};
+
+enum class PostKind
+{
+	Resume,
+	Fire,
+};
+
+// Work posted to the scheduler from another thread, run on its next update:
+struct PostedEvent
+{
+	PostKind kind;
+	int ref;
+	LuauPi::Message values;
+	// Resumes a task counted by begin_external_wait:
+	bool ends_external_wait;
+	PostedEvent* next;
+};
+
+enum IoDirection
+{
+	kIoRead,
+	kIoWrite,
+	kIoDirections,
+};
+
+// Tasks parked on one fd, at most one per direction:
+struct IoWatch
+{
+	int thread_refs[kIoDirections];
+	std::function<int(lua_State* T)> ready[kIoDirections];
+	uint32_t registered_events;
+};
+
+enum class BudgetPolicy
+{
+	Yield,
+	Error,
 };
 
 class LuauTaskScheduler
 {
 private:
 	lua_State* state;
-	std::vector<ScheduledTask*>* scheduled_tasks;
+	// One deadline-ordered heap per priority lane:
+	std::vector<ScheduledTask*>* scheduled_tasks[kPriorityCount];
 	std::vector<ScheduledTask*>* scheduled_tasks_temp;
 	std::vector<ScheduledTask*>* deferred_tasks;
 	std::vector<ScheduledTask*>* deferred_tasks_temp;
+	std::vector<int>* thread_pool;
 
 	bool updating;
+	bool purge_pending;
 	double time;
+	uint64_t sequence;
+	double low_priority_budget;
+
+	double resume_budget;
+	BudgetPolicy budget_policy;
+	double slice_deadline;
+	lua_State* resumed_thread;
+	unsigned int interrupt_count;
+
+	// Work handed to the worker pool that has not been drained by update() yet:
+	std::shared_ptr<LuauPi::JobSink>* job_sink;
+	size_t pending_jobs;
+	// Tasks parked on native waiters, such as inputs and steppers, that have not been resumed yet:
+	size_t external_waits;
+
+	// Events posted from other threads. The waker is signalled when either queue goes from empty to non-empty:
+	LuauPi::MpscQueue<PostedEvent>* posted;
+	LuauPi::Waker* waker;
+	// Set by reset_wake() so the next update() does not clear the waker a second time:
+	bool wake_reset;
+
+	// epoll instance for fds tasks are waiting on, keyed by fd:
+	int io_fd;
+	std::unordered_map<int, IoWatch>* io_watches;
+	// Watches the waker and io_fd together for get_poll_fd, or -1 until first asked for:
+	int poll_fd;
+
+	int resume(lua_State* T, lua_State* from, int n_args, bool can_yield, bool error);
+	void release_thread(lua_State* T);
+	void schedule(ScheduledTask* scheduled);
+	void run_periodic(ScheduledTask* scheduled, double now);
+	void release_task(ScheduledTask* scheduled);
+	void purge();
+	void run_completions();
+	void run_posted();
+	void run_io();
+	void run_io_waiter(int fd, IoDirection direction);
+	void update_io_interest(int fd);
 
 public:
 	static LuauTaskScheduler* create(lua_State* L);
 	static LuauTaskScheduler* get(lua_State* L);
 
-	lua_State* create_thread(lua_State* L);
+	// Only threads whose handle is not returned to the script (periodic tasks, signal handlers) may be
+	// recyclable, as a pooled thread is handed out again once it finishes. coroutine.running clears
+	// the flag on a thread it hands out. Others are never pooled, so lua_newthread still allocates:
+	lua_State* create_thread(lua_State* L, bool recyclable = false);
 	int spawn(lua_State* T, lua_State* from, int n_args, bool can_yield = true);
+	// The error a failed task stopped with, followed by its traceback, as printed when it fails:
+	static std::string describe_error(lua_State* T);
 	bool defer(lua_State* T, lua_State* from, int n_args, int thread_ref);
 	void delay(lua_State* T, lua_State* from, int n_args, int thread_ref, double delay_time, bool yield_delta);
+	void every(PeriodicTask* periodic, int args_ref, int n_args);
+	void wake(lua_State* T, lua_State* from, int n_args);
 	void cancel(lua_State* T);
+	void cancel(PeriodicTask* periodic);
+
+	// Runs work on the worker pool and yields L until it has finished. complete then
+	// runs on this scheduler's thread and pushes the values L resumes with:
+	int offload(lua_State* L, std::function<void()> work, std::function<int(lua_State* T)> complete);
+
+	// Returned by an I/O ready callback to keep waiting:
+	static constexpr int kIoRetry = -2;
+
+	// Yields L until fd is ready in the given direction. ready then runs on this scheduler's thread and
+	// pushes the values L resumes with and returns their count, pushes an error and returns -1, or
+	// returns kIoRetry to keep waiting. Only one task may wait on each direction of an fd:
+	int wait_io(lua_State* L, int fd, IoDirection direction, std::function<int(lua_State* T)> ready);
+	// Raises an error in any task waiting on fd. Call before closing fd:
+	void unwatch_io(int fd);
+
+	// Safe to call from any thread. Resumes the yielded thread pinned by thread_ref
+	// with values on the next update, then releases the ref. Allocates, so it is not
+	// async-signal-safe; a signal handler should set a flag and call wake() instead:
+	void post_resume(int thread_ref, LuauPi::Message&& values, bool ends_external_wait = false);
+	// Counts a task about to park on a native waiter that resumes it from another thread, so update()
+	// keeps reporting work until then. The waiter must resume it with post_resume(..., true):
+	void begin_external_wait();
+	// As post_resume. Fires the Signal pinned by signal_ref with values on the next update:
+	void post_fire(int signal_ref, LuauPi::Message&& values);
+	// Safe to call from any thread or a signal handler:
+	void wake();
+	// Clears pending wake-ups ahead of update(), for callers that drain their own work (e.g. an actor's
+	// inbox) before updating. update() otherwise clears them itself, after that work was drained:
+	void reset_wake();
+
+	// Earliest time update() has work to do without being woken, or HUGE_VAL if there is none:
+	double next_deadline() const;
+	// Blocks until the given time, until woken, or until extra_fd is readable:
+	void wait(double until, int extra_fd = -1);
+	// Polls readable whenever wait() would have been woken, for hosts that poll in their own loop instead
+	// and call update() when it is readable or next_deadline() has passed:
+	int get_poll_fd();
+
+	void set_resume_budget(double budget, BudgetPolicy policy);
+	void check_budget(lua_State* L);
+	void set_low_priority_budget(double budget);
+
+	// Scheduler clock, as last passed to update(). Virtual-time runs set it before anything is scheduled:
+	double get_time() const;
+	void set_time(double now);
 
 	bool update(double now, double dt);
 	void close();
@@ -2,24 +2,24 @@
 
 #include <string>
 #include <luacode.h>
+#include <luacodegen.h>
 #include <lualib.h>
 #include <cstdio>
 #include <memory>
+#include <vector>
+#include <unistd.h>
 
 #include "fs.h"
+#include "bundle.h"
 #include "scheduler.h"
+#include "hotlines.h"
 
 using namespace LuauPi;
 
-lua_State* LuauScript::load_and_run(lua_State* L, const std::string& filepath, int* status)
-{
-	if (status != nullptr)
-	{
-		*status = -1;
-	}
-
-	std::string source = FS::read_file(filepath);
+static bool native_compile = false;
 
+std::string LuauScript::compile(const std::string& source)
+{
 	const char* mutable_globals[] = { nullptr };
 	const char* userdata_types[] = { nullptr };
 
@@ -27,29 +27,188 @@ lua_State* LuauScript::load_and_run(lua_State* L, const std::string& filepath, i
 	compile_options.optimizationLevel = 1;
 	compile_options.debugLevel = 1;
 	compile_options.typeInfoLevel = 0;
-	compile_options.coverageLevel = 0;
+	compile_options.coverageLevel = HotLines::coverage_level();
 	compile_options.mutableGlobals = mutable_globals;
 	compile_options.userdataTypes = userdata_types;
 
 	size_t bytecode_size;
 	std::unique_ptr<char, void(*)(void*)> bytecode_ptr = std::unique_ptr<char, void(*)(void*)>(luau_compile(source.data(), source.size(), &compile_options, &bytecode_size), free);
 
+	return std::string(bytecode_ptr.get(), bytecode_size);
+}
+
+void LuauScript::set_native(bool native)
+{
+	native_compile = native;
+}
+
+// Every chunk is loaded through here, from a bundle or compiled source. source is empty for bundles:
+static bool load_bytecode(lua_State* L, const std::string& name, const char* bytecode, size_t bytecode_size, const std::string& source)
+{
+	if (luau_load(L, (std::string("=") + name).c_str(), bytecode, bytecode_size, 0) != LUA_OK)
+	{
+		return false;
+	}
+
+	HotLines::track(L, name, source);
+
+	if (native_compile && luau_codegen_supported())
+	{
+		luau_codegen_compile(L, -1);
+	}
+
+	return true;
+}
+
+bool LuauScript::load(lua_State* L, const std::string& name)
+{
+	if (const Bundle* bundle = Bundle::get_mounted())
+	{
+		const char* bytecode;
+		size_t bytecode_size;
+		if (!bundle->find(normalize_path(name), &bytecode, &bytecode_size))
+		{
+			lua_pushfstring(L, "%s is not in the bundle", name.c_str());
+			return false;
+		}
+
+		return load_bytecode(L, name, bytecode, bytecode_size, std::string());
+	}
+
+	std::string source;
+	std::string error;
+	if (!FS::read_file(name, &source, &error))
+	{
+		lua_pushstring(L, error.c_str());
+		return false;
+	}
+
+	return load_source(L, name, source);
+}
+
+bool LuauScript::load_source(lua_State* L, const std::string& name, const std::string& source)
+{
+	std::string compiled = compile(source);
+	return load_bytecode(L, name, compiled.data(), compiled.size(), source);
+}
+
+std::string LuauScript::normalize_path(const std::string& path)
+{
+	bool absolute = !path.empty() && path[0] == '/';
+
+	std::vector<std::string> parts;
+	size_t pos = 0;
+	while (pos <= path.size())
+	{
+		size_t end = path.find('/', pos);
+		if (end == std::string::npos)
+		{
+			end = path.size();
+		}
+
+		std::string part = path.substr(pos, end - pos);
+		if (part == "..")
+		{
+			// Leading ".." components of relative paths are kept:
+			if (!parts.empty() && parts.back() != "..")
+			{
+				parts.pop_back();
+			}
+			else if (!absolute)
+			{
+				parts.push_back(part);
+			}
+		}
+		else if (!part.empty() && part != ".")
+		{
+			parts.push_back(part);
+		}
+
+		pos = end + 1;
+	}
+
+	std::string out = absolute ? "/" : "";
+	for (size_t i = 0; i < parts.size(); i++)
+	{
+		if (i > 0)
+		{
+			out += '/';
+		}
+		out += parts[i];
+	}
+
+	return out;
+}
+
+static bool module_exists(const std::string& name)
+{
+	if (const Bundle* bundle = Bundle::get_mounted())
+	{
+		const char* bytecode;
+		size_t bytecode_size;
+		return bundle->find(name, &bytecode, &bytecode_size);
+	}
+
+	return access(name.c_str(), R_OK) == 0;
+}
+
+bool LuauScript::resolve_module(const std::string& from, const std::string& path, std::string* name)
+{
+	std::string base = path;
+	if (path.empty() || path[0] != '/')
+	{
+		size_t slash = from.rfind('/');
+		base = slash == std::string::npos ? path : from.substr(0, slash + 1) + path;
+	}
+	base = normalize_path(base);
+
+	const char* suffixes[] = { "", ".luau", ".lua", "/init.luau", nullptr };
+	for (const char** suffix = suffixes; *suffix; suffix++)
+	{
+		std::string candidate = base + *suffix;
+
+		// Only files with a script extension match as they are:
+		bool has_extension = candidate.size() > 4 && (candidate.compare(candidate.size() - 5, 5, ".luau") == 0 || candidate.compare(candidate.size() - 4, 4, ".lua") == 0);
+		if (has_extension && module_exists(candidate))
+		{
+			*name = candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+lua_State* LuauScript::load_and_run(lua_State* L, const std::string& filepath, int* status)
+{
+	if (status != nullptr)
+	{
+		*status = -1;
+	}
+
 	lua_pushthread(L);
 	int l_pin = lua_ref(L, -1);
 	lua_pop(L, 1);
 
-	int result = luau_load(L, (std::string("=") + filepath).c_str(), bytecode_ptr.get(), bytecode_size, 0);
-
-	if (result != LUA_OK)
+	if (!load(L, filepath))
 	{
 		size_t len;
 		const char* msg = lua_tolstring(L, -1, &len);
+		printf("[ERROR] %s\n", msg);
 		lua_pop(L, 1);
 		lua_unref(L, l_pin);
-		printf("[ERROR] %s\n", msg);
 		return nullptr;
 	}
 
+	lua_State* T = run_loaded(L, status);
+
+	lua_unref(L, l_pin);
+
+	return T;
+}
+
+lua_State* LuauScript::run_loaded(lua_State* L, int* status)
+{
 	LuauTaskScheduler* scheduler = LuauTaskScheduler::get(L);
 
 	lua_State* T = scheduler->create_thread(L);
@@ -65,7 +224,5 @@ lua_State* LuauScript::load_and_run(lua_State* L, const std::string& filepath, i
 		*status = spawn_status;
 	}
 
-	lua_unref(L, l_pin);
-
 	return T;
 }
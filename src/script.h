@@ -7,7 +7,27 @@
 class LuauScript
 {
 public:
+	// Compiles with the options every chunk is loaded with. As with luau_compile, errors are encoded in the result:
+	static std::string compile(const std::string& source);
+
+	// Native-compiles chunks as they are loaded, where the CPU supports it:
+	static void set_native(bool native);
+
+	// Pushes the chunk for a script or module, from the mounted bundle or compiled from source.
+	// On failure pushes an error message instead and returns false:
+	static bool load(lua_State* L, const std::string& name);
+	// As load, from source held in memory. name names the chunk in errors:
+	static bool load_source(lua_State* L, const std::string& name, const std::string& source);
+
+	// Finds the script a require of path from the chunk named from refers to. Paths are relative to
+	// that chunk's directory, and may leave out the .luau extension or name a directory with an init.luau:
+	static bool resolve_module(const std::string& from, const std::string& path, std::string* name);
+	// Removes "." and ".." components and repeated slashes:
+	static std::string normalize_path(const std::string& path);
+
 	static lua_State* load_and_run(lua_State* L, const std::string& filepath, int* status);
+	// Runs the chunk load pushed as a new task, popping it:
+	static lua_State* run_loaded(lua_State* L, int* status);
 };
 
 #endif
@@ -1,37 +1,90 @@
 #include "state.h"
 
 #include <lualib.h>
+#include <cstdlib>
+#include <memory>
+#include <vector>
 #include <luacodegen.h>
 
 #include "scheduler.h"
 #include "pilib.h"
 #include "tasklib.h"
+#include "actor.h"
+#include "fslib.h"
+#include "netlib.h"
+#include "requirelib.h"
 #include "threaddata.h"
+#include "hotlines.h"
+#include "allocprofiler.h"
+#include "gpioinput.h"
+#include "motion.h"
 
 using namespace LuauPi;
 
+// ThreadData of collected threads, reused for the next thread created on this OS thread. Every
+// state is only ever used from one OS thread, so no locking is needed:
+static constexpr size_t kMaxFreeThreadData = 128;
+static thread_local std::vector<std::unique_ptr<ThreadData>> free_thread_data;
+
 static void user_thread(lua_State* parent, lua_State* L)
 {
 	if (parent)
 	{
-		ThreadData* td = new ThreadData();
+		ThreadData* td;
+		if (!free_thread_data.empty())
+		{
+			td = free_thread_data.back().release();
+			free_thread_data.pop_back();
+			*td = ThreadData();
+		}
+		else
+		{
+			td = new ThreadData();
+		}
+
+		ThreadData* parent_td = static_cast<ThreadData*>(lua_getthreaddata(parent));
+		td->priority = parent_td ? parent_td->priority : kPriorityNormal;
 		lua_setthreaddata(L, td);
 	}
 	else
 	{
 		ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(L));
-		if (td)
+		if (td && free_thread_data.size() < kMaxFreeThreadData)
+		{
+			free_thread_data.emplace_back(td);
+		}
+		else if (td)
 		{
 			delete td;
 		}
 	}
 }
 
-LuauState::LuauState() : L(luaL_newstate())
+// Every state allocates through here, so --alloc-profile runs can see how much the VMs hold:
+static void* state_alloc(void* ud, void* ptr, size_t osize, size_t nsize)
 {
+	AllocProfiler::track_heap(ptr ? osize : 0, nsize);
+
+	if (nsize == 0)
+	{
+		free(ptr);
+		return nullptr;
+	}
+
+	return realloc(ptr, nsize);
+}
+
+LuauState::LuauState() : L(lua_newstate(state_alloc, nullptr))
+{
+	AllocProfiler::attach(L);
+
 	luaL_openlibs(L);
 	pilib_open(L);
 	task_lib_open(L);
+	actor_lib_open(L);
+	fs_lib_open(L);
+	net_lib_open(L);
+	require_lib_open(L);
 	LuauTaskScheduler::create(L);
 
 	if (luau_codegen_supported())
@@ -41,11 +94,21 @@ LuauState::LuauState() : L(luaL_newstate())
 
 	luaL_sandbox(L);
 
-	lua_callbacks(L)->userdata = reinterpret_cast<void*>(&user_thread);
+	lua_callbacks(L)->userthread = user_thread;
 }
 
 LuauState::~LuauState()
 {
+	// Native inputs and steppers stop posting to the scheduler before it goes away:
+	GpioInputs::release(LuauTaskScheduler::get(L));
+	MotionEngine::release(LuauTaskScheduler::get(L));
+
+	// Work still running on the worker pool is detached, and freed by its worker once it finishes:
+	LuauTaskScheduler::get(L)->close();
+
+	// Final counts for --hotlines runs, before the chunks they live in are collected:
+	HotLines::release(L);
+
 	lua_close(L);
 }
 
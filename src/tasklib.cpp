@@ -1,22 +1,45 @@
 #include "tasklib.h"
 
 #include <lualib.h>
+#include <cstring>
+#include <thread>
+#include <chrono>
 #include "scheduler.h"
+#include "tasksync.h"
+#include "fslib.h"
+
+static constexpr const char* kPeriodicTask = "PeriodicTask";
+
+static TaskPriority check_priority(lua_State* L, int idx)
+{
+	static const char* const names[] = {"high", "normal", "low", nullptr};
+	return static_cast<TaskPriority>(luaL_checkoption(L, idx, nullptr, names));
+}
 
 static lua_State* prepare_thread(lua_State* L, int idx, int* ref, int* n_args, bool* created_new_thread)
 {
 	LuauTaskScheduler* scheduler = LuauTaskScheduler::get(L);
 
+	// An optional priority may precede the function or thread:
+	int priority = -1;
+	if (lua_type(L, idx) == LUA_TSTRING)
+	{
+		priority = check_priority(L, idx);
+		idx++;
+	}
+
 	bool is_fn = lua_isfunction(L, idx);
 	bool is_thread = lua_isthread(L, idx);
 	luaL_argcheck(L, is_fn || is_thread, idx, "expected function or thread");
 
 	lua_State* T;
-	*ref = LUA_NOREF;
 	if (is_thread)
 	{
 		T = lua_tothread(L, idx);
 		*created_new_thread = false;
+
+		// Pin the thread:
+		*ref = lua_ref(L, idx);
 	}
 	else
 	{
@@ -32,6 +55,12 @@ static lua_State* prepare_thread(lua_State* L, int idx, int* ref, int* n_args, b
 		lua_xpush(L, T, idx);
 	}
 
+	if (priority != -1)
+	{
+		ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(T));
+		td->priority = static_cast<TaskPriority>(priority);
+	}
+
 	// Push arguments to the thread:
 	int top = lua_gettop(L);
 	for (int i = idx + 1; i <= top; i++)
@@ -63,10 +92,7 @@ static int task_spawn(lua_State* L)
 	}
 
 	// Unpin the thread:
-	if (ref != LUA_NOREF)
-	{
-		lua_unref(L, ref);
-	}
+	lua_unref(L, ref);
 
 	// Return thread:
 	return 1;
@@ -136,8 +162,127 @@ static int task_wait(lua_State* L)
 	return lua_yield(L, 1);
 }
 
+static int task_clock(lua_State* L)
+{
+	lua_pushnumber(L, LuauTaskScheduler::get(L)->get_time());
+	return 1;
+}
+
+static int task_every(lua_State* L)
+{
+	LuauTaskScheduler* scheduler = LuauTaskScheduler::get(L);
+
+	ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(L));
+
+	double interval;
+	bool catch_up = false;
+	TaskPriority priority = td ? td->priority : kPriorityNormal;
+	if (lua_istable(L, 1))
+	{
+		lua_rawgetfield(L, 1, "interval");
+		luaL_argcheck(L, lua_isnumber(L, -1), 1, "expected number for 'interval'");
+		interval = lua_tonumber(L, -1);
+		lua_pop(L, 1);
+
+		lua_rawgetfield(L, 1, "overrun");
+		if (!lua_isnil(L, -1))
+		{
+			const char* overrun = lua_tostring(L, -1);
+			bool valid = overrun && (strcmp(overrun, "skip") == 0 || strcmp(overrun, "catchup") == 0);
+			luaL_argcheck(L, valid, 1, "expected 'skip' or 'catchup' for 'overrun'");
+			catch_up = strcmp(overrun, "catchup") == 0;
+		}
+		lua_pop(L, 1);
+
+		lua_rawgetfield(L, 1, "priority");
+		if (!lua_isnil(L, -1))
+		{
+			priority = check_priority(L, -1);
+		}
+		lua_pop(L, 1);
+	}
+	else
+	{
+		interval = luaL_checknumber(L, 1);
+	}
+	luaL_argcheck(L, interval > 0, 1, "interval must be greater than zero");
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+
+	int n_args = lua_gettop(L) - 2;
+
+	PeriodicTask* periodic = static_cast<PeriodicTask*>(lua_newuserdata(L, sizeof(PeriodicTask)));
+	periodic->interval = interval;
+	periodic->missed = 0;
+	periodic->priority = priority;
+	periodic->catch_up = catch_up;
+	periodic->active = true;
+	luaL_getmetatable(L, kPeriodicTask);
+	lua_setmetatable(L, -2);
+
+	// Pin the handle, function and arguments as { handle, fn, args... }:
+	lua_createtable(L, n_args + 2, 0);
+	lua_pushvalue(L, -2);
+	lua_rawseti(L, -2, 1);
+	for (int i = 2; i <= n_args + 2; i++)
+	{
+		lua_pushvalue(L, i);
+		lua_rawseti(L, -2, i);
+	}
+	int ref = lua_ref(L, -1);
+	lua_pop(L, 1);
+
+	scheduler->every(periodic, ref, n_args);
+
+	// Return handle:
+	return 1;
+}
+
+static int periodic_cancel(lua_State* L)
+{
+	PeriodicTask* periodic = static_cast<PeriodicTask*>(luaL_checkudata(L, 1, kPeriodicTask));
+
+	LuauTaskScheduler* scheduler = LuauTaskScheduler::get(L);
+	scheduler->cancel(periodic);
+
+	return 0;
+}
+
+static int periodic_index(lua_State* L)
+{
+	PeriodicTask* periodic = static_cast<PeriodicTask*>(luaL_checkudata(L, 1, kPeriodicTask));
+	const char* key = luaL_checkstring(L, 2);
+
+	if (strcmp(key, "cancel") == 0)
+	{
+		lua_pushcfunction(L, periodic_cancel, "cancel");
+	}
+	else if (strcmp(key, "active") == 0)
+	{
+		lua_pushboolean(L, periodic->active);
+	}
+	else if (strcmp(key, "missed") == 0)
+	{
+		lua_pushnumber(L, static_cast<double>(periodic->missed));
+	}
+	else if (strcmp(key, "interval") == 0)
+	{
+		lua_pushnumber(L, periodic->interval);
+	}
+	else
+	{
+		luaL_error(L, "%s is not a valid member of PeriodicTask", key);
+	}
+
+	return 1;
+}
+
 static int task_cancel(lua_State* L)
 {
+	if (lua_type(L, 1) == LUA_TUSERDATA)
+	{
+		return periodic_cancel(L);
+	}
+
 	luaL_checktype(L, 1, LUA_TTHREAD);
 
 	lua_State* T = lua_tothread(L, 1);
@@ -148,12 +293,76 @@ static int task_cancel(lua_State* L)
 	return 0;
 }
 
+static int offload_sleep(lua_State* L)
+{
+	double seconds = luaL_checknumber(L, 1);
+
+	return LuauTaskScheduler::get(L)->offload(
+		L,
+		[seconds]() {
+			std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+		},
+		[seconds](lua_State* T) {
+			lua_pushnumber(T, seconds);
+			return 1;
+		}
+	);
+}
+
+// Blocking operations task.offload runs on the worker pool, by name:
+static const luaL_Reg offload_ops[] = {
+	{"sleep", offload_sleep},
+	{"readFile", fs_read_file},
+	{"writeFile", fs_write_file},
+	{nullptr, nullptr},
+};
+
+static int task_offload(lua_State* L)
+{
+	const char* name = luaL_checkstring(L, 1);
+
+	for (const luaL_Reg* op = offload_ops; op->name; op++)
+	{
+		if (strcmp(op->name, name) == 0)
+		{
+			lua_remove(L, 1);
+			return op->func(L);
+		}
+	}
+
+	luaL_error(L, "unknown offload operation '%s'", name);
+}
+
+// As Luau's own, but a pooled thread that hands out its handle stops being recyclable, as the
+// handle would otherwise refer to whichever later task the thread is reused for:
+static int coroutine_running(lua_State* L)
+{
+	ThreadData* td = static_cast<ThreadData*>(lua_getthreaddata(L));
+	if (td)
+	{
+		td->recyclable = false;
+	}
+
+	// The main thread is not a coroutine:
+	if (lua_pushthread(L))
+	{
+		lua_pushnil(L);
+	}
+
+	return 1;
+}
+
 static const luaL_Reg lib[] = {
 	{"spawn", task_spawn},
 	{"delay", task_delay},
 	{"defer", task_defer},
 	{"wait", task_wait},
 	{"cancel", task_cancel},
+	{"every", task_every},
+	{"signal", task_signal},
+	{"channel", task_channel},
+	{"offload", task_offload},
+	{"clock", task_clock},
 	{nullptr, nullptr},
 };
 
@@ -161,4 +370,19 @@ void task_lib_open(lua_State* L)
 {
 	luaL_register(L, "task", lib);
 	lua_pop(L, 1);
+
+	// PeriodicTask handle metatable:
+	luaL_newmetatable(L, kPeriodicTask);
+	lua_pushcfunction(L, periodic_index, "__index");
+	lua_setfield(L, -2, "__index");
+	lua_pushstring(L, "The metatable is locked");
+	lua_setfield(L, -2, "__metatable");
+	lua_pop(L, 1);
+
+	lua_getglobal(L, "coroutine");
+	lua_pushcfunction(L, coroutine_running, "running");
+	lua_setfield(L, -2, "running");
+	lua_pop(L, 1);
+
+	task_sync_open(L);
 }
@@ -0,0 +1,494 @@
+#include "tasksync.h"
+
+#include <lualib.h>
+#include <cstring>
+
+#include "scheduler.h"
+
+static constexpr const char* kSignal = "Signal";
+static constexpr const char* kConnection = "SignalConnection";
+static constexpr const char* kChannel = "Channel";
+static constexpr const char* kSyncStorage = "TaskSyncStorage";
+
+// Slots of the storage table kept for each signal/channel. Parked threads and
+// buffered values live there rather than in registry refs, so an abandoned
+// object is collected along with everything it holds:
+enum StorageSlot
+{
+	kHandlers = 1,
+	kWaiters,
+	kValues,
+	kReceivers,
+	kSenders,
+	kSenderValues,
+	kStorageSlots = kSenderValues,
+};
+
+struct Fifo
+{
+	int head;
+	int tail;
+};
+
+struct Signal
+{
+	Fifo waiters;
+};
+
+struct Connection
+{
+	bool connected;
+};
+
+struct Channel
+{
+	int capacity;
+	int head;
+	int count;
+	Fifo receivers;
+	Fifo senders;
+	bool closed;
+};
+
+static void push_storage(lua_State* L, int idx)
+{
+	idx = lua_absindex(L, idx);
+	lua_rawgetfield(L, LUA_REGISTRYINDEX, kSyncStorage);
+	lua_pushvalue(L, idx);
+	lua_rawget(L, -2);
+	lua_remove(L, -2);
+}
+
+static void create_storage(lua_State* L, int idx)
+{
+	idx = lua_absindex(L, idx);
+	lua_rawgetfield(L, LUA_REGISTRYINDEX, kSyncStorage);
+	lua_pushvalue(L, idx);
+	lua_createtable(L, kStorageSlots, 0);
+	for (int i = 1; i <= kStorageSlots; i++)
+	{
+		lua_newtable(L);
+		lua_rawseti(L, -2, i);
+	}
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+}
+
+static void fifo_init(Fifo* fifo)
+{
+	fifo->head = 1;
+	fifo->tail = 1;
+}
+
+// Pops the value on top of the stack into the fifo stored at slot of the storage table at storage_idx:
+static void fifo_push(lua_State* L, int storage_idx, int slot, Fifo* fifo)
+{
+	lua_rawgeti(L, storage_idx, slot);
+	lua_insert(L, -2);
+	lua_rawseti(L, -2, fifo->tail);
+	lua_pop(L, 1);
+
+	fifo->tail++;
+}
+
+// Pushes the oldest value of the fifo and removes it from the fifo:
+static void fifo_pop(lua_State* L, int storage_idx, int slot, Fifo* fifo)
+{
+	lua_rawgeti(L, storage_idx, slot);
+	lua_rawgeti(L, -1, fifo->head);
+	lua_pushnil(L);
+	lua_rawseti(L, -3, fifo->head);
+	lua_remove(L, -2);
+
+	fifo->head++;
+	if (fifo->head == fifo->tail)
+	{
+		fifo_init(fifo);
+	}
+}
+
+// Pops parked threads until one that is still waiting is found. Threads that
+// were cancelled while parked are dropped. Returns nullptr if none are left:
+static lua_State* pop_waiter(lua_State* L, int storage_idx, int slot, Fifo* fifo, int value_slot = 0)
+{
+	while (fifo->head != fifo->tail)
+	{
+		int head = fifo->head;
+		fifo_pop(L, storage_idx, slot, fifo);
+		lua_State* T = lua_tothread(L, -1);
+		lua_pop(L, 1);
+
+		if (value_slot != 0)
+		{
+			// Push the value parked along with the thread:
+			Fifo values = { head, head + 1 };
+			fifo_pop(L, storage_idx, value_slot, &values);
+		}
+
+		if (lua_status(T) == LUA_YIELD)
+		{
+			return T;
+		}
+
+		if (value_slot != 0)
+		{
+			lua_pop(L, 1);
+		}
+	}
+
+	return nullptr;
+}
+
+static int signal_connect(lua_State* L)
+{
+	luaL_checkudata(L, 1, kSignal);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+
+	Connection* connection = static_cast<Connection*>(lua_newuserdata(L, sizeof(Connection)));
+	connection->connected = true;
+	luaL_getmetatable(L, kConnection);
+	lua_setmetatable(L, -2);
+
+	// handlers[connection] = fn
+	push_storage(L, 1);
+	lua_rawgeti(L, -1, kHandlers);
+	lua_pushvalue(L, -3);
+	lua_pushvalue(L, 2);
+	lua_rawset(L, -3);
+	lua_pop(L, 2);
+
+	// The connection maps back to its signal so it can disconnect itself:
+	lua_rawgetfield(L, LUA_REGISTRYINDEX, kSyncStorage);
+	lua_pushvalue(L, -2);
+	lua_pushvalue(L, 1);
+	lua_rawset(L, -3);
+	lua_pop(L, 1);
+
+	return 1;
+}
+
+static int signal_wait(lua_State* L)
+{
+	Signal* signal = static_cast<Signal*>(luaL_checkudata(L, 1, kSignal));
+
+	push_storage(L, 1);
+	lua_pushthread(L);
+	fifo_push(L, lua_gettop(L) - 1, kWaiters, &signal->waiters);
+	lua_pop(L, 1);
+
+	// Resumed by task_signal_fire with the fired values:
+	return lua_yield(L, 0);
+}
+
+int task_signal_fire(lua_State* L)
+{
+	Signal* signal = static_cast<Signal*>(luaL_checkudata(L, 1, kSignal));
+	LuauTaskScheduler* scheduler = LuauTaskScheduler::get(L);
+
+	int n_args = lua_gettop(L) - 1;
+
+	push_storage(L, 1);
+	int storage = lua_gettop(L);
+
+	// Each connected handler runs on its own thread:
+	lua_rawgeti(L, storage, kHandlers);
+	int handlers = lua_gettop(L);
+	lua_pushnil(L);
+	while (lua_next(L, handlers))
+	{
+		lua_State* T = scheduler->create_thread(L, true);
+		lua_xpush(L, T, -2);
+		for (int i = 2; i <= n_args + 1; i++)
+		{
+			lua_xpush(L, T, i);
+		}
+		scheduler->wake(T, L, n_args);
+
+		lua_pop(L, 2);
+	}
+	lua_pop(L, 1);
+
+	// Parked threads are moved straight to the deferred queue:
+	while (lua_State* T = pop_waiter(L, storage, kWaiters, &signal->waiters))
+	{
+		for (int i = 2; i <= n_args + 1; i++)
+		{
+			lua_xpush(L, T, i);
+		}
+		scheduler->wake(T, L, n_args);
+	}
+
+	lua_pop(L, 1);
+
+	return 0;
+}
+
+static int connection_disconnect(lua_State* L)
+{
+	Connection* connection = static_cast<Connection*>(luaL_checkudata(L, 1, kConnection));
+	if (!connection->connected)
+	{
+		return 0;
+	}
+	connection->connected = false;
+
+	// signal = storage[connection]
+	lua_rawgetfield(L, LUA_REGISTRYINDEX, kSyncStorage);
+	lua_pushvalue(L, 1);
+	lua_rawget(L, -2);
+
+	// handlers[connection] = nil
+	push_storage(L, -1);
+	lua_rawgeti(L, -1, kHandlers);
+	lua_pushvalue(L, 1);
+	lua_pushnil(L);
+	lua_rawset(L, -3);
+	lua_pop(L, 4);
+
+	return 0;
+}
+
+static int connection_index(lua_State* L)
+{
+	Connection* connection = static_cast<Connection*>(luaL_checkudata(L, 1, kConnection));
+	const char* key = luaL_checkstring(L, 2);
+
+	if (strcmp(key, "disconnect") == 0)
+	{
+		lua_pushcfunction(L, connection_disconnect, "disconnect");
+	}
+	else if (strcmp(key, "connected") == 0)
+	{
+		lua_pushboolean(L, connection->connected);
+	}
+	else
+	{
+		luaL_error(L, "%s is not a valid member of SignalConnection", key);
+	}
+
+	return 1;
+}
+
+static int channel_send(lua_State* L)
+{
+	Channel* channel = static_cast<Channel*>(luaL_checkudata(L, 1, kChannel));
+	luaL_checkany(L, 2);
+	lua_settop(L, 2);
+
+	if (channel->closed)
+	{
+		lua_pushboolean(L, false);
+		return 1;
+	}
+
+	LuauTaskScheduler* scheduler = LuauTaskScheduler::get(L);
+
+	push_storage(L, 1);
+	int storage = lua_gettop(L);
+
+	// Hand the value straight to a parked receiver:
+	if (lua_State* T = pop_waiter(L, storage, kReceivers, &channel->receivers))
+	{
+		lua_xpush(L, T, 2);
+		lua_pushboolean(T, true);
+		scheduler->wake(T, L, 2);
+
+		lua_pushboolean(L, true);
+		return 1;
+	}
+
+	// Buffer the value if there is room:
+	if (channel->count < channel->capacity)
+	{
+		lua_rawgeti(L, storage, kValues);
+		lua_pushvalue(L, 2);
+		lua_rawseti(L, -2, (channel->head + channel->count) % channel->capacity + 1);
+		channel->count++;
+
+		lua_pushboolean(L, true);
+		return 1;
+	}
+
+	// Otherwise wait for a receiver to make room. The value is parked alongside the thread:
+	lua_pushvalue(L, 2);
+	Fifo values = { channel->senders.tail, channel->senders.tail };
+	fifo_push(L, storage, kSenderValues, &values);
+	lua_pushthread(L);
+	fifo_push(L, storage, kSenders, &channel->senders);
+
+	// Resumed with true once received, or false if the channel is closed first:
+	return lua_yield(L, 0);
+}
+
+static int channel_recv(lua_State* L)
+{
+	Channel* channel = static_cast<Channel*>(luaL_checkudata(L, 1, kChannel));
+	LuauTaskScheduler* scheduler = LuauTaskScheduler::get(L);
+
+	push_storage(L, 1);
+	int storage = lua_gettop(L);
+
+	if (channel->count > 0)
+	{
+		lua_rawgeti(L, storage, kValues);
+		int values = lua_gettop(L);
+
+		lua_rawgeti(L, values, channel->head + 1);
+		lua_pushnil(L);
+		lua_rawseti(L, values, channel->head + 1);
+		channel->head = (channel->head + 1) % channel->capacity;
+		channel->count--;
+
+		// Move a parked sender's value into the freed slot:
+		if (lua_State* T = pop_waiter(L, storage, kSenders, &channel->senders, kSenderValues))
+		{
+			lua_rawseti(L, values, (channel->head + channel->count) % channel->capacity + 1);
+			channel->count++;
+
+			lua_pushboolean(T, true);
+			scheduler->wake(T, L, 1);
+		}
+
+		lua_pushboolean(L, true);
+		return 2;
+	}
+
+	// Unbuffered channels (or zero capacity) take the value from a parked sender directly:
+	if (lua_State* T = pop_waiter(L, storage, kSenders, &channel->senders, kSenderValues))
+	{
+		lua_pushboolean(T, true);
+		scheduler->wake(T, L, 1);
+
+		lua_pushboolean(L, true);
+		return 2;
+	}
+
+	if (channel->closed)
+	{
+		lua_pushnil(L);
+		lua_pushboolean(L, false);
+		return 2;
+	}
+
+	lua_pushthread(L);
+	fifo_push(L, storage, kReceivers, &channel->receivers);
+
+	// Resumed by channel_send with (value, true), or by channel_close with (nil, false):
+	return lua_yield(L, 0);
+}
+
+static int channel_close(lua_State* L)
+{
+	Channel* channel = static_cast<Channel*>(luaL_checkudata(L, 1, kChannel));
+	if (channel->closed)
+	{
+		return 0;
+	}
+	channel->closed = true;
+
+	LuauTaskScheduler* scheduler = LuauTaskScheduler::get(L);
+
+	push_storage(L, 1);
+	int storage = lua_gettop(L);
+
+	while (lua_State* T = pop_waiter(L, storage, kReceivers, &channel->receivers))
+	{
+		lua_pushnil(T);
+		lua_pushboolean(T, false);
+		scheduler->wake(T, L, 2);
+	}
+
+	while (lua_State* T = pop_waiter(L, storage, kSenders, &channel->senders, kSenderValues))
+	{
+		lua_pop(L, 1);
+		lua_pushboolean(T, false);
+		scheduler->wake(T, L, 1);
+	}
+
+	lua_pop(L, 1);
+
+	return 0;
+}
+
+int task_signal(lua_State* L)
+{
+	Signal* signal = static_cast<Signal*>(lua_newuserdata(L, sizeof(Signal)));
+	fifo_init(&signal->waiters);
+	luaL_getmetatable(L, kSignal);
+	lua_setmetatable(L, -2);
+
+	create_storage(L, -1);
+
+	return 1;
+}
+
+int task_channel(lua_State* L)
+{
+	int capacity = luaL_optinteger(L, 1, 0);
+	luaL_argcheck(L, capacity >= 0, 1, "capacity must not be negative");
+
+	Channel* channel = static_cast<Channel*>(lua_newuserdata(L, sizeof(Channel)));
+	channel->capacity = capacity;
+	channel->head = 0;
+	channel->count = 0;
+	fifo_init(&channel->receivers);
+	fifo_init(&channel->senders);
+	channel->closed = false;
+	luaL_getmetatable(L, kChannel);
+	lua_setmetatable(L, -2);
+
+	create_storage(L, -1);
+
+	return 1;
+}
+
+static const luaL_Reg signal_methods[] = {
+	{"connect", signal_connect},
+	{"wait", signal_wait},
+	{"fire", task_signal_fire},
+	{nullptr, nullptr},
+};
+
+static const luaL_Reg channel_methods[] = {
+	{"send", channel_send},
+	{"recv", channel_recv},
+	{"close", channel_close},
+	{nullptr, nullptr},
+};
+
+static void create_metatable(lua_State* L, const char* name, const luaL_Reg* methods, lua_CFunction index)
+{
+	luaL_newmetatable(L, name);
+
+	if (methods)
+	{
+		lua_newtable(L);
+		luaL_register(L, nullptr, methods);
+		lua_setreadonly(L, -1, true);
+	}
+	else
+	{
+		lua_pushcfunction(L, index, "__index");
+	}
+	lua_setfield(L, -2, "__index");
+
+	lua_pushstring(L, "The metatable is locked");
+	lua_setfield(L, -2, "__metatable");
+
+	lua_pop(L, 1);
+}
+
+void task_sync_open(lua_State* L)
+{
+	create_metatable(L, kSignal, signal_methods, nullptr);
+	create_metatable(L, kConnection, nullptr, connection_index);
+	create_metatable(L, kChannel, channel_methods, nullptr);
+
+	// Weak-keyed storage for signal/channel state:
+	lua_newtable(L);
+	lua_newtable(L);
+	lua_pushstring(L, "k");
+	lua_setfield(L, -2, "__mode");
+	lua_setmetatable(L, -2);
+	lua_rawsetfield(L, LUA_REGISTRYINDEX, kSyncStorage);
+}
@@ -0,0 +1,14 @@
+#ifndef TASKSYNC_H
+#define TASKSYNC_H
+
+#include <lua.h>
+
+int task_signal(lua_State* L);
+int task_channel(lua_State* L);
+
+// Signal:fire, for firing signals from native code. Expects the signal followed by the values:
+int task_signal_fire(lua_State* L);
+
+void task_sync_open(lua_State* L);
+
+#endif
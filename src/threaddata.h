@@ -3,9 +3,37 @@
 
 #include <cstddef>
 
+// Scheduling lanes, highest first. Due tasks in a higher lane always run before those in a lower one:
+enum TaskPriority
+{
+	kPriorityHigh,
+	kPriorityNormal,
+	kPriorityLow,
+	kPriorityCount,
+};
+
 struct ThreadData
 {
 	size_t defer_depth;
+
+	// Inherited from the creating thread:
+	TaskPriority priority;
+
+	// Set for threads created as recyclable by LuauTaskScheduler::create_thread, which
+	// may be reset and returned to the thread pool once they finish cleanly. Cleared
+	// once the script has been handed the thread through coroutine.running:
+	bool recyclable;
+
+	// Set once a warning has been printed for this thread exceeding the resume budget:
+	bool budget_warned;
+
+	// Offloaded job this thread is parked on. Cleared on cancel so a late result is dropped:
+	void* pending_wait;
+
+	// fd and direction this thread is parked on for I/O, or -1. Looked up by value, as the watch
+	// holding the thread may be erased and a new one created for the same fd. Cleared on cancel too:
+	int pending_fd = -1;
+	int pending_direction = 0;
 };
 
 #endif
@@ -0,0 +1,28 @@
+#ifndef LUAUPI_TRACEBACK_H
+#define LUAUPI_TRACEBACK_H
+
+#include <lua.h>
+#include <cstring>
+
+namespace LuauPi
+{
+
+// Calls visit with the lua_Debug of each Luau frame on L's stack, innermost first, starting at level.
+// C functions are skipped. Does not allocate, so it is safe to use from allocation hooks:
+template <typename Visit>
+void for_each_frame(lua_State* L, int level, Visit visit)
+{
+	lua_Debug ar;
+	for (int i = level; lua_getinfo(L, i, "sln", &ar); i++)
+	{
+		if (strcmp(ar.what, "C") == 0)
+		{
+			continue;
+		}
+		visit(ar);
+	}
+}
+
+}
+
+#endif
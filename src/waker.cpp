@@ -0,0 +1,72 @@
+#include "waker.h"
+
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cmath>
+#include <ctime>
+#include <cstdint>
+
+using namespace LuauPi;
+
+Waker::Waker() : fd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+}
+
+Waker::~Waker()
+{
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+}
+
+void Waker::wake() const
+{
+	uint64_t one = 1;
+	ssize_t written = write(fd, &one, sizeof(one));
+	(void)written;
+}
+
+void Waker::reset() const
+{
+	uint64_t count;
+	ssize_t n = read(fd, &count, sizeof(count));
+	(void)n;
+}
+
+void Waker::wait(double timeout, std::initializer_list<int> extra_fds) const
+{
+	static constexpr size_t kMaxFds = 4;
+
+	pollfd fds[kMaxFds];
+	fds[0].fd = fd;
+	fds[0].events = POLLIN;
+	nfds_t n_fds = 1;
+	for (auto it = extra_fds.begin(); it != extra_fds.end() && n_fds < kMaxFds; ++it)
+	{
+		if (*it >= 0)
+		{
+			fds[n_fds].fd = *it;
+			fds[n_fds].events = POLLIN;
+			n_fds++;
+		}
+	}
+
+	if (timeout < 0)
+	{
+		ppoll(fds, n_fds, nullptr, nullptr);
+		return;
+	}
+
+	timespec ts;
+	double seconds = std::floor(timeout);
+	ts.tv_sec = static_cast<time_t>(seconds);
+	ts.tv_nsec = static_cast<long>((timeout - seconds) * 1e9);
+	ppoll(fds, n_fds, &ts, nullptr);
+}
+
+int Waker::get_fd() const
+{
+	return fd;
+}
@@ -0,0 +1,37 @@
+#ifndef LUAUPI_WAKER_H
+#define LUAUPI_WAKER_H
+
+#include <initializer_list>
+
+namespace LuauPi
+{
+
+// Wakes a thread blocked in wait() from another thread or a signal handler. Backed by an eventfd.
+class Waker
+{
+private:
+	int fd;
+
+public:
+	Waker();
+	~Waker();
+
+	Waker(const Waker&) = delete;
+	Waker& operator=(const Waker&) = delete;
+
+	// Async-signal-safe:
+	void wake() const;
+
+	// Clears pending wake-ups. Must happen before checking for the work they announce:
+	void reset() const;
+
+	// Blocks until woken, until one of extra_fds is readable, or until timeout seconds have passed.
+	// A negative timeout waits indefinitely. Negative fds are ignored:
+	void wait(double timeout, std::initializer_list<int> extra_fds = {}) const;
+
+	int get_fd() const;
+};
+
+}
+
+#endif
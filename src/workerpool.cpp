@@ -0,0 +1,107 @@
+#include "workerpool.h"
+
+#include <algorithm>
+
+#include "realtime.h"
+
+using namespace LuauPi;
+
+static constexpr unsigned int kMinWorkers = 2;
+
+WorkerPool::WorkerPool() : detached(0)
+{
+	unsigned int count = std::max(kMinWorkers, std::thread::hardware_concurrency());
+	for (unsigned int i = 0; i < count; i++)
+	{
+		workers.emplace_back(&WorkerPool::worker_main, this);
+	}
+}
+
+WorkerPool& WorkerPool::get()
+{
+	// Started on first use:
+	static WorkerPool* pool = new WorkerPool();
+	return *pool;
+}
+
+void WorkerPool::worker_main()
+{
+	Realtime::configure_background_thread();
+
+	while (true)
+	{
+		WorkerJob* job;
+		{
+			std::unique_lock<std::mutex> lock(jobs_mutex);
+			jobs_cv.wait(lock, [this]() {
+				return !jobs.empty();
+			});
+
+			job = jobs.front();
+			jobs.pop_front();
+		}
+
+		job->work();
+
+		if (!job->sink)
+		{
+			delete job;
+
+			std::lock_guard<std::mutex> lock(jobs_mutex);
+			if (--detached == 0)
+			{
+				detached_cv.notify_all();
+			}
+			continue;
+		}
+
+		std::shared_ptr<JobSink> sink = std::move(job->sink);
+		std::lock_guard<std::mutex> lock(sink->mutex);
+		if (sink->orphaned)
+		{
+			// Its scheduler has closed, so nothing will take the result:
+			delete job;
+		}
+		else if (sink->done.push(job))
+		{
+			sink->waker->wake();
+		}
+	}
+}
+
+void WorkerPool::submit(WorkerJob* job)
+{
+	{
+		std::lock_guard<std::mutex> lock(jobs_mutex);
+		jobs.push_back(job);
+	}
+	jobs_cv.notify_one();
+}
+
+void WorkerPool::submit_detached(std::function<void()> work)
+{
+	WorkerJob* job = new WorkerJob();
+	job->work = std::move(work);
+	job->thread_ref = LUA_NOREF;
+	job->next = nullptr;
+
+	{
+		std::lock_guard<std::mutex> lock(jobs_mutex);
+		detached++;
+		jobs.push_back(job);
+	}
+	jobs_cv.notify_one();
+}
+
+void WorkerPool::wait_detached()
+{
+	std::unique_lock<std::mutex> lock(jobs_mutex);
+	detached_cv.wait(lock, [this]() {
+		return detached == 0;
+	});
+}
+
+size_t WorkerPool::get_worker_count() const
+{
+	return workers.size();
+}
@@ -0,0 +1,84 @@
+#ifndef LUAUPI_WORKERPOOL_H
+#define LUAUPI_WORKERPOOL_H
+
+#include <lua.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "mpscqueue.h"
+#include "waker.h"
+
+namespace LuauPi
+{
+
+struct WorkerJob;
+
+// Where a scheduler's finished jobs are queued, and how it is woken. Shared with the jobs still out,
+// so those finishing after the scheduler has closed are freed by their worker instead:
+struct JobSink
+{
+	MpscQueue<WorkerJob> done;
+	const Waker* waker;
+
+	std::mutex mutex;
+	// Set under mutex as the scheduler closes, after which waker is gone:
+	bool orphaned;
+
+	explicit JobSink(const Waker* waker) : waker(waker), orphaned(false)
+	{
+	}
+};
+
+struct WorkerJob
+{
+	// Runs on a worker thread:
+	std::function<void()> work;
+
+	// Runs on the scheduler's thread once work has finished. Pushes the values the
+	// task resumes with onto T and returns their count, or pushes an error and returns -1:
+	std::function<int(lua_State* T)> complete;
+
+	// Where the finished job is queued, or null for a detached job:
+	std::shared_ptr<JobSink> sink;
+
+	int thread_ref;
+	WorkerJob* next;
+};
+
+// Process-wide pool of threads for blocking work, shared by every actor:
+class WorkerPool
+{
+private:
+	std::vector<std::thread> workers;
+	std::mutex jobs_mutex;
+	std::condition_variable jobs_cv;
+	std::deque<WorkerJob*> jobs;
+
+	// Detached jobs not yet finished, guarded by jobs_mutex:
+	size_t detached;
+	std::condition_variable detached_cv;
+
+	WorkerPool();
+	void worker_main();
+
+public:
+	// Never destroyed, so exiting does not wait on workers stuck in blocking calls:
+	static WorkerPool& get();
+
+	void submit(WorkerJob* job);
+	// Runs work with no scheduler waiting on it, e.g. the final flush of a collected file:
+	void submit_detached(std::function<void()> work);
+	// Blocks until every detached job has finished, so their effects are not lost at exit:
+	void wait_detached();
+	size_t get_worker_count() const;
+};
+
+}
+
+#endif